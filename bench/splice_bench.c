@@ -0,0 +1,157 @@
+/**
+ * Socket-to-file receive benchmark. A sender thread streams 16 KiB blocks over
+ * loopback TCP; the receiver stores them in a file either by recv() into a
+ * buffer followed by storage_write(), or by splice() from the socket into a
+ * pipe and from the pipe into the file (the --splice path). Reports MB/s and
+ * the CPU time spent in the process for each, per storage backend.
+ *
+ * Build and run with: make bench && ./splice_bench [MiB] [path]
+ */
+
+#define _GNU_SOURCE     // For splice
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "storage.h"
+
+#define BENCH_BLOCK_LENGTH (16 * 1024)
+#define BENCH_DEFAULT_MIB 512
+
+typedef struct {
+    double wall;
+    double cpu;
+} Sample;
+
+typedef struct {
+    int sock_fd;
+    uint64_t length;
+} SenderArgs;
+
+static Sample sample_now(void) {
+    struct timespec ts;
+    struct rusage usage;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    getrusage(RUSAGE_SELF, &usage);
+    Sample s = {
+        .wall = ts.tv_sec + ts.tv_nsec / 1e9,
+        .cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6
+    };
+    return s;
+}
+
+static void *sender_main(void *arg) {
+    SenderArgs *sender = arg;
+    uint8_t block[BENCH_BLOCK_LENGTH];
+    memset(block, 0xA5, sizeof(block));
+    for (uint64_t sent = 0; sent < sender->length; ) {
+        ssize_t n = send(sender->sock_fd, block, sizeof(block), 0);
+        if (n <= 0) break;
+        sent += n;
+    }
+    shutdown(sender->sock_fd, SHUT_WR);
+    return NULL;
+}
+
+// Connected loopback TCP pair, like a peer connection
+static int connect_pair(int fds[2]) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0 };
+    socklen_t addr_length = sizeof(addr);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &addr_length) != 0) {
+        if (listener >= 0) close(listener);
+        return -1;
+    }
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[0] < 0 || connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(listener);
+        return -1;
+    }
+    fds[1] = accept(listener, NULL, NULL);
+    close(listener);
+    return fds[1] < 0 ? -1 : 0;
+}
+
+// Receive length bytes into the file. Returns bytes stored.
+static uint64_t receive(int sock_fd, uint64_t length, bool use_splice) {
+    uint64_t stored = 0;
+    if (use_splice) {
+        int pipe_fds[2];
+        if (pipe(pipe_fds) != 0) return 0;
+        while (stored < length) {
+            size_t want = length - stored < BENCH_BLOCK_LENGTH ? length - stored : BENCH_BLOCK_LENGTH;
+            ssize_t n = splice(sock_fd, NULL, pipe_fds[1], NULL, want, SPLICE_F_MOVE);
+            if (n <= 0 || storage_splice_from(pipe_fds[0], stored, (size_t)n) != 0) break;
+            stored += n;
+        }
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+    } else {
+        uint8_t *buffer = storage_alloc_buffer(BENCH_BLOCK_LENGTH);
+        if (!buffer) return 0;
+        while (stored < length) {
+            size_t want = length - stored < BENCH_BLOCK_LENGTH ? length - stored : BENCH_BLOCK_LENGTH;
+            ssize_t n = recv(sock_fd, buffer, want, 0);
+            if (n <= 0 || storage_write(stored, buffer, (size_t)n) != 0) break;
+            stored += n;
+        }
+        free(buffer);
+    }
+    return stored;
+}
+
+static void run(StorageBackend backend, const char *path, uint64_t length, bool use_splice) {
+    remove(path);
+    StorageFileSpec spec = { .path = path, .length = length };
+    if (storage_open(&spec, 1, backend, false, NULL) != 0) {
+        perror("splice_bench: storage_open");
+        return;
+    }
+    int fds[2];
+    if (connect_pair(fds) != 0) {
+        perror("splice_bench: loopback connection");
+        storage_close();
+        return;
+    }
+
+    pthread_t sender_thread;
+    SenderArgs sender = { .sock_fd = fds[0], .length = length };
+    Sample start = sample_now();
+    pthread_create(&sender_thread, NULL, sender_main, &sender);
+    uint64_t stored = receive(fds[1], length, use_splice);
+    pthread_join(sender_thread, NULL);
+    Sample end = sample_now();
+
+    // The CPU time includes the sender thread, which is the same in both modes
+    printf("%-7s %-12s %9.1f MB/s  %6.2f s CPU%s\n", storage_backend_name(storage_get_backend()),
+        use_splice ? "splice" : "recv+write", stored / (end.wall - start.wall) / 1e6, end.cpu - start.cpu,
+        stored == length ? "" : "  (failed)");
+    close(fds[0]);
+    close(fds[1]);
+    storage_close();
+}
+
+int main(int argc, char **argv) {
+    uint64_t mib = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_DEFAULT_MIB;
+    const char *path = argc > 2 ? argv[2] : "splice_bench.tmp";
+    if (mib == 0) mib = BENCH_DEFAULT_MIB;
+    uint64_t length = mib * 1024 * 1024;
+
+    printf("Receiving %lu MiB over loopback TCP into %s\n", mib, path);
+    StorageBackend backends[] = { STORAGE_BACKEND_PREAD, STORAGE_BACKEND_MMAP, STORAGE_BACKEND_DIRECT };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        run(backends[i], path, length, false);
+        run(backends[i], path, length, true);
+    }
+    remove(path);
+    return 0;
+}
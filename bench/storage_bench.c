@@ -0,0 +1,128 @@
+/**
+ * Output file storage benchmark. For each backend, writes a file piece by piece
+ * in shuffled order (like a swarm download), then serves random 16 KiB blocks
+ * (like uploading) and reads it back sequentially (like a recheck). Reports
+ * MB/s and the CPU time spent in the process for each phase.
+ *
+ * Build and run with: make bench && ./storage_bench [file MiB] [path]
+ * Reads are served from the page cache unless it is dropped between runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "storage.h"
+
+#define BENCH_PIECE_LENGTH (256 * 1024)
+#define BENCH_BLOCK_LENGTH (16 * 1024)
+#define BENCH_DEFAULT_MIB 512
+
+typedef struct {
+    double wall;
+    double cpu;
+} Sample;
+
+static Sample sample_now(void) {
+    struct timespec ts;
+    struct rusage usage;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    getrusage(RUSAGE_SELF, &usage);
+    Sample s = {
+        .wall = ts.tv_sec + ts.tv_nsec / 1e9,
+        .cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6
+    };
+    return s;
+}
+
+static void report(const char *phase, uint64_t bytes, Sample start) {
+    Sample end = sample_now();
+    printf("  %-18s %9.1f MB/s  %6.2f s CPU\n", phase, bytes / (end.wall - start.wall) / 1e6, end.cpu - start.cpu);
+}
+
+static int run_backend(StorageBackend backend, const char *path, uint64_t file_length, const uint8_t *piece_data) {
+    remove(path);
+    StorageFileSpec spec = { .path = path, .length = file_length };
+    if (storage_open(&spec, 1, backend, false, NULL) != 0) {
+        perror("storage_bench: storage_open");
+        return -1;
+    }
+    printf("%s%s\n", storage_backend_name(storage_get_backend()),
+        storage_get_backend() != backend ? " (fallback)" : "");
+
+    uint32_t num_pieces = file_length / BENCH_PIECE_LENGTH;
+    uint32_t *order = malloc(num_pieces * sizeof(uint32_t));
+    uint8_t *block = NULL;
+    if (posix_memalign((void **)&block, STORAGE_DIRECT_ALIGNMENT, BENCH_PIECE_LENGTH) != 0) block = NULL;
+    if (!order || !block) {
+        free(order);
+        free(block);
+        storage_close();
+        return -1;
+    }
+    for (uint32_t i = 0; i < num_pieces; i++) order[i] = i;
+    srand(417);
+    for (uint32_t i = num_pieces - 1; i > 0; i--) {
+        uint32_t j = rand() % (i + 1);
+        uint32_t tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+    }
+
+    Sample start = sample_now();
+    for (uint32_t i = 0; i < num_pieces; i++) {
+        storage_write((uint64_t)order[i] * BENCH_PIECE_LENGTH, piece_data, BENCH_PIECE_LENGTH);
+    }
+    storage_sync();
+    report("write pieces", file_length, start);
+
+    storage_advise(0, file_length, STORAGE_ACCESS_RANDOM);
+    uint64_t num_blocks = file_length / BENCH_BLOCK_LENGTH;
+    start = sample_now();
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        storage_read(((uint64_t)rand() % num_blocks) * BENCH_BLOCK_LENGTH, block, BENCH_BLOCK_LENGTH);
+    }
+    report("random 16K reads", num_blocks * BENCH_BLOCK_LENGTH, start);
+
+    storage_advise(0, file_length, STORAGE_ACCESS_SEQUENTIAL);
+    start = sample_now();
+    for (uint32_t i = 0; i < num_pieces; i++) {
+        storage_read((uint64_t)i * BENCH_PIECE_LENGTH, block, BENCH_PIECE_LENGTH);
+    }
+    report("sequential reads", file_length, start);
+
+    free(order);
+    free(block);
+    storage_close();
+    remove(path);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t file_mib = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_DEFAULT_MIB;
+    const char *path = argc > 2 ? argv[2] : "storage_bench.tmp";
+    if (file_mib == 0) file_mib = BENCH_DEFAULT_MIB;
+    uint64_t file_length = file_mib * 1024 * 1024;
+
+    uint8_t *piece_data = NULL;
+    if (posix_memalign((void **)&piece_data, STORAGE_DIRECT_ALIGNMENT, BENCH_PIECE_LENGTH) != 0) piece_data = NULL;   // Lets DIRECT skip the page cache
+    if (!piece_data) {
+        fprintf(stderr, "storage_bench: out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < BENCH_PIECE_LENGTH; i++) {
+        piece_data[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    printf("%llu MiB file at %s, %d KiB pieces\n", (unsigned long long)file_mib, path, BENCH_PIECE_LENGTH / 1024);
+    const StorageBackend backends[] = { STORAGE_BACKEND_STDIO, STORAGE_BACKEND_MMAP, STORAGE_BACKEND_PREAD, STORAGE_BACKEND_DIRECT };
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        if (run_backend(backends[b], path, file_length, piece_data) != 0) {
+            free(piece_data);
+            return 1;
+        }
+    }
+
+    free(piece_data);
+    return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * Tracker response parsing benchmark. Builds announce responses with compact
+ * peer lists of several sizes, frames each one with Content-Length, as 1 KiB
+ * chunks, and delimited by the connection closing, then feeds it to the HTTP
+ * parser in TCP-segment-sized pieces the way the receive loop does and parses
+ * the body. Reports MB/s of response bytes and ns per peer.
+ *
+ * Build and run with: make bench && ./tracker_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tracker_parser.h"
+#include "btclient.h"
+
+#define BENCH_BYTES_PER_RUN (256UL * 1024 * 1024)  // Parse this much per measurement
+#define BENCH_SEGMENT 1448                          // Bytes per receive, a typical TCP segment
+#define BENCH_CHUNK 1024                            // Chunk size for chunked responses
+
+// The parser logs through get_args(); the benchmark runs without debug output
+struct run_arguments get_args(void) {
+    struct run_arguments args;
+    memset(&args, 0, sizeof(args));
+    return args;
+}
+
+typedef enum { FRAME_LENGTH, FRAME_CHUNKED, FRAME_CLOSE } Framing;
+
+static const char *framing_name(Framing framing) {
+    return framing == FRAME_LENGTH ? "content-length" : framing == FRAME_CHUNKED ? "chunked" : "close";
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A bencoded announce response with num_peers compact peers
+static char *make_body(int num_peers, size_t *len) {
+    size_t cap = num_peers * 6 + 128;
+    char *body = malloc(cap);
+    if (!body) return NULL;
+    size_t pos = snprintf(body, cap, "d8:completei%de10:incompletei%de8:intervali1800e12:min intervali900e5:peers%d:",
+        num_peers / 2, num_peers - num_peers / 2, num_peers * 6);
+    for (int i = 0; i < num_peers; i++) {
+        unsigned char *peer = (unsigned char *)body + pos + i * 6;
+        uint32_t address = 0x0a000000u + i;
+        peer[0] = address >> 24;
+        peer[1] = address >> 16;
+        peer[2] = address >> 8;
+        peer[3] = address;
+        peer[4] = 0x1a;
+        peer[5] = 0xe1;
+    }
+    pos += num_peers * 6;
+    body[pos++] = 'e';
+    *len = pos;
+    return body;
+}
+
+// The full HTTP response carrying body
+static char *make_response(const char *body, size_t body_len, Framing framing, size_t *len) {
+    size_t cap = body_len + body_len / BENCH_CHUNK * 16 + 256;
+    char *response = malloc(cap);
+    if (!response) return NULL;
+    size_t pos;
+    if (framing == FRAME_LENGTH) {
+        pos = snprintf(response, cap, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n\r\n", body_len);
+        memcpy(response + pos, body, body_len);
+        pos += body_len;
+    } else if (framing == FRAME_CHUNKED) {
+        pos = snprintf(response, cap, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n");
+        for (size_t done = 0; done < body_len; ) {
+            size_t size = body_len - done < BENCH_CHUNK ? body_len - done : BENCH_CHUNK;
+            pos += snprintf(response + pos, cap - pos, "%zx\r\n", size);
+            memcpy(response + pos, body + done, size);
+            pos += size;
+            memcpy(response + pos, "\r\n", 2);
+            pos += 2;
+            done += size;
+        }
+        pos += snprintf(response + pos, cap - pos, "0\r\n\r\n");
+    } else {
+        pos = snprintf(response, cap, "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n");
+        memcpy(response + pos, body, body_len);
+        pos += body_len;
+    }
+    *len = pos;
+    return response;
+}
+
+// Receive response the way http_exchange does and parse it; returns the number of peers, -1 on failure
+static int receive_and_parse(const char *response, size_t response_len) {
+    HttpResponseParser parser;
+    http_parser_init(&parser);
+    size_t len = 0, max_len = 4096, offset = 0;
+    char *buf = malloc(max_len);
+    int parsed = 0;
+    while (buf && (parsed = http_parser_feed(&parser, buf, &len)) == 0) {
+        size_t wanted = http_parser_expected_size(&parser) + 1;
+        if (wanted > max_len || len + 1 >= max_len) {
+            size_t new_len = wanted > max_len ? wanted : max_len * 2;
+            char *grown = realloc(buf, new_len);
+            if (!grown) break;
+            buf = grown;
+            max_len = new_len;
+        }
+        size_t segment = response_len - offset;
+        if (segment == 0) {
+            parsed = http_parser_finish(&parser);
+            break;
+        }
+        if (segment > BENCH_SEGMENT) segment = BENCH_SEGMENT;
+        if (segment > max_len - len - 1) segment = max_len - len - 1;
+        memcpy(buf + len, response + offset, segment);
+        len += segment;
+        offset += segment;
+    }
+    int num_peers = -1;
+    TrackerResponse result;
+    if (buf && parsed > 0) {
+        buf[parser.body_start + parser.body_len] = '\0';
+        if (parse_response(&result, buf + parser.body_start, parser.body_len) == 0) {
+            num_peers = result.num_peers;
+            free_tracker_response(&result);
+        }
+    }
+    free(buf);
+    return num_peers;
+}
+
+int main(void) {
+    const int peer_counts[] = { 50, 1000, 50000 };
+    const Framing framings[] = { FRAME_LENGTH, FRAME_CHUNKED, FRAME_CLOSE };
+
+    printf("%-8s %-15s %10s %12s %10s\n", "peers", "framing", "bytes", "MB/s", "ns/peer");
+    for (size_t c = 0; c < sizeof(peer_counts) / sizeof(peer_counts[0]); c++) {
+        size_t body_len;
+        char *body = make_body(peer_counts[c], &body_len);
+        for (size_t f = 0; body && f < sizeof(framings) / sizeof(framings[0]); f++) {
+            size_t response_len;
+            char *response = make_response(body, body_len, framings[f], &response_len);
+            if (!response || receive_and_parse(response, response_len) != peer_counts[c]) {
+                fprintf(stderr, "tracker_bench: %d peers with %s framing didn't parse\n", peer_counts[c], framing_name(framings[f]));
+                free(response);
+                free(body);
+                return 1;
+            }
+            size_t rounds = BENCH_BYTES_PER_RUN / response_len;
+            if (rounds == 0) rounds = 1;
+
+            double start = now_seconds();
+            for (size_t r = 0; r < rounds; r++) {
+                receive_and_parse(response, response_len);
+            }
+            double elapsed = now_seconds() - start;
+            printf("%-8d %-15s %10zu %12.1f %10.2f\n", peer_counts[c], framing_name(framings[f]), response_len,
+                (double)rounds * response_len / elapsed / 1e6, elapsed * 1e9 / ((double)rounds * peer_counts[c]));
+            free(response);
+        }
+        free(body);
+    }
+    return 0;
+}
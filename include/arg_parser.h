@@ -3,6 +3,13 @@
 #include <argp.h>
 #include <stdbool.h>
 
+#define ARG_KEY_SPARSE 0x100    // Long-only options use keys outside the printable range
+#define ARG_KEY_READ_CACHE 0x101
+#define ARG_KEY_WRITE_THROUGH 0x102
+#define ARG_KEY_SPLICE 0x103
+#define ARG_KEY_BUFFER_MEMORY 0x104
+#define ARG_KEY_HUGE_PAGES 0x105
+
 // Holds parsed run arguments for the client
 struct run_arguments {
     int debug_mode;             // If debug mode should be enabled (writes output to log file)
@@ -11,6 +18,13 @@ struct run_arguments {
     char *peer_ip;              // Hardcoded peer address
     int peer_port;              // Hardcoded peer port
     bool seed_after;            // Seed after download complete
+    int storage_backend;        // StorageBackend used for the output file (pread unless -S is given)
+    bool sparse_file;           // Don't reserve disk space for the output file up front
+    int read_cache_mb;          // Memory cap of the upload read cache in MiB, 0 disables it
+    bool write_through;         // Write blocks to disk as they arrive instead of buffering whole pieces
+    bool splice_receive;        // Splice block payloads from sockets straight into the file (implies write_through)
+    int buffer_memory_mb;       // Budget for in-flight piece buffers in MiB
+    bool huge_pages;            // Back the piece buffer pool with transparent huge pages
 };
 
 /**
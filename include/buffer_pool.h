@@ -0,0 +1,65 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BUFFER_POOL_DEFAULT_MB 256                      // Piece buffer budget when --buffer-memory isn't given
+#define BUFFER_POOL_BLOCK_SLOT (16 * 1024 + 64)         // A 16 KiB block plus room for its message header
+#define BUFFER_POOL_BLOCK_SLOTS 64                      // Block-sized buffers kept in the pool
+#define BUFFER_POOL_HUGE_PAGE_SIZE (2UL * 1024 * 1024)  // Arenas are rounded and aligned to this with --huge-pages
+
+// Counters for the debug log
+typedef struct {
+    uint64_t slab_allocations;          // Buffers handed out from a slab
+    uint64_t heap_fallbacks;            // Buffers that didn't fit a size class or found their slab full
+    size_t piece_bytes_in_use;          // Piece-sized buffers currently handed out, counted against the budget
+    size_t peak_piece_bytes;            // Highest piece_bytes_in_use seen
+    size_t budget_bytes;                // Memory budget for piece-sized buffers
+    bool huge_pages;                    // Arenas were advised to use transparent huge pages
+} BufferPoolStats;
+
+/**
+ * @brief Reserve the slabs: one for standard pieces, one for the shorter last piece and one for 16 KiB blocks.
+ * Slots are page aligned (so O_DIRECT can use them) and only touched when first handed out. Event loop only.
+ * @param piece_length Standard piece length, or 0 if pieces aren't buffered (write-through mode).
+ * @param last_piece_length Length of the last piece (0 or piece_length if it needs no class of its own).
+ * @param budget_bytes Memory for piece-sized buffers; the piece slab holds this many bytes' worth of pieces.
+ * @param huge_pages Advise the kernel to back the arenas with transparent huge pages.
+ * @return 0 on success, -1 on failure (allocations then come from the heap).
+ */
+int buffer_pool_init(size_t piece_length, size_t last_piece_length, size_t budget_bytes, bool huge_pages);
+
+/**
+ * @brief Unmap the slabs. Every pooled buffer must have been freed.
+ */
+void buffer_pool_destroy(void);
+
+/**
+ * @brief Get a buffer from the smallest size class it fits in, or from the heap if it fits none or that slab is full.
+ * @param length Bytes needed.
+ * @return The buffer (page aligned if it came from a piece slab), or NULL on failure.
+ */
+void *buffer_pool_alloc(size_t length);
+
+/**
+ * @brief Return a buffer from buffer_pool_alloc.
+ * @param buffer Buffer to free (NULL is ignored).
+ * @param length The length it was allocated with.
+ */
+void buffer_pool_free(void *buffer, size_t length);
+
+/**
+ * @brief Check whether another piece-sized buffer would take piece buffers over the budget. The piece picker
+ * asks this before starting a new piece.
+ * @param length Length of the buffer about to be allocated.
+ */
+bool buffer_pool_over_budget(size_t length);
+
+/**
+ * @brief Get the allocation counters.
+ */
+void buffer_pool_get_stats(BufferPoolStats *stats);
+
+#endif
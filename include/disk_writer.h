@@ -0,0 +1,77 @@
+#ifndef DISK_WRITER_H
+#define DISK_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DISK_WRITER_MEMORY_BUDGET (64UL * 1024 * 1024)  // Queued piece bytes above which the network side stops requesting
+#define DISK_WRITER_MAX_COALESCE (16UL * 1024 * 1024)   // Upper bound on the bytes merged into one pwritev call
+
+// A finished write, handed back to the event loop so the piece's buffer can be released
+typedef struct {
+    uint32_t piece_index;
+    size_t length;                  // Bytes that were queued for the piece
+    bool ok;                        // false if the data could not be written
+} DiskWriteResult;
+
+/**
+ * @brief Start the disk I/O thread. The storage module must already be open with a backend that is safe to use
+ * from another thread (anything but stdio).
+ * @return 0 on success, -1 on failure (callers then write synchronously).
+ */
+int disk_writer_init(void);
+
+/**
+ * @brief Write out everything still queued, then stop and join the thread. Results not yet polled are dropped.
+ */
+void disk_writer_destroy(void);
+
+/**
+ * @brief Queue a verified piece for writing. The buffer must stay valid and unchanged until its result is polled.
+ * @param piece_index Piece the data belongs to (returned in the result).
+ * @param offset Absolute file offset.
+ * @param data Piece data.
+ * @param length Bytes to write.
+ * @return 0 if queued, -1 if the writer isn't running or can't take the write (caller should write synchronously).
+ */
+int disk_writer_submit(uint32_t piece_index, uint64_t offset, const uint8_t *data, size_t length);
+
+/**
+ * @brief Run a task on the disk I/O thread, before any write queued after it (e.g. saving fast-resume state, so
+ * the event loop never waits on its syncs). Only one task is queued at a time.
+ * @param run Called on the disk I/O thread with arg, which it owns from then on.
+ * @return 0 if queued, -1 if the writer isn't running or already has a task queued (run is not called).
+ */
+int disk_writer_submit_task(void (*run)(void *arg), void *arg);
+
+/**
+ * @brief Take finished writes off the completion list. Call from the event loop.
+ * @param results Output array.
+ * @param max_results Capacity of results.
+ * @return Number of results written.
+ */
+int disk_writer_poll_completed(DiskWriteResult *results, int max_results);
+
+/**
+ * @brief Block until every queued write has reached the storage module and a queued task has run (e.g. before syncing
+ * for fast-resume).
+ */
+void disk_writer_flush(void);
+
+/**
+ * @brief Get the bytes queued or being written whose results haven't been polled yet.
+ */
+size_t disk_writer_queued_bytes(void);
+
+/**
+ * @brief Check whether queued writes exceed DISK_WRITER_MEMORY_BUDGET, in which case no new blocks should be requested.
+ */
+bool disk_writer_over_budget(void);
+
+/**
+ * @brief Check whether the disk I/O thread is running.
+ */
+bool disk_writer_running(void);
+
+#endif
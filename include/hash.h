@@ -6,6 +6,16 @@
 
 struct sha1sum_ctx;
 
+/* SHA-1 implementations. The fastest available one is picked at runtime the
+ * first time a context is created: SHA-NI when the CPU has the SHA
+ * extensions, OpenSSL EVP otherwise. AVX2_MB is the 8-lane multi-buffer
+ * kernel, used only by sha1sum_many for batches of equal-length payloads. */
+enum sha1sum_engine {
+	SHA1SUM_ENGINE_EVP,
+	SHA1SUM_ENGINE_SHANI,
+	SHA1SUM_ENGINE_AVX2_MB
+};
+
 /* This takes an initial salt and salt length and returns a context that can
  * be used with the other functions. If len is 0, salt can be NULL. Returns
  * NULL on error */
@@ -35,6 +45,28 @@ int sha1sum_reset(struct sha1sum_ctx*);
  * the context */
 int sha1sum_destroy(struct sha1sum_ctx*);
 
+/* Hash a single payload with a reusable per-thread context. Never allocates
+ * after the first call on a thread. Returns 0 on success. */
+int sha1sum_oneshot(const uint8_t *payload, size_t len, uint8_t *out);
+
+/* Hash count payloads of the same length, writing one 20 byte checksum per
+ * payload into out. Batches go through the AVX2 multi-buffer kernel when it
+ * is selected, otherwise each payload is hashed in turn. Returns 0 on
+ * success. */
+int sha1sum_many(const uint8_t *const *payloads, size_t len, uint8_t (*out)[20], size_t count);
+
+/* Returns 1 if the engine can run on this CPU, 0 otherwise. */
+int sha1sum_engine_available(enum sha1sum_engine engine);
+
+/* Override the runtime choice (used by the benchmark). Contexts created
+ * before the call keep their engine. Selecting AVX2_MB, or passing
+ * multi_buffer, routes sha1sum_many through the multi-buffer kernel. Returns
+ * 0 on success, 1 if the engine is unavailable. */
+int sha1sum_select_engine(enum sha1sum_engine engine, int multi_buffer);
+
+/* Human readable name of the engine in use. */
+const char *sha1sum_engine_name(void);
+
 /**
  * @brief Take the first 8 bytes of the hash.
  * 
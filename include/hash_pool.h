@@ -0,0 +1,59 @@
+#ifndef HASH_POOL_H
+#define HASH_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sha1sum_ctx;
+
+#define HASH_POOL_QUEUE_SIZE 1024          // Capacity of the job and result queues (must be a power of two)
+#define HASH_POOL_MAX_WORKERS 16           // Upper bound on hashing threads
+
+// A piece handed to the hashing workers, and handed back to the event loop with the verdict filled in
+typedef struct {
+    uint32_t piece_index;                  // Piece being verified
+    struct sha1sum_ctx *ctx;               // Running hash of the piece's prefix to continue, or NULL to hash data from scratch
+    const uint8_t *data;                   // Remaining payload to hash (owned by the piece manager, must not change while queued)
+    size_t length;                         // Remaining payload length in bytes
+    // Payload that is already on disk instead of in memory (data is NULL): read_payload streams it back from
+    // payload_offset in chunks. Needs ctx, and read_payload must be safe to call from a worker thread.
+    int (*read_payload)(uint64_t offset, uint8_t *buffer, size_t length);
+    uint64_t payload_offset;
+    uint8_t expected_hash[20];             // SHA-1 from the .torrent metafile
+    bool verified;                         // Result: true if the SHA-1 matched
+} HashJob;
+
+/**
+ * @brief Start the hashing worker threads.
+ * @param num_workers Number of threads, or 0 to use one per online core (leaving one for the event loop).
+ * @return 0 on success, -1 on failure.
+ */
+int hash_pool_init(int num_workers);
+
+/**
+ * @brief Stop and join the worker threads. Jobs still queued are dropped.
+ */
+void hash_pool_destroy(void);
+
+/**
+ * @brief Queue a piece for verification. Never blocks (the queue is lock-free).
+ * @param job Piece to hash, copied into the queue.
+ * @return 0 if queued, -1 if the pool isn't running or the queue is full (caller should verify inline).
+ */
+int hash_pool_submit(const HashJob *job);
+
+/**
+ * @brief Take one finished job off the result queue. Call from the event loop only.
+ * @param job Output for the finished job.
+ * @return true if a result was returned, false if none are ready.
+ */
+bool hash_pool_poll_result(HashJob *job);
+
+/**
+ * @brief Get how many submitted jobs have not been collected with hash_pool_poll_result yet.
+ * @return Number of jobs in flight.
+ */
+int hash_pool_in_flight(void);
+
+#endif
@@ -17,6 +17,12 @@
 
 #define MAX_OUTSTANDING_REQUESTS 10                 // Max number of requests "in-flight" per peer (arbitrary number 10, adjust as needed)
 #define MAX_PEERS 50                                // Max number of peers per torrent
+#define PEER_CONNECT_TIMEOUT_SECONDS 5              // Connects started by peer_manager_connect_peer fail after this long
+#define MAX_REQUEST_LENGTH (128 * 1024)             // Longer REQUESTs are refused (the usual cap; most clients ask for 16 KiB)
+
+// Work stealing (outside endgame): a peer with free request slots may take over a block queued at a slower peer
+#define STEAL_MIN_AGE_MS 2000                       // Only steal requests that have been in-flight at least this long
+#define STEAL_ETA_RATIO 4.0                         // Holder's expected completion time must be this many times worse than ours
 
 // Max number of incoming bytes based on the size of piece messages
 #define MAX_INCOMING_BYTES (MAX_OUTSTANDING_REQUESTS * (DEFAULT_BLOCK_LENGTH + 17))
@@ -30,12 +36,22 @@ typedef struct {
     unsigned char incoming_buffer[MAX_INCOMING_BYTES];
     size_t incoming_buffer_offset;                  // Bytes in use in incoming_buffer
 
+    // PIECE payload being spliced from the socket into the output file (--splice)
+    bool splice_active;                             // The bytes after incoming_buffer's consumed header are this payload
+    bool splice_failed;                             // File write failed, the rest of the payload is read and dropped
+    uint32_t splice_index, splice_begin;            // Block being received
+    uint32_t splice_length;                         // Payload length
+    uint32_t splice_received;                       // Payload bytes consumed from the socket so far
+    uint64_t splice_offset;                         // Where the payload goes in the torrent's data
+
     // Download/upload rate fields
     ssize_t bytes_sent;                             // Bytes sent since the last rate measure
     ssize_t bytes_recv;                             // Bytes received since the last rate measure
     struct timeval last_rate_time;                  // Last time a rate measure was taken
     double upload_rate;                             // Last measured upload rate (bits/sec)
     double download_rate;                           // Last measured download rate (bits/sec)
+    uint64_t total_bytes_recv;                      // Bytes received over the whole connection
+    time_t connected_at;                            // When the connection was made
 
     // For keepalive
     time_t last_keepalive_to_peer;                  // The last time a keepalive was sent to this peer
@@ -50,6 +66,7 @@ typedef struct {
         uint32_t index;
         uint32_t begin;
         uint32_t length;
+        struct timeval requested_at;                // When the request was sent (for work stealing)
     } outstanding_requests[MAX_OUTSTANDING_REQUESTS];
 
     // Connectivity info
@@ -58,6 +75,7 @@ typedef struct {
     uint16_t port;                                  // Port 0-65535 (big endian/network byte order)
     unsigned char id[20];                           // Unique peer ID
     bool we_initiated;                              // True if we initiated the connection, false if the peer initiated with us
+    bool connecting;                                // True while a non-blocking connect is in progress (polled for POLLOUT)
     
     // Manages if we can upload/download
     bool handshake_done;                            // True meaning handshake exchange is complete with this peer
@@ -97,6 +115,12 @@ int peer_manager_choke_peer(Peer *peer);
  */
 int peer_manager_unchoke_peer(Peer *peer);
 
+/**
+ * @brief Send have message to peer, announcing a newly verified piece
+ * @return 0 if successful, -1 otherwise
+ */
+int peer_manager_send_have(Peer *peer, uint32_t piece_index);
+
 /**
  * @brief Send bitfield to peer 
  * @return 0 if successful, -1 otherwise
@@ -109,6 +133,14 @@ int send_bitfield(Peer *peer);
  */
 int peer_manager_send_request(Peer *peer, uint32_t request_index, uint32_t request_begin, uint32_t request_length);
 
+/**
+ * @brief Work stealing outside of endgame. When peer has free request slots but no fresh blocks are left to request, re-request
+ * the oldest outstanding block (of a piece peer has) whose current holder is expected to finish it much later than peer would.
+ * The request is moved to peer and the slower copy is cancelled with peer_manager_send_cancel.
+ * @return 0 if a request was stolen and sent to peer, -1 otherwise (nothing worth stealing)
+ */
+int peer_manager_steal_request(Peer *peer);
+
 /** 
  * @brief Get the last time a keepalive message was sent to peer (this should ideally not exceed 120 seconds)
  * @return Seconds since the last keepalive message was sent to peer
@@ -134,6 +166,24 @@ int peer_manager_receive_messages(Peer *peer);
  */
 int peer_manager_add_peer(Torrent torrent, const struct sockaddr_in *addr, socklen_t addr_len);
 
+/**
+ * @brief Start connecting to the peer at addr without waiting. The peer is added right away with its socket polled
+ * for POLLOUT; call peer_manager_finish_connect when that fires.
+ * @return The peer's socket file descriptor, or -1 if the connect couldn't be started
+ */
+int peer_manager_connect_peer(Torrent torrent, const struct sockaddr_in *addr, socklen_t addr_len);
+
+/**
+ * @brief Complete a connection started by peer_manager_connect_peer whose socket polled writable, and send the handshake.
+ * @return 0 if connected, -1 if the connect failed (remove the peer)
+ */
+int peer_manager_finish_connect(Peer *peer);
+
+/**
+ * @brief Remove the peers whose connect hasn't finished within PEER_CONNECT_TIMEOUT_SECONDS.
+ */
+void peer_manager_drop_stalled_connects(void);
+
 /**
  * @brief Disconnect and remove a specified peer. Compacts the fds and peers arrays by filling the resulting empty hole when the peer is removed.
  * @return 0 if successful, -1 otherwise
@@ -0,0 +1,89 @@
+#ifndef PEER_POOL_H
+#define PEER_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PEER_POOL_CAPACITY 4096             // Candidates remembered; beyond this the lowest ranked idle one is dropped
+#define PEER_POOL_BUCKETS 8192              // Hash set buckets (power of two)
+#define PEER_POOL_TARGET_CONNECTIONS 30     // Outgoing connections kept open while downloading (MAX_PEERS leaves room for incoming)
+#define PEER_POOL_CONNECTS_PER_PASS 4       // Connects started per event loop pass
+#define PEER_POOL_RETRY_SECONDS 30          // Wait after a failed connect, doubling with each failure in a row
+#define PEER_POOL_MAX_FAILURES 6            // A candidate that failed this many times in a row is dropped
+#define PEER_POOL_RECONNECT_SECONDS 60      // Wait before reconnecting to a peer that was connected
+#define PEER_POOL_CANDIDATES_PER_SLOT 2     // Candidates wanted per free connection slot, since many won't answer
+#define PEER_CACHE_FILE_SUFFIX ".peers"     // The best peers of a run are kept next to the output file
+#define PEER_CACHE_MAX_PEERS 50             // Peers saved for the next start
+#define PEER_CACHE_MAX_AGE_SECONDS (7 * 24 * 3600)  // An older cache is ignored, its peers are likely gone
+
+/**
+ * @brief Set up an empty candidate pool.
+ * @return 0 on success, -1 on failure.
+ */
+int peer_pool_init(void);
+
+/**
+ * @brief Free the candidate pool.
+ */
+void peer_pool_destroy(void);
+
+/**
+ * @brief Add a candidate (from a tracker or any other source). A candidate already in the pool keeps its history.
+ * @param address IPv4 address (host byte order).
+ * @param port Port (host byte order).
+ * @return true if the candidate is new.
+ */
+bool peer_pool_add(uint32_t address, uint16_t port);
+
+/**
+ * @brief Pick the best ranked candidate that isn't in use or waiting out a backoff, and mark it in use until
+ * peer_pool_connect_result reports a failure or peer_pool_disconnected is called. Candidates are ranked by the
+ * throughput they gave in earlier connections, then by fewest failures, then untried ones first.
+ * @param address Filled with the candidate's address (host byte order).
+ * @param port Filled with the candidate's port (host byte order).
+ * @return true if a candidate was picked.
+ */
+bool peer_pool_next(uint32_t *address, uint16_t *port);
+
+/**
+ * @brief Record the outcome of a connect attempt to a candidate from peer_pool_next. A failure is retried after
+ * PEER_POOL_RETRY_SECONDS, doubling with each failure in a row, until PEER_POOL_MAX_FAILURES drops the candidate.
+ * @param connected true once the peer's handshake has arrived, false if the connect or the handshake failed.
+ */
+void peer_pool_connect_result(uint32_t address, uint16_t port, bool connected);
+
+/**
+ * @brief Record that a connection we made has closed, with what it delivered.
+ * @param bytes_received Bytes received over the connection.
+ * @param seconds Seconds the connection was open.
+ */
+void peer_pool_disconnected(uint32_t address, uint16_t port, uint64_t bytes_received, long seconds);
+
+/**
+ * @brief Save the candidates that delivered the most (by throughput, then by time connected) for the next start.
+ * Call after every connection has been closed, so their stats are in.
+ * @param path File to write, replaced atomically.
+ * @param info_hash Torrent the peers belong to.
+ * @return The number of peers saved, or -1 on failure.
+ */
+int peer_pool_save(const char *path, const unsigned char info_hash[20]);
+
+/**
+ * @brief Add the peers saved by peer_pool_save to the pool, with their history, so they are connected first.
+ * @param path File written by peer_pool_save.
+ * @param info_hash Torrent being downloaded; a cache for any other torrent is ignored.
+ * @return The number of peers added, or -1 if there is no usable cache.
+ */
+int peer_pool_load(const char *path, const unsigned char info_hash[20]);
+
+/**
+ * @brief Get the number of candidates in the pool.
+ */
+int peer_pool_size(void);
+
+/**
+ * @brief Get the number of candidates peer_pool_next could pick right now (not in use, not backing off).
+ */
+int peer_pool_available(void);
+
+#endif
@@ -8,31 +8,19 @@
 #include "peer_manager.h"   // For Peer's bitfield context (optional here)
 
 #define DEFAULT_BLOCK_LENGTH 16384 // 16 KiB, common block request size
+#define RESUME_FILE_SUFFIX ".resume" // Fast-resume state is kept next to the output file
+#define INLINE_HASH_MAX_BYTES (2 * DEFAULT_BLOCK_LENGTH) // Unhashed tail at completion small enough to finish on the event loop
+#define WRITE_THROUGH_AUTO_PIECE_LENGTH (8u * 1024 * 1024) // Pieces this large are always written through instead of buffered
+#define WRITE_THROUGH_CATCHUP_BLOCKS 16 // Early blocks read back per received block to keep a write-through piece's hash moving
 
 // Represents the client's state regarding a piece
 typedef enum {
     PIECE_STATE_MISSING,    // Don't have, not requested
     PIECE_STATE_PENDING,    // Some/all blocks requested, not yet verified
+    PIECE_STATE_VERIFYING,  // All blocks received, SHA-1 check queued on the hashing pool
     PIECE_STATE_HAVE        // All blocks received and verified
 } PieceState;
 
-// Internal tracking for each piece of the torrent
-typedef struct {
-    uint32_t index;                 // Piece index (0 to N-1)
-    PieceState state;               // Current download state of this piece
-    uint8_t *data_buffer;           // Buffer for incoming block data
-    uint32_t piece_length;          // Actual byte length of this piece
-    uint8_t expected_hash[20];      // SHA-1 hash from .torrent metafile
-
-    uint32_t num_total_blocks;      // How many blocks make up this piece
-    bool *block_status_received;    // Tracks received blocks for this piece
-    uint32_t num_blocks_received;   // Count of blocks successfully received
-    bool *block_requested;
-
-    // For rarest-first strategy (extra credit)
-    int peer_availability_count;  // How many connected peers have this piece
-} ManagedPiece;
-
 /**
  * @brief Initialize piece manager with torrent data and output file.
  * @param torrent Parsed torrent file metadata.
@@ -56,6 +44,24 @@ void piece_manager_destroy(void);
  */
 int piece_manager_record_block_received(uint32_t piece_index, uint32_t begin, const uint8_t *block_data, uint32_t block_length);
 
+/**
+ * @brief Check whether a block may be received straight into the output file (e.g. with splice()) instead of
+ * through piece_manager_record_block_received. Only in write-through mode, for a block still missing.
+ * @param piece_index Index of the piece.
+ * @param begin Byte offset within the piece.
+ * @param block_length Length of the block.
+ * @param file_offset_out Output for the block's absolute offset in the torrent's data.
+ * @return true if the caller may write the block there and then call piece_manager_record_block_on_disk.
+ */
+bool piece_manager_splice_target(uint32_t piece_index, uint32_t begin, uint32_t block_length, uint64_t *file_offset_out);
+
+/**
+ * @brief Record a block the caller has already put in the output file (see piece_manager_splice_target). Hashing
+ * reads it back from the page cache.
+ * @return 0 on success, -1 on error or verification failure.
+ */
+int piece_manager_record_block_on_disk(uint32_t piece_index, uint32_t begin, uint32_t block_length);
+
 /**
  * @brief Check if all blocks for a piece have been received.
  * @param piece_index Index of the piece.
@@ -64,12 +70,56 @@ int piece_manager_record_block_received(uint32_t piece_index, uint32_t begin, co
 bool piece_manager_is_piece_payload_complete(uint32_t piece_index);
 
 /**
- * @brief Verify a completed piece against its SHA-1 hash and write to file.
+ * @brief Verify a completed piece against its SHA-1 hash and write to file. Finishes the piece's running hash
+ * if it has one, so only the not yet hashed tail is read.
  * @param piece_index Index of the piece to verify.
  * @return true if verified and processed, false otherwise.
  */
 bool piece_manager_verify_and_write_piece(uint32_t piece_index);
 
+/**
+ * @brief Collect verification results from the hashing pool. Verified pieces are written to file and marked HAVE,
+ * failed pieces are reset for re-download. Call regularly from the event loop.
+ * @param verified_out Output for the indices of pieces that just became HAVE (so HAVE messages can be sent).
+ * @param max_verified Capacity of verified_out.
+ * @return Number of indices written to verified_out.
+ */
+int piece_manager_process_verified_pieces(uint32_t *verified_out, int max_verified);
+
+/**
+ * @brief Get the number of completed pieces still waiting for their hash check.
+ * @return Pieces in PIECE_STATE_VERIFYING.
+ */
+int piece_manager_get_pieces_verifying_count(void);
+
+/**
+ * @brief Get the number of verified pieces still queued on the disk writer (their buffers are held until written).
+ * @return Pieces waiting to be written.
+ */
+int piece_manager_get_pieces_writing_count(void);
+
+/**
+ * @brief Check whether verified pieces waiting for the disk exceed the write memory budget. While true, no new blocks
+ * should be requested, so a slow disk throttles the download instead of growing memory use.
+ * @return true if requests should be held back.
+ */
+bool piece_manager_write_backlog_full(void);
+
+/**
+ * @brief Save fast-resume state next to the output file. Received blocks of unfinished pieces are flushed to the
+ * output file first, so a restart can reload them instead of downloading them again. Waits for queued writes and
+ * syncs, so it is meant for shutdown; see piece_manager_queue_resume_save.
+ * @return 0 on success, -1 on failure.
+ */
+int piece_manager_save_resume_state(void);
+
+/**
+ * @brief Like piece_manager_save_resume_state, but the flush, sync and file write happen on the disk I/O thread (or
+ * inline if it isn't running), leaving out pieces whose writes are still queued. Call periodically.
+ * @return 0 if the save was queued (or one is still in progress), -1 on failure.
+ */
+int piece_manager_queue_resume_save(void);
+
 /**
  * @brief Select a piece that a peer has and we need.
  * @param peer_bitfield Peer's bitfield of available pieces.
@@ -88,6 +138,14 @@ bool piece_manager_select_piece_for_peer(const uint8_t *peer_bitfield, size_t pe
  */
 bool piece_manager_get_block_to_request_from_piece(uint32_t piece_idx, uint32_t *begin_out, uint32_t *length_out);
 
+/**
+ * @brief Give up on a block requested through piece_manager_get_block_to_request_from_piece that won't arrive, so
+ * it can be requested again.
+ * @param piece_index Index of the piece.
+ * @param begin The block's starting offset.
+ */
+void piece_manager_release_block_request(uint32_t piece_index, uint32_t begin);
+
 /**
  * @brief Get the client's current bitfield of verified pieces.
  * @param bitfield Output for pointer to the bitfield.
@@ -108,6 +166,13 @@ void piece_manager_update_peer_availability(uint32_t piece_index, bool peer_has_
  */
 bool piece_manager_is_download_complete(void);
 
+/**
+ * @brief Get the length of a piece (the last one can be shorter).
+ * @param piece_index Index of the piece.
+ * @return The length in bytes, 0 if there is no such piece.
+ */
+uint32_t piece_manager_get_piece_length(uint32_t piece_index);
+
 /**
  * @brief Get the current state of a piece.
  * @param piece_index Index of the piece.
@@ -142,7 +207,7 @@ uint64_t piece_manager_get_bytes_left_total(void);
 bool piece_manager_has_block(uint32_t piece_index, uint32_t block_offset);
 
 /**
- * @brief Read a block from the file into block buffer parameter.
+ * @brief Read a block into block buffer parameter, from the piece's buffer while its write is still queued, else from the file.
  * @param piece_idx Index of the piece from which block is needed.
  * @param begin Byte offset within the piece.
  * @param block_length Length of the block's data.
@@ -153,6 +218,4 @@ bool piece_manager_read_block(uint32_t piece_index, uint32_t begin, uint32_t blo
 
 int piece_manager_get_bytes_downloaded(void);
 
-ManagedPiece *piece_manager_get_all_managed_pieces(void);
-
 #endif // PIECE_MANAGER_H
\ No newline at end of file
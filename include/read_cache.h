@@ -0,0 +1,63 @@
+#ifndef READ_CACHE_H
+#define READ_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define READ_CACHE_DEFAULT_MB 64       // Memory cap when --read-cache isn't given
+
+// Counters for the debug log
+typedef struct {
+    uint64_t hits;                      // Block reads served from a cached piece
+    uint64_t misses;                    // Block reads that loaded their piece from disk
+    uint64_t evictions;                 // Pieces dropped to stay under the cap
+    size_t bytes_cached;                // Current memory held
+    size_t capacity_bytes;              // Memory cap
+} ReadCacheStats;
+
+/**
+ * @brief Set up the cache of whole pieces read for uploading.
+ * @param num_pieces Number of pieces in the torrent (cache entries are looked up by index).
+ * @param capacity_bytes Memory cap, or 0 to disable the cache.
+ * @return 0 on success, -1 on failure.
+ */
+int read_cache_init(uint32_t num_pieces, size_t capacity_bytes);
+
+/**
+ * @brief Free every cached piece.
+ */
+void read_cache_destroy(void);
+
+/**
+ * @brief Look up a piece and mark it most recently used.
+ * @param piece_index Piece to find.
+ * @return The piece's data, or NULL if it isn't cached (counts a miss).
+ */
+const uint8_t *read_cache_get(uint32_t piece_index);
+
+/**
+ * @brief Add a piece just read from disk, evicting least recently used pieces to make room.
+ * @param piece_index Piece the data belongs to.
+ * @param data Whole piece, allocated with malloc. The cache takes ownership, or frees it if it can't be cached.
+ * @param length Piece length.
+ * @return data if it was cached, NULL if it was freed (larger than the whole cache, or the cache is disabled).
+ */
+const uint8_t *read_cache_insert(uint32_t piece_index, uint8_t *data, size_t length);
+
+/**
+ * @brief Drop a piece from the cache (e.g. its data on disk is no longer valid).
+ */
+void read_cache_invalidate(uint32_t piece_index);
+
+/**
+ * @brief Check whether the cache is enabled.
+ */
+bool read_cache_enabled(void);
+
+/**
+ * @brief Get the hit, miss and eviction counters.
+ */
+void read_cache_get_stats(ReadCacheStats *stats);
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct iovec;
+
+#define STORAGE_SYNC_INTERVAL 5          // Seconds between background fdatasync calls while there are unsynced writes
+#define STORAGE_DIRECT_ALIGNMENT 4096     // Offset, length and buffer alignment O_DIRECT transfers need
+#define STORAGE_FD_CACHE_MIN 8            // Open descriptor cache size bounds; within them it gets a quarter
+#define STORAGE_FD_CACHE_MAX 1024         // of RLIMIT_NOFILE, leaving the rest to sockets
+
+// How the output files are accessed. The piece manager only ever talks to them through this module, addressing
+// the torrent as one byte range; the module maps each range onto the files it covers.
+typedef enum {
+    STORAGE_BACKEND_STDIO,      // Buffered FILE* with fseeko/fwrite/fread (single-file torrents only)
+    STORAGE_BACKEND_MMAP,       // Whole file mapped shared; writes and reads are memcpy into/out of the page cache (single-file torrents only)
+    STORAGE_BACKEND_PREAD,      // Raw fd with pread/pwrite, no shared file position so safe from any thread
+    STORAGE_BACKEND_DIRECT      // PREAD, but aligned transfers bypass the page cache with O_DIRECT
+} StorageBackend;
+
+// Expected access pattern for a range of the file, passed on to the kernel as a readahead hint
+typedef enum {
+    STORAGE_ACCESS_SEQUENTIAL,  // Recheck, streaming reads
+    STORAGE_ACCESS_RANDOM,      // Serving blocks to peers
+    STORAGE_ACCESS_WILLNEED     // Range will be read soon, start reading it in now
+} StorageAccessHint;
+
+// One output file, in torrent order. A single-file torrent has exactly one.
+typedef struct {
+    const char *path;           // Where to write it; missing parent directories are created
+    uint64_t length;
+} StorageFileSpec;
+
+// Open descriptor cache counters, for the debug log. Files are opened on first use and the least recently used
+// idle ones closed to stay within the cap.
+typedef struct {
+    uint64_t hits;              // Transfers that found their file already open
+    uint64_t misses;            // Transfers that had to open it
+    uint64_t evictions;         // Idle files closed to make room
+    int open_fds;               // Descriptors open right now
+    int capacity;               // Cap, from RLIMIT_NOFILE
+} StorageFdCacheStats;
+
+/**
+ * @brief Open (or create) the output files and preallocate each to its full length.
+ * @param specs Files in torrent order; their lengths laid end to end make up the torrent's byte range.
+ * @param num_specs Number of files.
+ * @param backend Backend to use. Falls back to PREAD if the backend can't be set up (or needs a single file).
+ * @param sparse true to only set the file sizes, false to reserve disk blocks with fallocate.
+ * @param existed_out Optional output, set to true if any of the files was already there.
+ * @return 0 on success, -1 on failure.
+ */
+int storage_open(const StorageFileSpec *specs, int num_specs, StorageBackend backend, bool sparse, bool *existed_out);
+
+/**
+ * @brief Sync and close the output files.
+ */
+void storage_close(void);
+
+/**
+ * @brief Write bytes at an absolute torrent offset. A range crossing file boundaries is split, one call per file.
+ * @return 0 on success, -1 on failure.
+ */
+int storage_write(uint64_t offset, const uint8_t *data, size_t length);
+
+/**
+ * @brief Write several buffers back to back starting at an absolute torrent offset, with one pwritev per file
+ * where the backend allows. Safe to call from another thread with every backend but stdio.
+ * @param iov Buffers to write. The array may be modified.
+ * @param iovcnt Number of buffers.
+ * @return 0 on success, -1 on failure.
+ */
+int storage_writev(uint64_t offset, struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Read bytes at an absolute torrent offset, with one preadv per file the range covers.
+ * @return 0 on success, -1 on failure.
+ */
+int storage_read(uint64_t offset, uint8_t *buffer, size_t length);
+
+/**
+ * @brief Move bytes waiting in a pipe into the output file(s) at an absolute torrent offset with splice(), so they
+ * never pass through user space. Not available with the stdio backend.
+ * @param pipe_fd Read end of a pipe holding at least length bytes.
+ * @return 0 once all length bytes are in the page cache, -1 on failure (the pipe may still hold some of them).
+ */
+int storage_splice_from(int pipe_fd, uint64_t offset, size_t length);
+
+/**
+ * @brief Get a direct pointer into the file contents (MMAP backend only).
+ * @return Pointer to offset in the mapping, or NULL if the backend doesn't map the file or the range is out of bounds.
+ */
+const uint8_t *storage_map(uint64_t offset, size_t length);
+
+/**
+ * @brief Flush written data and file metadata to disk now.
+ * @return 0 on success, -1 on failure.
+ */
+int storage_sync(void);
+
+/**
+ * @brief fdatasync the files if there are unsynced writes and STORAGE_SYNC_INTERVAL has passed since the last sync.
+ * Writes themselves never sync, so call this regularly: the disk I/O thread does while it runs, else the event loop.
+ * @return 0 on success or if nothing was due, -1 on failure.
+ */
+int storage_sync_if_due(void);
+
+/**
+ * @brief Tell the kernel how a range of the file is about to be read. Best effort.
+ */
+void storage_advise(uint64_t offset, uint64_t length, StorageAccessHint hint);
+
+/**
+ * @brief Allocate a piece buffer suitable for storage_write. With the DIRECT backend it is aligned (and padded) so
+ * whole pieces can bypass the page cache. Release with free().
+ * @return The buffer, or NULL on failure.
+ */
+void *storage_alloc_buffer(size_t length);
+
+/**
+ * @brief Summarize the files' on-disk state, so fast-resume can tell whether anything touched them since a save.
+ * @param total_size_out Sum of the file sizes.
+ * @param mtime_sec_out Latest modification time of any file, seconds part.
+ * @param mtime_nsec_out Latest modification time of any file, nanoseconds part.
+ * @return 0 on success, -1 on failure.
+ */
+int storage_fingerprint(uint64_t *total_size_out, int64_t *mtime_sec_out, int64_t *mtime_nsec_out);
+
+/**
+ * @brief Get the file descriptor of a single-file torrent's output file (for private mappings).
+ * @return The descriptor, or -1 if closed or the torrent has several files.
+ */
+int storage_fd(void);
+
+/**
+ * @brief Get the number of non-empty output files.
+ */
+int storage_num_files(void);
+
+/**
+ * @brief Get the open descriptor cache's hit, miss and eviction counters.
+ */
+void storage_get_fd_cache_stats(StorageFdCacheStats *stats);
+
+/**
+ * @brief Get the backend actually in use (after any fallback).
+ */
+StorageBackend storage_get_backend(void);
+
+/**
+ * @brief Parse a backend name as given on the command line ("stdio", "mmap", "pread", "direct").
+ * @return The backend, or -1 if the name is unknown.
+ */
+int storage_backend_from_name(const char *name);
+
+/**
+ * @brief Name of a backend, for logs.
+ */
+const char *storage_backend_name(StorageBackend backend);
+
+#endif
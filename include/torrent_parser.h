@@ -51,7 +51,8 @@ typedef struct {
 
 typedef struct {
     char *announce;
-    char **announce_list;
+    char **announce_list;           // Every tracker of the announce-list, tier by tier
+    int *announce_tiers;            // Tier (BEP 12) of each announce_list entry, starting at 0
     int announce_list_count;
     time_t creation_date;
     char *comment;
@@ -1,26 +1,123 @@
-#include "peer_manager.h"
-#include "bencode.h"
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include <stdint.h>
 
 // tracker communication
 
-// NOTE: optional parameters have been LEFT OUT for now
+// NOTE: optional parameters other than numwant have been LEFT OUT for now
+
+#define TRACKER_TIMEOUT_SECONDS 15          // Longest wait for any one step (connect, TLS handshake, response)
+#define TRACKER_DEFAULT_INTERVAL 1800       // Re-announce interval when the tracker doesn't give one
+#define TRACKER_RETRY_SECONDS 15            // First retry after a failed announce, doubling up to the default interval
+#define TRACKER_THREADS 4                   // Announce threads started up front
+#define TRACKER_MAX_THREADS 32              // More are started while all are waiting on trackers, up to this many
+
+// Tracker host names (getaddrinfo gives no TTLs, so these stand in for them)
+#define TRACKER_DNS_TTL_SECONDS 300         // Addresses are looked up again after this long
+#define TRACKER_DNS_NEGATIVE_TTL_SECONDS 10 // A name that didn't resolve isn't tried again for this long
+#define TRACKER_DNS_CACHE 32                // Host names remembered
+#define TRACKER_DNS_MAX_ADDRESSES 8         // Addresses kept per name
+
+// HTTP(S) trackers
+#define TRACKER_HTTP_CONNECTION_CACHE 16    // Trackers whose keep-alive connection and TLS session are kept
+#define TRACKER_HTTP_KEEPALIVE_SECONDS 60   // Idle connections older than this are closed instead of reused
+
+// UDP trackers (BEP 15)
+#define TRACKER_UDP_BASE_TIMEOUT 15         // First UDP timeout, doubling with each retransmission (15 * 2^n)
+#define TRACKER_UDP_MAX_RETRANSMITS 2       // BEP 15 allows 8; fewer so a dead tracker fails over to the next one
+#define TRACKER_UDP_CONNECTION_TTL 60       // Seconds a connection ID may be reused
+#define TRACKER_UDP_CONNECTION_CACHE 16     // UDP trackers whose connection IDs are remembered
+#define TRACKER_UDP_MAX_DATAGRAM 65536      // Announce replies are read whole, however many peers they carry
+#define TRACKER_UDP_SCRAPE_MAX 74           // Info hashes per UDP scrape request
+
+// A peer as trackers list it (host byte order)
+typedef struct {
+    uint32_t address;
+    uint16_t port;
+} PeerEndpoint;
 
 typedef struct {
     int interval;
+    int min_interval;                       // Shortest re-announce interval the tracker allows, 0 if not given
     int complete;
     int incomplete;
     int num_peers;
-    Peer *peers;
+    PeerEndpoint *peers;
 } TrackerResponse;
 
+typedef struct {
+    int complete;                           // Seeders, -1 if the tracker didn't report the torrent
+    int downloaded;                         // Completed downloads
+    int incomplete;                         // Leechers
+} ScrapeResult;
+
 // send GET request to get list of peers
 // calls internal udp or http(s) helpers depending on protocol specified in announce URL
-TrackerResponse tracker_get(char *announce, unsigned char *info_hash, unsigned char *peer_id, 
-    int port, long uploaded, long downloaded, long left);
+// blocks for up to a few TRACKER_TIMEOUT_SECONDS, so the event loop uses tracker_announce_async instead
+// numwant is the number of peers to ask for, -1 for the tracker's default
+// returns 0 and fills response on success, -1 if the tracker couldn't be reached or refused the announce
+int tracker_get(TrackerResponse *response, const char *announce, unsigned char *info_hash, unsigned char *peer_id, 
+    int port, long uploaded, long downloaded, long left, int numwant);
 
 // scrape convention, calls internal helpers based on protocol
 // returns -1 if scrape is not supported for this tracker, 0 on success
-int scrape(TrackerResponse *response, char *announce, unsigned char *info_hash);
+int scrape(TrackerResponse *response, const char *announce, unsigned char *info_hash);
+
+/**
+ * @brief Scrape several torrents from one tracker. UDP trackers get TRACKER_UDP_SCRAPE_MAX info hashes per
+ * request and HTTP trackers all of them in one request.
+ * @param announce Announce URL of the tracker.
+ * @param info_hashes Info hashes of the torrents.
+ * @param count Number of info hashes.
+ * @param results Filled with one result per info hash, in the same order (fields are -1 for unknown torrents).
+ * @return 0 on success, -1 if the tracker doesn't support scraping or couldn't be reached.
+ */
+int tracker_scrape(const char *announce, const unsigned char (*info_hashes)[20], int count, ScrapeResult *results);
 
 // free list of peers
-void free_tracker_response(TrackerResponse *response);
\ No newline at end of file
+void free_tracker_response(TrackerResponse *response);
+
+/**
+ * @brief Start the threads that run announces off the event loop.
+ * @return 0 on success, -1 on failure (announces then run inline, blocking the caller).
+ */
+int tracker_client_init(void);
+
+/**
+ * @brief Stop the announce threads. Announces still waiting on a tracker are abandoned rather than waited for.
+ */
+void tracker_client_destroy(void);
+
+/**
+ * @brief Queue an announce for the announce threads. Event loop only.
+ * @param tag Caller's ID for the tracker, handed back with the result.
+ * @param numwant Number of peers to ask for, -1 for the tracker's default.
+ * @return 0 if queued, -1 on failure.
+ */
+int tracker_announce_async(int tag, const char *announce, const unsigned char *info_hash, const unsigned char *peer_id,
+    int port, long uploaded, long downloaded, long left, int numwant);
+
+/**
+ * @brief Queue a scrape of one torrent for the announce threads. Its result is polled like an announce's, with
+ * only complete and incomplete filled in. Event loop only.
+ * @param tag Caller's ID for the scrape, handed back with the result.
+ * @return 0 if queued, -1 on failure.
+ */
+int tracker_scrape_async(int tag, const char *announce, const unsigned char *info_hash);
+
+/**
+ * @brief Take one finished announce or scrape. Event loop only.
+ * @param tag Set to the tag the announce or scrape was queued with.
+ * @param response Filled with the tracker's answer when 1 is returned (free with free_tracker_response).
+ * @return 1 if a response arrived, -1 if the announce or scrape failed (or the tracker didn't know the torrent),
+ * 0 if none has finished.
+ */
+int tracker_poll_announce(int *tag, TrackerResponse *response);
+
+/**
+ * @brief Get how many queued announces haven't had their result collected yet.
+ */
+int tracker_announces_in_flight(void);
+
+#endif
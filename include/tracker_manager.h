@@ -0,0 +1,69 @@
+#ifndef TRACKER_MANAGER_H
+#define TRACKER_MANAGER_H
+
+#include <stdbool.h>
+
+#include "torrent_parser.h"
+#include "tracker.h"
+
+#define TRACKER_HEDGE_SECONDS 5     // A tier's next tracker is tried alongside one that has been quiet this long
+#define TRACKER_DEFAULT_MIN_INTERVAL 300    // Earliest early re-announce when the tracker gives no "min interval"
+#define TRACKER_NUMWANT_MAX 200     // Most peers asked for in one announce
+#define TRACKER_SCRAPE_INTERVAL 900 // A tier's swarm size is refreshed by a scrape when it is this old between announces
+
+/**
+ * @brief Set up the trackers to announce to and start the announce threads. With an announce-list the tiers
+ * come from it (BEP 12) and the announce URL is ignored; otherwise the announce URL is a tier of its own.
+ * The trackers within each tier are shuffled.
+ * @param torrent Torrent to announce (its URLs are copied).
+ * @param peer_id Our 20-byte peer ID.
+ * @param port Port we listen on.
+ * @return Number of trackers (0 if the torrent has none), or -1 on failure.
+ */
+int tracker_manager_init(const Torrent *torrent, const unsigned char *peer_id, int port);
+
+/**
+ * @brief Stop announcing and free the tracker list.
+ */
+void tracker_manager_destroy(void);
+
+/**
+ * @brief Start the announces and scrapes that are due. Every tier announces on its own schedule, so the peers from
+ * several tiers are merged and a dead tier never holds up the others. Within a tier, trackers are tried in order
+ * until one answers, which is then moved to the front. Call from the event loop.
+ *
+ * Each announce asks for peers_wanted peers (0 when we have enough). While peers are wanted, a tier announces
+ * again as soon as its min interval allows, unless its last answer already had fewer peers than were asked for.
+ * Between announces, a tier's lead tracker is scraped every TRACKER_SCRAPE_INTERVAL to keep the swarm size current.
+ * @param uploaded Bytes uploaded so far.
+ * @param downloaded Bytes downloaded so far.
+ * @param left Bytes still missing.
+ * @param peers_wanted Peers we would like to hear about.
+ */
+void tracker_manager_update(long uploaded, long downloaded, long left, int peers_wanted);
+
+/**
+ * @brief Take one tracker response that came in. Call until it returns false.
+ * @param response Filled with the response (free with free_tracker_response).
+ * @return true if a response was returned.
+ */
+bool tracker_manager_poll(TrackerResponse *response);
+
+/**
+ * @brief Get the size of the swarm (seeders plus leechers, including us) from the announces and scrapes so far,
+ * taking the largest any tier reported.
+ * @return The swarm size, or -1 if no tracker has reported it.
+ */
+int tracker_manager_swarm_size(void);
+
+/**
+ * @brief Get the seconds until the next tier is due to announce (0 if one is announcing or due now).
+ */
+long tracker_manager_seconds_until_announce(void);
+
+/**
+ * @brief Check whether any announce is waiting on a tracker.
+ */
+bool tracker_manager_busy(void);
+
+#endif
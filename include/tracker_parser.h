@@ -0,0 +1,66 @@
+#ifndef TRACKER_PARSER_H
+#define TRACKER_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tracker.h"
+
+#define TRACKER_MAX_RESPONSE_BYTES (1024 * 1024)    // Larger HTTP responses are cut off (and fail to parse)
+
+// Incremental parser for one HTTP response. It works in place on the caller's receive buffer: the body is left
+// (or, when chunked, compacted) at body_start, so it is never copied out.
+typedef struct {
+    int state;                      // Internal
+    size_t scanned;                 // Bytes of the buffer already looked at
+    size_t body_start;              // Offset of the body once the headers are in
+    size_t body_len;                // Body bytes in place so far
+    size_t chunk_left;              // Data bytes still to come in the current chunk
+    long content_length;            // -1 if the response didn't give one
+    bool chunked;
+    bool keep_alive;                // The tracker keeps the connection open after this response
+} HttpResponseParser;
+
+/**
+ * @brief Start parsing a new response.
+ */
+void http_parser_init(HttpResponseParser *parser);
+
+/**
+ * @brief Parse the bytes received since the last call. Chunk framing is stripped as it arrives, moving the chunk
+ * data down to the end of the body, so each byte is looked at and moved at most once however the response is split.
+ * @param buf Receive buffer, holding everything received for this response.
+ * @param len Bytes in buf; set to the bytes still in use, where the next receive should be appended.
+ * @return 1 once the response is complete, 0 if more is needed, -1 if it is malformed.
+ */
+int http_parser_feed(HttpResponseParser *parser, char *buf, size_t *len);
+
+/**
+ * @brief Get the buffer size the whole response needs, once the headers have given it.
+ * @return The size in bytes, or 0 if it isn't known (chunked, or delimited by the connection closing).
+ */
+size_t http_parser_expected_size(const HttpResponseParser *parser);
+
+/**
+ * @brief Tell the parser the tracker closed the connection.
+ * @return 1 if that completed the response (it had no length and ran until the close), -1 otherwise.
+ */
+int http_parser_finish(HttpResponseParser *parser);
+
+/**
+ * @brief Parse a bencoded announce response (an HTTP body). Compact peer lists are decoded straight from the body.
+ * @param out Filled on success (free with free_tracker_response).
+ * @return 0 on success, -1 if the tracker refused the announce or the body isn't a bencoded dictionary.
+ */
+int parse_response(TrackerResponse *out, const char *body, size_t body_len);
+
+/**
+ * @brief Parse a bencoded scrape response (an HTTP body), filling in the results of the torrents it lists.
+ * @param info_hashes Info hashes that were scraped.
+ * @param count Number of info hashes.
+ * @param results One per info hash; torrents the response doesn't list are left as they are.
+ */
+void parse_scrape_response(const char *body, size_t body_len, const unsigned char (*info_hashes)[20], int count,
+    ScrapeResult *results);
+
+#endif
@@ -4,6 +4,9 @@
 #include <stdbool.h>
 
 #include "arg_parser.h"
+#include "storage.h"
+#include "read_cache.h"
+#include "buffer_pool.h"
 
 // Parse and validate each command-line option
 // Stores an extracted value into its correct field inside args
@@ -45,6 +48,44 @@ error_t arg_parser(int key, char *arg, struct argp_state *state) {
 		args->seed_after = true;
 		break;
 	}
+	case 'S': {
+		args->storage_backend = storage_backend_from_name(arg);
+		if (args->storage_backend < 0) {
+			argp_error(state, "Unknown storage backend '%s', expected stdio, mmap, pread or direct", arg);
+		}
+		break;
+	}
+	case ARG_KEY_SPARSE: {
+		args->sparse_file = true;
+		break;
+	}
+	case ARG_KEY_READ_CACHE: {
+		args->read_cache_mb = atoi(arg);
+		if (args->read_cache_mb < 0) {
+			argp_error(state, "Read cache size must be a number of MiB (0 disables it)");
+		}
+		break;
+	}
+	case ARG_KEY_WRITE_THROUGH: {
+		args->write_through = true;
+		break;
+	}
+	case ARG_KEY_SPLICE: {
+		args->splice_receive = true;
+		args->write_through = true;     // Spliced blocks go to disk on arrival, there is no piece buffer to fill
+		break;
+	}
+	case ARG_KEY_BUFFER_MEMORY: {
+		args->buffer_memory_mb = atoi(arg);
+		if (args->buffer_memory_mb <= 0) {
+			argp_error(state, "Buffer memory must be a positive number of MiB");
+		}
+		break;
+	}
+	case ARG_KEY_HUGE_PAGES: {
+		args->huge_pages = true;
+		break;
+	}
 	default:
 		ret = ARGP_ERR_UNKNOWN;
 		break;
@@ -63,6 +104,13 @@ struct run_arguments arg_parseopt(int argc, char *argv[]) {
 		{ "peer-ip", 'A', "address", 0, "Only download from this peer", 0},
 		{ "peer-port", 'P', "peer port", 0, "Peer's port if --peer-ip is specified", 0},
 		{ "seed-after", 's', NULL, 0, "Seed after download complete", 0},
+		{ "storage", 'S', "backend", 0, "How the output file is accessed: stdio, mmap, pread (default) or direct (O_DIRECT)", 0},
+		{ "sparse", ARG_KEY_SPARSE, NULL, 0, "Create the output file sparse instead of reserving its disk space", 0},
+		{ "read-cache", ARG_KEY_READ_CACHE, "MiB", 0, "Memory for caching whole pieces served to peers (default 64, 0 disables)", 0},
+		{ "write-through", ARG_KEY_WRITE_THROUGH, NULL, 0, "Write blocks to disk as they arrive instead of holding whole pieces in memory (automatic for pieces of 8 MiB and up)", 0},
+		{ "splice", ARG_KEY_SPLICE, NULL, 0, "Experimental: move block payloads from sockets into the output file with splice() (implies --write-through, Linux only)", 0},
+		{ "buffer-memory", ARG_KEY_BUFFER_MEMORY, "MiB", 0, "Memory for pieces being downloaded; no new piece is started beyond it (default 256)", 0},
+		{ "huge-pages", ARG_KEY_HUGE_PAGES, NULL, 0, "Back piece buffers with transparent huge pages", 0},
 		{0}
 	};
 
@@ -70,6 +118,9 @@ struct run_arguments arg_parseopt(int argc, char *argv[]) {
 
 	struct run_arguments args;
 	memset(&args, 0, sizeof(args));
+	args.storage_backend = STORAGE_BACKEND_PREAD;	// Lets verified pieces be written from the disk I/O thread
+	args.read_cache_mb = READ_CACHE_DEFAULT_MB;
+	args.buffer_memory_mb = BUFFER_POOL_DEFAULT_MB;
 
 	if (argp_parse(&argp_settings, argc, argv, 0, NULL, &args) != 0) {
 		fprintf(stderr, "Error while parsing\n");
@@ -9,12 +9,17 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <time.h>
+#include <signal.h>
 
 #include "btclient.h"
 #include "torrent_parser.h"
 #include "peer_manager.h"
 #include "tracker.h"
+#include "tracker_manager.h"
+#include "peer_pool.h"
 #include "piece_manager.h"
+#include "storage.h"
+#include "disk_writer.h"
 
 // Useful ANSI codes (source: https://gist.github.com/fnky/458719343aabd01cfb17a3a4f7296797)
 #define CLEAR_SCREEN "\033[2J\033[H"    // Erase screen, move cursor to home position (0, 0)
@@ -36,10 +41,6 @@ static struct run_arguments args;
 static Torrent *current_torrent = NULL;
 static unsigned char client_peer_id[20];
 
-// Tracker refresh state
-static time_t last_tracker_request_time;
-static int tracker_interval_seconds;
-
 static time_t last_optimistic_unchoke_time = 0;
 #define OPTIMISTIC_UNCHOKE_INTERVAL 30 
 
@@ -47,6 +48,11 @@ static time_t last_choke_time = 0;
 #define CHOKING_INTERVAL 10
 #define MAX_UNCHOKED_PEERS 4
 
+static time_t last_resume_save_time = 0;
+#define RESUME_SAVE_INTERVAL 30
+
+static volatile sig_atomic_t stop_requested = 0;   // Set by SIGINT/SIGTERM to leave the main loop and save state
+
 struct run_arguments get_args(void) { 
     return args; 
 }
@@ -71,6 +77,11 @@ bool get_endgame(void) {
     return endgame;
 }
 
+static void handle_stop_signal(int signum) {
+    (void)signum;
+    stop_requested = 1;
+}
+
 // Prints progress bar (progress must be between 0 and 1)
 static void print_progress_bar(double progress) {
     int bar_width = 100;
@@ -113,7 +124,7 @@ void optimistic_unchoke(void) {
     
     // get a list of peers that we are currently choking and is interested in us
     for (int i = 0; i < *num_peers; i++) {
-        if (peers[i].choking && peers[i].is_interested) {
+        if (peers[i].choking && peers[i].is_interested && !peers[i].connecting) {
             potential_unchoke[num_potential] = i;
             num_potential++;
         }
@@ -216,6 +227,9 @@ void choke_peer(void) {
 
     for (int i = 0; i < *num_peers; i++) {
         int peer_idx = peer_indices[i];
+        if (peers[peer_idx].connecting) {
+            continue;   // Nothing can be sent before the connection is made
+        }
         if (!peers[peer_idx].is_interested) {
             if (peer_rates[i] > min_unchoked_rate || num_downloaders < MAX_UNCHOKED_PEERS) {
                 if (peers[peer_idx].choking) {
@@ -336,52 +350,94 @@ int client_listen(int port) {
     return 0;
 }
 
-// MODIFIED: connect_peers function
-void connect_peers(int num_peers_to_connect, TrackerResponse response_arg) {
-    if (num_peers_to_connect > 0) {
-        if (get_args().debug_mode) {
-            fprintf(stderr, "[BTCLIENT_CONNECT_PEERS]: Attempting to connect to %d peers from tracker list...\n", num_peers_to_connect);
-            fflush(stderr);
+// Add the peers from a tracker response to the candidate pool
+static void add_tracker_peers(const TrackerResponse *tracker_resp) {
+    int added = 0;
+    for (int k = 0; k < tracker_resp->num_peers; k++) {
+        if (peer_pool_add(tracker_resp->peers[k].address, tracker_resp->peers[k].port)) {
+            added++;
         }
-        for (int i = 0; i < num_peers_to_connect; i++) {
-            if (*get_num_peers() >= MAX_PEERS) {
-                if (get_args().debug_mode) {
-                    fprintf(stderr, "[BTCLIENT_CONNECT_PEERS]: Reached MAX_PEERS limit (%d), not attempting more connections from this tracker list.\n", MAX_PEERS);
-                    fflush(stderr);
-                }
-                break;
-            }
+    }
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: Tracker provided %d new peers, %d candidates in the pool.\n", added, peer_pool_size());
+        fflush(stderr);
+    }
+}
 
-            struct sockaddr_in peer_addr_sa;
-            memset(&peer_addr_sa, 0, sizeof(peer_addr_sa));
-            peer_addr_sa.sin_family = AF_INET;
-            peer_addr_sa.sin_port = htons(response_arg.peers[i].port);
-            peer_addr_sa.sin_addr.s_addr = htonl(response_arg.peers[i].address);
+// Connections worth keeping open: PEER_POOL_TARGET_CONNECTIONS, or fewer in a swarm too small to fill them
+static int connection_target(void) {
+    int target = PEER_POOL_TARGET_CONNECTIONS < MAX_PEERS ? PEER_POOL_TARGET_CONNECTIONS : MAX_PEERS;
+    int swarm_size = tracker_manager_swarm_size();
+    if (swarm_size >= 0 && swarm_size - 1 < target) {
+        target = swarm_size > 1 ? swarm_size - 1 : 1;   // Everyone but us, and at least one for cached or unlisted peers
+    }
+    return target;
+}
 
-            char peer_ip_log_str[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &(peer_addr_sa.sin_addr), peer_ip_log_str, INET_ADDRSTRLEN);
-            if (get_args().debug_mode) {
-                fprintf(stderr, "[BTCLIENT_CONNECT_PEERS]: Attempting to add peer %s:%d\n", peer_ip_log_str, ntohs(peer_addr_sa.sin_port));
-                fflush(stderr);
-            }
+// Peers to ask the trackers for: enough candidates to fill the free connection slots, none while seeding
+static int peers_wanted(void) {
+    if (piece_manager_is_download_complete()) {
+        return 0;
+    }
+    int free_slots = connection_target() - *get_num_peers();
+    return free_slots * PEER_POOL_CANDIDATES_PER_SLOT - peer_pool_available();
+}
 
-            int new_sock = peer_manager_add_peer(*current_torrent, &peer_addr_sa, sizeof(peer_addr_sa));
-            if (new_sock > 0) {
-                if (get_args().debug_mode) {
-                    fprintf(stderr, "[BTCLIENT_CONNECT_PEERS]: Initiated connection process for peer %s:%d. Peer socket: %d. Current num_fds: %d, num_peers: %d\n",
-                            peer_ip_log_str, ntohs(peer_addr_sa.sin_port), new_sock, *get_num_fds(), *get_num_peers());
-                    fflush(stderr);
-                }
+// Keep connection_target() connections open while downloading, taking the best candidates from the pool as slots
+// free up. Connects don't block: the event loop finishes them when their sockets poll writable.
+static void connect_pool_peers(void) {
+    peer_manager_drop_stalled_connects();
+    int target = connection_target();
+    if (piece_manager_is_download_complete()) {
+        return;
+    }
+    uint32_t address;
+    uint16_t port;
+    for (int attempts = 0; attempts < PEER_POOL_CONNECTS_PER_PASS && *get_num_peers() < target &&
+            peer_pool_next(&address, &port); attempts++) {
+        struct sockaddr_in peer_addr_sa;
+        memset(&peer_addr_sa, 0, sizeof(peer_addr_sa));
+        peer_addr_sa.sin_family = AF_INET;
+        peer_addr_sa.sin_port = htons(port);
+        peer_addr_sa.sin_addr.s_addr = htonl(address);
+
+        char peer_ip_log_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(peer_addr_sa.sin_addr), peer_ip_log_str, INET_ADDRSTRLEN);
+        int new_sock = peer_manager_connect_peer(*current_torrent, &peer_addr_sa, sizeof(peer_addr_sa));
+        if (new_sock == -1) {
+            peer_pool_connect_result(address, port, false);     // Otherwise reported once the connect finishes
+        }
+        if (get_args().debug_mode) {
+            if (new_sock != -1) {
+                fprintf(stderr, "[BTCLIENT_CONNECT_PEERS]: Connecting to pool peer %s:%u. Peer socket: %d. Current num_fds: %d, num_peers: %d\n",
+                        peer_ip_log_str, port, new_sock, *get_num_fds(), *get_num_peers());
             } else {
-                if (get_args().debug_mode) {
-                    fprintf(stderr, "[BTCLIENT_CONNECT_PEERS]: Failed to add peer %s:%d (sock_fd: %d).\n", peer_ip_log_str, ntohs(peer_addr_sa.sin_port), new_sock);
-                    fflush(stderr);
-                }
+                fprintf(stderr, "[BTCLIENT_CONNECT_PEERS]: Failed to connect to pool peer %s:%u.\n", peer_ip_log_str, port);
             }
+            fflush(stderr);
         }
     }
 }
 
+// Pool the peers from tracker responses that came in, then start any announces that are due
+static void update_tracker(void) {
+    TrackerResponse tracker_resp;
+    while (tracker_manager_poll(&tracker_resp)) {
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: New Tracker Response -> Interval: %d, Complete: %d, Incomplete: %d, Num Peers: %d\n",
+                    tracker_resp.interval, tracker_resp.complete, tracker_resp.incomplete, tracker_resp.num_peers);
+            fflush(stderr);
+        }
+        add_tracker_peers(&tracker_resp);
+        free_tracker_response(&tracker_resp);
+    }
+
+    long downloaded_for_tracker = piece_manager_get_bytes_downloaded_total();
+    long left_for_tracker = piece_manager_get_bytes_left_total();
+    long uploaded_for_tracker = 0; // Placeholder, update if upload tracking is added
+    tracker_manager_update(uploaded_for_tracker, downloaded_for_tracker, left_for_tracker, peers_wanted());
+}
+
 int main(int argc, char *argv[]) {
     printf(CLEAR_SCREEN);        // Clear the terminal screen for progress bar
     args = arg_parseopt(argc, argv);
@@ -448,16 +504,16 @@ int main(int argc, char *argv[]) {
 
     // srand(time(NULL));
     memcpy(client_peer_id, PEER_ID, sizeof(client_peer_id));
-    TrackerResponse response;
     char output_filename[1024];
 
     const char *output_filename_base = current_torrent->info.name ? current_torrent->info.name : "downloaded_file";
     snprintf(output_filename, sizeof(output_filename), "%s", output_filename_base);
+    char peer_cache_filename[sizeof(output_filename) + sizeof(PEER_CACHE_FILE_SUFFIX)];
+    snprintf(peer_cache_filename, sizeof(peer_cache_filename), "%s%s", output_filename, PEER_CACHE_FILE_SUFFIX);
 
     if (piece_manager_init(current_torrent, output_filename) != 0) {
         fprintf(stderr, "[BTCLIENT_MAIN]: Error: Failed to initialize piece manager.\n");
         fflush(stderr);
-        free_tracker_response(&response); 
         torrent_free(current_torrent);
         exit(1);
     }
@@ -479,33 +535,25 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
     } else {
-        response = tracker_get(current_torrent->announce, current_torrent->info_hash, client_peer_id, args.port, 0, 0, total_len);
-        if (get_args().debug_mode) {
-            fprintf(stderr, "[BTCLIENT_MAIN]: Initial Tracker Response -> Interval: %d, Complete: %d, Incomplete: %d, Num Peers: %d\n",
-                    response.interval, response.complete, response.incomplete, response.num_peers);
+        if (client_listen(args.port) != 0) {
+            fprintf(stderr, "[BTCLIENT_MAIN]: Error: Failed to start listening on port %d.\n", args.port);
             fflush(stderr);
+            torrent_free(current_torrent);
+            exit(1);
         }
-    
-        last_tracker_request_time = time(NULL);
-        tracker_interval_seconds = response.interval;
-        if (get_args().debug_mode) {
-            fprintf(stderr, "[BTCLIENT_MAIN]: Tracker interval set to %d seconds.\n", tracker_interval_seconds);
+        if (peer_pool_init() != 0) {
+            fprintf(stderr, "[BTCLIENT_MAIN]: Error: Failed to allocate the peer candidate pool.\n");
             fflush(stderr);
+            torrent_free(current_torrent);
+            exit(1);
         }
-    
-        int num_peers_from_tracker = response.num_peers;
-    
-        if (!get_args().peer_ip) {
-            if (client_listen(args.port) != 0) {
-                fprintf(stderr, "[BTCLIENT_MAIN]: Error: Failed to start listening on port %d.\n", args.port);
-                fflush(stderr);
-                free_tracker_response(&response);
-                torrent_free(current_torrent);
-                exit(1);
-            }
+        // Peers that served us well last time are connected right away, alongside the first announce
+        peer_pool_load(peer_cache_filename, current_torrent->info_hash);
+        // The first announces go out from the main loop; peers are pooled as each tracker answers and connected from the pool
+        if (tracker_manager_init(current_torrent, client_peer_id, args.port) <= 0) {
+            fprintf(stderr, "[BTCLIENT_MAIN]: Warning: The torrent has no usable tracker, waiting for incoming peers.\n");
+            fflush(stderr);
         }
-    
-        connect_peers(num_peers_from_tracker, response); // This was the first call to connect_peers
     }
 
     if (get_args().debug_mode) {
@@ -518,9 +566,17 @@ int main(int argc, char *argv[]) {
     time_t current_time = time(NULL);
     last_optimistic_unchoke_time = current_time;
     last_choke_time = current_time;
+    last_resume_save_time = current_time;
+
+    // No SA_RESTART, so a signal interrupts poll() and the loop exits promptly
+    struct sigaction stop_action = {0};
+    stop_action.sa_handler = handle_stop_signal;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
 
     int print_bar = 1;
-    while (1) {
+    while (!stop_requested) {
         optimistic_unchoke();
         choke_peer();
 
@@ -529,97 +585,14 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: Polling %d FDs. Active Peers: %d. Downloaded: %lu / %ld (%.2f%%). Tracker refresh in %ld s.\n",
                 *get_num_fds(), *get_num_peers(), piece_manager_get_bytes_downloaded_total(), total_len,
                 total_len > 0 ? (double)piece_manager_get_bytes_downloaded_total() * 100.0 / total_len : 0.0,
-                (last_tracker_request_time + tracker_interval_seconds) - time(NULL) > 0 ? (last_tracker_request_time + tracker_interval_seconds) - time(NULL) : 0);
+                tracker_manager_seconds_until_announce());
             fflush(stderr);
         }
 
-        // Periodic tracker re-query logic
+        // Periodic tracker re-query logic, then top up connections from the candidate pool
         if (!get_args().peer_ip) {
-            if (time(NULL) - last_tracker_request_time >= tracker_interval_seconds) {
-                if (get_args().debug_mode) {
-                    fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: Tracker interval elapsed (%ds). Re-contacting tracker.\n", tracker_interval_seconds);
-                    fflush(stderr);
-                }
-    
-                long downloaded_for_tracker = piece_manager_get_bytes_downloaded_total();
-                long left_for_tracker = piece_manager_get_bytes_left_total();
-                long uploaded_for_tracker = 0; // Placeholder, update if upload tracking is added
-    
-                TrackerResponse new_tracker_resp = tracker_get(current_torrent->announce, 
-                    current_torrent->info_hash, client_peer_id, args.port, uploaded_for_tracker, downloaded_for_tracker, left_for_tracker);
-    
-                if (get_args().debug_mode) {
-                    fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: New Tracker Response -> Interval: %d, Complete: %d, Incomplete: %d, Num Peers: %d\n",
-                            new_tracker_resp.interval, new_tracker_resp.complete, new_tracker_resp.incomplete, new_tracker_resp.num_peers);
-                    fflush(stderr);
-                }
-    
-                tracker_interval_seconds = new_tracker_resp.interval;
-                 if (get_args().debug_mode) {
-                    fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: Next tracker refresh interval set to %d seconds.\n", tracker_interval_seconds);
-                    fflush(stderr);
-                }
-    
-                if (new_tracker_resp.num_peers > 0 && *get_num_peers() < MAX_PEERS) {
-                    Peer *existing_peers_array = get_peers();
-                    int current_num_peers = *get_num_peers();
-                    Peer *candidate_peers_for_connection = malloc(new_tracker_resp.num_peers * sizeof(Peer));
-                    int num_candidate_peers_to_connect = 0;
-    
-                    if (candidate_peers_for_connection) {
-                        for (int k = 0; k < new_tracker_resp.num_peers; k++) {
-                            // Ensure we don't exceed MAX_PEERS considering already connected and newly found candidates
-                            if (current_num_peers + num_candidate_peers_to_connect >= MAX_PEERS) {
-                                 if (get_args().debug_mode) {
-                                    fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: MAX_PEERS would be exceeded by adding more candidates, stopping peer scan from tracker.\n");
-                                    fflush(stderr);
-                                }
-                                break;
-                            }
-    
-                            bool already_connected = false;
-                            for (int j = 0; j < current_num_peers; j++) {
-                                if (existing_peers_array[j].address == htonl(new_tracker_resp.peers[k].address) &&
-                                    existing_peers_array[j].port == htons(new_tracker_resp.peers[k].port)) {
-                                    already_connected = true;
-                                    break;
-                                }
-                            }
-                            if (!already_connected) {
-                                if (get_args().debug_mode) {
-                                    char new_peer_ip_str[INET_ADDRSTRLEN];
-                                    struct in_addr new_peer_addr_struct;
-                                    new_peer_addr_struct.s_addr = htonl(new_tracker_resp.peers[k].address);
-                                    inet_ntop(AF_INET, &new_peer_addr_struct, new_peer_ip_str, INET_ADDRSTRLEN);
-                                    fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: Tracker provided new peer %s:%u for connection attempt.\n",
-                                            new_peer_ip_str, new_tracker_resp.peers[k].port);
-                                    fflush(stderr);
-                                }
-                                candidate_peers_for_connection[num_candidate_peers_to_connect++] = new_tracker_resp.peers[k];
-                            }
-                        }
-    
-                        if (num_candidate_peers_to_connect > 0) {
-                            TrackerResponse temp_connect_arg_response;
-                            temp_connect_arg_response.peers = candidate_peers_for_connection;
-                            temp_connect_arg_response.num_peers = num_candidate_peers_to_connect;
-                            temp_connect_arg_response.interval = new_tracker_resp.interval; 
-                            temp_connect_arg_response.complete = new_tracker_resp.complete; 
-                            temp_connect_arg_response.incomplete = new_tracker_resp.incomplete;
-                            
-                            connect_peers(num_candidate_peers_to_connect, temp_connect_arg_response);
-                        }
-                        free(candidate_peers_for_connection);
-                    } else if (new_tracker_resp.num_peers > 0) { // Malloc failed but there were peers to process
-                         if (get_args().debug_mode) {
-                            fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: Failed to allocate memory for candidate peers list. Skipping new connections this cycle.\n");
-                            fflush(stderr);
-                        }
-                    }
-                }
-                free_tracker_response(&new_tracker_resp); 
-                last_tracker_request_time = time(NULL);
-            }
+            update_tracker();
+            connect_pool_peers();
         }
 
         // Enable endgame mode if applicable
@@ -649,6 +622,11 @@ int main(int argc, char *argv[]) {
         }*/
         
         int poll_timeout_ms = 1000; // 1 second timeout
+        if (piece_manager_get_pieces_verifying_count() > 0 || piece_manager_get_pieces_writing_count() > 0) {
+            poll_timeout_ms = 10;   // Come back soon to collect hashing and disk write results
+        } else if (tracker_manager_busy()) {
+            poll_timeout_ms = 100;  // Pick up the tracker's peers soon after it answers
+        }
         int poll_result = poll(fds, *get_num_fds(), poll_timeout_ms);
 
         if (poll_result == -1) {
@@ -697,6 +675,16 @@ int main(int argc, char *argv[]) {
                 continue; // num_fds changed, so re-evaluate loop condition and current fds[i]
             }
 
+            if (current_peer_ptr->connecting) {
+                // Outgoing connect still in progress: writable means it finished, one way or the other
+                if ((fds[i].revents & POLLOUT) && peer_manager_finish_connect(current_peer_ptr) != 0) {
+                    peer_manager_remove_peer(current_peer_ptr);
+                    continue;
+                }
+                i++;
+                continue;
+            }
+
             if (fds[i].revents & POLLIN) {
                 // current_peer_ptr should still be valid unless POLLOUT removed it.
                 // If it was removed by POLLOUT, `continue` was hit.
@@ -724,7 +712,9 @@ int main(int argc, char *argv[]) {
                 break; // Or continue to next poll() cycle
             }
             // current_peer_ptr = &peers[i - 1];
-            if (current_peer_ptr->handshake_done && !current_peer_ptr->choked && current_peer_ptr->is_interesting && current_peer_ptr->bitfield != NULL) {
+            // Hold back new requests while the disk is behind (backpressure from the disk writer)
+            if (current_peer_ptr->handshake_done && !current_peer_ptr->choked && current_peer_ptr->is_interesting && current_peer_ptr->bitfield != NULL &&
+                !piece_manager_write_backlog_full()) {
                 while (current_peer_ptr->num_outstanding_requests < MAX_OUTSTANDING_REQUESTS) {
                     uint32_t block_begin_offset;
                     uint32_t block_length;
@@ -762,6 +752,10 @@ int main(int argc, char *argv[]) {
                         }
                     }
                     if (!found_block_to_request_this_iteration) {
+                        // No fresh blocks left, try taking over a block stuck at a slower peer
+                        if (peer_manager_steal_request(current_peer_ptr) == 0) {
+                            continue;
+                        }
                         break;
                     }
                 }
@@ -784,6 +778,34 @@ int main(int argc, char *argv[]) {
             i++; // Move to the next fd ONLY if no peer was removed 
         }
 
+        // Collect pieces verified by the hashing pool and announce them to every peer
+        uint32_t verified_pieces[64];
+        int num_verified;
+        while ((num_verified = piece_manager_process_verified_pieces(verified_pieces, 64)) > 0) {
+            for (int v = 0; v < num_verified; v++) {
+                for (int p = 0; p < *get_num_peers(); p++) {
+                    if (peers[p].handshake_done) {
+                        peer_manager_send_have(&peers[p], verified_pieces[v]);
+                    }
+                }
+            }
+            if (print_bar) {
+                print_progress_bar(total_len > 0 ? (double)piece_manager_get_bytes_downloaded_total() / total_len : 0.0);
+            }
+        }
+
+        // Piece writes don't sync; push them to disk in one batch every few seconds (the disk I/O thread does this
+        // itself when it is running, so the event loop never waits on fdatasync)
+        if (!disk_writer_running() && storage_sync_if_due() != 0 && get_args().debug_mode) {
+            fprintf(stderr, "[BTCLIENT_MAIN_LOOP]: Warning: Syncing the output file failed: %s\n", strerror(errno));
+            fflush(stderr);
+        }
+
+        if (time(NULL) - last_resume_save_time >= RESUME_SAVE_INTERVAL) {
+            piece_manager_queue_resume_save();
+            last_resume_save_time = time(NULL);
+        }
+
         peer_manager_send_keep_alives();
         // TODO: for uploads to work we should not be breaking when we're done downloading
         if (piece_manager_is_download_complete() && print_bar) {
@@ -799,14 +821,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Free initial tracker response (original variable name was 'response')
-    if (!get_args().peer_ip) {
-        free_tracker_response(&response);
-    }
-    if (get_args().debug_mode) {
-        fprintf(stderr, "[BTCLIENT_MAIN]: Freed initial tracker response data.\n");
-        fflush(stderr);
-    }
+    tracker_manager_destroy();
 
     printf("\n");                // Exit progress bar cleanly
 
@@ -846,11 +861,19 @@ int main(int argc, char *argv[]) {
             }
         }
     }
+    if (!get_args().peer_ip) {
+        peer_pool_save(peer_cache_filename, current_torrent->info_hash);    // Every connection is closed, so the stats are final
+    }
+    peer_pool_destroy();
     if (get_args().debug_mode) {
         fprintf(stderr, "[BTCLIENT_MAIN]: Finished peer cleanup. Num_fds: %d, Num_peers: %d\n", *get_num_fds(),*get_num_peers());
         fflush(stderr);
     }
 
+    if (piece_manager_save_resume_state() != 0) {
+        fprintf(stderr, "[BTCLIENT_MAIN]: Warning: Could not save resume state, the next start will recheck the file.\n");
+        fflush(stderr);
+    }
     piece_manager_destroy();
     if (get_args().debug_mode) {
         fprintf(stderr, "[BTCLIENT_MAIN]: Piece manager destroyed.\n");
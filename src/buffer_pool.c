@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "buffer_pool.h"
+#include "storage.h"    // For STORAGE_DIRECT_ALIGNMENT and storage_alloc_buffer
+
+typedef enum {
+    BUFFER_CLASS_BLOCK,         // Smallest first, so the first class that fits is the tightest
+    BUFFER_CLASS_LAST_PIECE,
+    BUFFER_CLASS_PIECE,
+    BUFFER_CLASS_COUNT
+} BufferClass;
+
+// One size class: an arena of equal slots. Slots past next_untouched have never been handed out (so never
+// faulted in); freed slots go on a stack and are reused first, while their pages are still resident.
+typedef struct {
+    size_t length;              // Largest request the class serves
+    size_t slot_size;           // length rounded up to the slot alignment
+    uint32_t num_slots;
+    uint8_t *arena;
+    size_t arena_size;
+    uint32_t next_untouched;
+    uint32_t *free_slots;
+    uint32_t num_free;
+} Slab;
+
+static Slab slabs[BUFFER_CLASS_COUNT];
+static BufferPoolStats stats;
+
+static size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+static void release_slab(Slab *slab) {
+    if (slab->arena) munmap(slab->arena, slab->arena_size);
+    free(slab->free_slots);
+    memset(slab, 0, sizeof(Slab));
+}
+
+static int reserve_slab(Slab *slab, size_t length, size_t alignment, uint32_t num_slots, bool huge_pages) {
+    memset(slab, 0, sizeof(Slab));
+    if (length == 0 || num_slots == 0) return 0;    // Class not used
+
+    slab->length = length;
+    slab->slot_size = round_up(length, alignment);
+    slab->num_slots = num_slots;
+    slab->free_slots = malloc(num_slots * sizeof(uint32_t));
+    if (!slab->free_slots) return -1;
+
+    // Address space only: pages are committed as slots get written
+    size_t wanted = slab->slot_size * num_slots;
+    size_t reserve = huge_pages ? round_up(wanted, BUFFER_POOL_HUGE_PAGE_SIZE) + BUFFER_POOL_HUGE_PAGE_SIZE : wanted;
+    uint8_t *mapping = mmap(NULL, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        release_slab(slab);
+        return -1;
+    }
+    slab->arena = mapping;
+    slab->arena_size = reserve;
+    if (huge_pages) {
+        // Start the slots on a huge page boundary and give the slack back
+        uint8_t *aligned = (uint8_t *)round_up((uintptr_t)mapping, BUFFER_POOL_HUGE_PAGE_SIZE);
+        size_t head = aligned - mapping;
+        size_t body = round_up(wanted, BUFFER_POOL_HUGE_PAGE_SIZE);
+        if (head > 0) munmap(mapping, head);
+        if (reserve - head - body > 0) munmap(aligned + body, reserve - head - body);
+        slab->arena = aligned;
+        slab->arena_size = body;
+        if (madvise(slab->arena, slab->arena_size, MADV_HUGEPAGE) != 0) stats.huge_pages = false;
+    }
+    return 0;
+}
+
+// Slab a pooled buffer belongs to, or NULL for a heap buffer
+static Slab *slab_of(const void *buffer) {
+    for (int c = 0; c < BUFFER_CLASS_COUNT; c++) {
+        const uint8_t *p = buffer;
+        if (slabs[c].arena && p >= slabs[c].arena && p < slabs[c].arena + slabs[c].slot_size * slabs[c].num_slots) return &slabs[c];
+    }
+    return NULL;
+}
+
+int buffer_pool_init(size_t piece_length, size_t last_piece_length, size_t budget_bytes, bool huge_pages) {
+    buffer_pool_destroy();
+    memset(&stats, 0, sizeof(stats));
+    stats.budget_bytes = budget_bytes;
+    stats.huge_pages = huge_pages;
+
+    uint32_t piece_slots = 0;
+    if (piece_length > 0) {
+        piece_slots = budget_bytes / round_up(piece_length, STORAGE_DIRECT_ALIGNMENT);
+        if (piece_slots == 0) piece_slots = 1;      // The budget still admits one piece at a time
+    }
+    if (last_piece_length == piece_length) last_piece_length = 0;
+
+    if (reserve_slab(&slabs[BUFFER_CLASS_BLOCK], BUFFER_POOL_BLOCK_SLOT, 64, BUFFER_POOL_BLOCK_SLOTS, false) != 0 ||
+        reserve_slab(&slabs[BUFFER_CLASS_LAST_PIECE], last_piece_length, STORAGE_DIRECT_ALIGNMENT, piece_length > 0 ? 1 : 0, huge_pages) != 0 ||
+        reserve_slab(&slabs[BUFFER_CLASS_PIECE], piece_length, STORAGE_DIRECT_ALIGNMENT, piece_slots, huge_pages) != 0) {
+        buffer_pool_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+void buffer_pool_destroy(void) {
+    for (int c = 0; c < BUFFER_CLASS_COUNT; c++) {
+        release_slab(&slabs[c]);
+    }
+}
+
+void *buffer_pool_alloc(size_t length) {
+    void *buffer = NULL;
+    for (int c = 0; c < BUFFER_CLASS_COUNT && !buffer; c++) {
+        Slab *slab = &slabs[c];
+        if (!slab->arena || length > slab->length) continue;
+        if (slab->num_free > 0) {
+            buffer = slab->arena + (size_t)slab->free_slots[--slab->num_free] * slab->slot_size;
+        } else if (slab->next_untouched < slab->num_slots) {
+            buffer = slab->arena + (size_t)slab->next_untouched++ * slab->slot_size;
+        }
+        break;      // Only the tightest class; a full one falls back to the heap rather than take a bigger slot
+    }
+    if (buffer) {
+        stats.slab_allocations++;
+    } else {
+        buffer = storage_alloc_buffer(length);
+        if (!buffer) return NULL;
+        stats.heap_fallbacks++;
+    }
+
+    if (length > BUFFER_POOL_BLOCK_SLOT) {
+        stats.piece_bytes_in_use += length;
+        if (stats.piece_bytes_in_use > stats.peak_piece_bytes) stats.peak_piece_bytes = stats.piece_bytes_in_use;
+    }
+    return buffer;
+}
+
+void buffer_pool_free(void *buffer, size_t length) {
+    if (!buffer) return;
+    if (length > BUFFER_POOL_BLOCK_SLOT) stats.piece_bytes_in_use -= length;
+
+    Slab *slab = slab_of(buffer);
+    if (!slab) {
+        free(buffer);
+        return;
+    }
+    slab->free_slots[slab->num_free++] = (uint32_t)(((uint8_t *)buffer - slab->arena) / slab->slot_size);
+}
+
+bool buffer_pool_over_budget(size_t length) {
+    if (stats.budget_bytes == 0 || length <= BUFFER_POOL_BLOCK_SLOT) return false;
+    // Always let one piece through, or a budget below the piece length would stall the download
+    return stats.piece_bytes_in_use > 0 && stats.piece_bytes_in_use + length > stats.budget_bytes;
+}
+
+void buffer_pool_get_stats(BufferPoolStats *out) {
+    if (out) *out = stats;
+}
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "disk_writer.h"
+#include "storage.h"
+#include "btclient.h"   // For get_args() for debug mode
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct {
+    uint32_t piece_index;
+    uint64_t offset;
+    const uint8_t *data;
+    size_t length;
+} DiskWrite;
+
+// Pending writes and finished results, both guarded by queue_lock. Arrays grow on demand.
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_drained = PTHREAD_COND_INITIALIZER;
+static DiskWrite *pending = NULL;
+static size_t pending_count = 0, pending_capacity = 0;
+static DiskWriteResult *completed = NULL;
+static size_t completed_count = 0, completed_capacity = 0;
+static size_t unpolled_count = 0;           // Submitted writes whose results haven't been polled: completed has room for them
+static void (*queued_task)(void *) = NULL;  // From disk_writer_submit_task, run ahead of the next batch
+static void *queued_task_arg = NULL;
+static bool writing = false;                // Writer thread holds a batch outside the lock
+static bool stopping = false;
+
+static pthread_t writer_thread;
+static bool running = false;
+static _Atomic size_t queued_bytes = 0;     // Submitted but not yet polled, read lock-free by the event loop
+
+static int compare_by_offset(const void *a, const void *b) {
+    const DiskWrite *wa = a, *wb = b;
+    return (wa->offset > wb->offset) - (wa->offset < wb->offset);
+}
+
+static bool grow(void **array, size_t *capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) return true;
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) return false;
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Write a batch sorted by offset, merging pieces that touch into one pwritev, then report each piece's result
+static void write_batch(DiskWrite *batch, size_t count) {
+    qsort(batch, count, sizeof(DiskWrite), compare_by_offset);
+
+    struct iovec iov[IOV_MAX];
+    size_t run_start = 0;
+    while (run_start < count) {
+        // Extend the run while the next piece starts exactly where this one ends
+        size_t run_end = run_start + 1;
+        size_t run_bytes = batch[run_start].length;
+        while (run_end < count && run_end - run_start < IOV_MAX &&
+               batch[run_end].offset == batch[run_end - 1].offset + batch[run_end - 1].length &&
+               run_bytes + batch[run_end].length <= DISK_WRITER_MAX_COALESCE) {
+            run_bytes += batch[run_end].length;
+            run_end++;
+        }
+        for (size_t i = run_start; i < run_end; i++) {
+            iov[i - run_start].iov_base = (void *)batch[i].data;
+            iov[i - run_start].iov_len = batch[i].length;
+        }
+        bool ok = storage_writev(batch[run_start].offset, iov, (int)(run_end - run_start)) == 0;
+        if (!ok && get_args().debug_mode) {
+            fprintf(stderr, "[DISK_WRITER] Error: Writing %zu bytes at offset %lu failed.\n", run_bytes, batch[run_start].offset);
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        for (size_t i = run_start; i < run_end; i++) {      // Room was reserved when the write was submitted
+            completed[completed_count++] = (DiskWriteResult){ .piece_index = batch[i].piece_index, .length = batch[i].length, .ok = ok };
+        }
+        pthread_mutex_unlock(&queue_lock);
+        run_start = run_end;
+    }
+}
+
+// Push earlier writes to disk once STORAGE_SYNC_INTERVAL has passed. fdatasync can take seconds on a busy disk,
+// which is why it runs here and not on the event loop. Called without queue_lock.
+static void sync_if_due(void) {
+    if (storage_sync_if_due() != 0 && get_args().debug_mode) {
+        fprintf(stderr, "[DISK_WRITER] Warning: Syncing the output file failed: %s\n", strerror(errno));
+    }
+}
+
+static void *disk_writer_main(void *arg) {
+    (void)arg;
+    DiskWrite *batch = NULL;
+    size_t batch_capacity = 0;
+
+    pthread_mutex_lock(&queue_lock);
+    while (1) {
+        while (pending_count == 0 && !queued_task && !stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += STORAGE_SYNC_INTERVAL;
+            if (pthread_cond_timedwait(&work_available, &queue_lock, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&queue_lock);
+                sync_if_due();
+                pthread_mutex_lock(&queue_lock);
+            }
+        }
+        if (pending_count == 0 && !queued_task && stopping) break;
+
+        // Take everything queued so far; the longer the disk took last time, the bigger (and better merged) this batch.
+        // The queue and the last batch's array trade places, so the thread never allocates.
+        DiskWrite *taken = pending;
+        size_t taken_capacity = pending_capacity;
+        size_t batch_count = pending_count;
+        pending = batch;
+        pending_capacity = batch_capacity;
+        pending_count = 0;
+        batch = taken;
+        batch_capacity = taken_capacity;
+        void (*task)(void *) = queued_task;
+        void *task_arg = queued_task_arg;
+        queued_task = NULL;
+        writing = true;
+        pthread_mutex_unlock(&queue_lock);
+
+        if (task) task(task_arg);       // Ahead of the batch, which may hold writes queued after it
+        write_batch(batch, batch_count);
+
+        pthread_mutex_lock(&queue_lock);
+        writing = false;
+        if (pending_count == 0 && !queued_task) pthread_cond_broadcast(&queue_drained);
+        pthread_mutex_unlock(&queue_lock);
+
+        sync_if_due();
+        pthread_mutex_lock(&queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    free(batch);
+    return NULL;
+}
+
+int disk_writer_init(void) {
+    if (running) return 0;
+    if (storage_get_backend() == STORAGE_BACKEND_STDIO) return -1;  // Stream position is shared with the event loop's reads
+
+    stopping = false;
+    writing = false;
+    pending_count = 0;
+    completed_count = 0;
+    unpolled_count = 0;
+    queued_task = NULL;
+    atomic_store(&queued_bytes, 0);
+    if (pthread_create(&writer_thread, NULL, disk_writer_main, NULL) != 0) {
+        if (get_args().debug_mode) perror("[DISK_WRITER] Error pthread_create");
+        return -1;
+    }
+    running = true;
+    if (get_args().debug_mode) fprintf(stderr, "[DISK_WRITER] Started disk I/O thread.\n");
+    return 0;
+}
+
+void disk_writer_destroy(void) {
+    if (!running) return;
+
+    pthread_mutex_lock(&queue_lock);
+    stopping = true;
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(writer_thread, NULL);
+    running = false;
+
+    free(pending);
+    pending = NULL;
+    pending_count = pending_capacity = 0;
+    free(completed);
+    completed = NULL;
+    completed_count = completed_capacity = 0;
+    unpolled_count = 0;
+    atomic_store(&queued_bytes, 0);
+}
+
+int disk_writer_submit(uint32_t piece_index, uint64_t offset, const uint8_t *data, size_t length) {
+    if (!running) return -1;
+
+    pthread_mutex_lock(&queue_lock);
+    // Reserve the result's slot now, so the thread never has to allocate to hand a result back
+    if (!grow((void **)&completed, &completed_capacity, unpolled_count + 1, sizeof(DiskWriteResult)) ||
+        !grow((void **)&pending, &pending_capacity, pending_count + 1, sizeof(DiskWrite))) {
+        pthread_mutex_unlock(&queue_lock);
+        return -1;
+    }
+    pending[pending_count++] = (DiskWrite){ .piece_index = piece_index, .offset = offset, .data = data, .length = length };
+    unpolled_count++;
+    atomic_fetch_add(&queued_bytes, length);
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
+
+int disk_writer_submit_task(void (*run)(void *arg), void *arg) {
+    if (!running || !run) return -1;
+
+    pthread_mutex_lock(&queue_lock);
+    if (queued_task) {
+        pthread_mutex_unlock(&queue_lock);
+        return -1;
+    }
+    queued_task = run;
+    queued_task_arg = arg;
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
+
+int disk_writer_poll_completed(DiskWriteResult *results, int max_results) {
+    if (!running || !results || max_results <= 0) return 0;
+
+    pthread_mutex_lock(&queue_lock);
+    int n = completed_count < (size_t)max_results ? (int)completed_count : max_results;
+    memcpy(results, completed, n * sizeof(DiskWriteResult));
+    memmove(completed, completed + n, (completed_count - n) * sizeof(DiskWriteResult));
+    completed_count -= n;
+    unpolled_count -= n;
+    pthread_mutex_unlock(&queue_lock);
+
+    for (int i = 0; i < n; i++) {
+        atomic_fetch_sub(&queued_bytes, results[i].length);   // The caller frees these buffers now
+    }
+    return n;
+}
+
+void disk_writer_flush(void) {
+    if (!running) return;
+
+    pthread_mutex_lock(&queue_lock);
+    while (pending_count > 0 || queued_task || writing) {
+        pthread_cond_wait(&queue_drained, &queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+size_t disk_writer_queued_bytes(void) {
+    return atomic_load(&queued_bytes);
+}
+
+bool disk_writer_over_budget(void) {
+    return atomic_load(&queued_bytes) > DISK_WRITER_MEMORY_BUDGET;
+}
+
+bool disk_writer_running(void) {
+    return running;
+}
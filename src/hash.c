@@ -1,30 +1,377 @@
 #include <string.h>
 #include <strings.h>
+#include <stdlib.h>
+#include <endian.h>
+#include <pthread.h>
 
 #include "hash.h"
 
 /* third party libraries */
 #include <openssl/evp.h>
 
-/* You shouldn't have to be looking at this file, but have fun! */
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA1_HAVE_X86 1
+#endif
 
+/* You shouldn't have to be looking at this file, but have fun! */
 
+/* Contexts remember the engine they were created with. EVP contexts carry an
+ * EVP_MD_CTX, native contexts (SHA-NI) keep the SHA-1 state inline so they
+ * need no allocation beyond the context itself. */
 struct sha1sum_ctx {
+	enum sha1sum_engine engine;
 	EVP_MD_CTX *ctx;
 	const EVP_MD *md;
+	uint32_t state[5];
+	uint8_t block[64];
+	size_t block_len;
+	uint64_t total_len;
 	uint8_t *salt;
 	size_t len;
 };
 
+static const uint32_t sha1_iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+static pthread_once_t engine_once = PTHREAD_ONCE_INIT;
+static int cpu_has_shani = 0;
+static int cpu_has_avx2 = 0;
+static enum sha1sum_engine active_engine = SHA1SUM_ENGINE_EVP;
+static int use_multi_buffer = 0;
+
+
+#ifdef SHA1_HAVE_X86
+/* Single-stream compression with the SHA extensions, four rounds per
+ * instruction. Follows Intel's reference flow: the message schedule for the
+ * next groups is computed while the current group's rounds run. */
+#define SHANI_ROUNDS(Ea, Eb, M0, M1, M2, M3, F) \
+	Ea = _mm_sha1nexte_epu32(Ea, M0); \
+	Eb = abcd; \
+	M1 = _mm_sha1msg2_epu32(M1, M0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, Ea, F); \
+	M3 = _mm_sha1msg1_epu32(M3, M0); \
+	M2 = _mm_xor_si128(M2, M0);
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_compress_shani(uint32_t state[5], const uint8_t *data, size_t blocks) {
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+	__m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+	__m128i e1, m0, m1, m2, m3;
+
+	while (blocks--) {
+		__m128i abcd_save = abcd;
+		__m128i e0_save = e0;
+
+		/* Rounds 0-15 load the message */
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), mask);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 0);
+
+		/* Rounds 16-79 */
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 0);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 1);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 1);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 1);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 2);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 2);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 2);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 3);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 3);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 3);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		data += 64;
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	_mm_storeu_si128((__m128i *)state, abcd);
+	state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+/* Eight independent messages at once, one per 32-bit lane of an AVX2
+ * register. Every lane runs the same rounds, so all messages must be
+ * processed for the same number of blocks. */
+#define SHA1_LANES 8
+
+__attribute__((target("avx2")))
+static inline __m256i rotl_x8(__m256i x, int n) {
+	return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+/* Transpose an 8x8 matrix of 32-bit words held in eight registers */
+__attribute__((target("avx2")))
+static void transpose_8x8(__m256i r[8]) {
+	__m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+	__m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+	__m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	__m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+	__m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	__m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+	__m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+	r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+/* state[i] holds word i of all eight lanes */
+__attribute__((target("avx2")))
+static void sha1_compress_x8_avx2(__m256i state[5], const uint8_t *const data[SHA1_LANES], size_t block_offset) {
+	const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+					      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i w[16];
+	for (int half = 0; half < 2; half++) {
+		__m256i r[8];
+		for (int lane = 0; lane < SHA1_LANES; lane++) {
+			r[lane] = _mm256_loadu_si256((const __m256i *)(data[lane] + block_offset + half * 32));
+		}
+		transpose_8x8(r);
+		for (int i = 0; i < 8; i++) {
+			w[half * 8 + i] = _mm256_shuffle_epi8(r[i], bswap);
+		}
+	}
+
+	__m256i a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (int t = 0; t < 80; t++) {
+		__m256i wt;
+		if (t < 16) {
+			wt = w[t];
+		} else {
+			wt = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+					      _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+			wt = rotl_x8(wt, 1);
+			w[t & 15] = wt;
+		}
+
+		__m256i f, k;
+		if (t < 20) {
+			f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d));
+			k = _mm256_set1_epi32(0x5A827999);
+		} else if (t < 40) {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32(0x6ED9EBA1);
+		} else if (t < 60) {
+			f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+			k = _mm256_set1_epi32((int)0x8F1BBCDC);
+		} else {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32((int)0xCA62C1D6);
+		}
+
+		__m256i temp = _mm256_add_epi32(_mm256_add_epi32(rotl_x8(a, 5), f), _mm256_add_epi32(_mm256_add_epi32(e, k), wt));
+		e = d;
+		d = c;
+		c = rotl_x8(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	state[0] = _mm256_add_epi32(state[0], a);
+	state[1] = _mm256_add_epi32(state[1], b);
+	state[2] = _mm256_add_epi32(state[2], c);
+	state[3] = _mm256_add_epi32(state[3], d);
+	state[4] = _mm256_add_epi32(state[4], e);
+}
+
+/* Hash eight equal-length payloads. Full blocks are read in place, the
+ * padded tail of each lane is built in a small per-lane buffer. */
+__attribute__((target("avx2")))
+static void sha1_many_x8_avx2(const uint8_t *const payloads[SHA1_LANES], size_t len, uint8_t out[SHA1_LANES][20]) {
+	__m256i state[5];
+	for (int i = 0; i < 5; i++) {
+		state[i] = _mm256_set1_epi32((int)sha1_iv[i]);
+	}
+
+	size_t full_blocks = len / 64;
+	for (size_t blk = 0; blk < full_blocks; blk++) {
+		sha1_compress_x8_avx2(state, payloads, blk * 64);
+	}
+
+	/* Tail: remaining bytes, 0x80, zeros, 64-bit big-endian bit length */
+	uint8_t tail[SHA1_LANES][128];
+	const uint8_t *tail_ptrs[SHA1_LANES];
+	size_t rem = len % 64;
+	size_t tail_len = rem < 56 ? 64 : 128;
+	uint64_t bit_len = htobe64((uint64_t)len * 8);
+	for (int lane = 0; lane < SHA1_LANES; lane++) {
+		memset(tail[lane], 0, tail_len);
+		memcpy(tail[lane], payloads[lane] + full_blocks * 64, rem);
+		tail[lane][rem] = 0x80;
+		memcpy(tail[lane] + tail_len - 8, &bit_len, 8);
+		tail_ptrs[lane] = tail[lane];
+	}
+	for (size_t off = 0; off < tail_len; off += 64) {
+		sha1_compress_x8_avx2(state, tail_ptrs, off);
+	}
+
+	uint32_t words[5][SHA1_LANES];
+	for (int i = 0; i < 5; i++) {
+		_mm256_storeu_si256((__m256i *)words[i], state[i]);
+	}
+	for (int lane = 0; lane < SHA1_LANES; lane++) {
+		for (int i = 0; i < 5; i++) {
+			uint32_t be = htobe32(words[i][lane]);
+			memcpy(out[lane] + i * 4, &be, 4);
+		}
+	}
+}
+#endif
+
+static void detect_engines(void) {
+#ifdef SHA1_HAVE_X86
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		cpu_has_shani = (ebx >> 29) & 1;
+	}
+	__builtin_cpu_init();
+	cpu_has_shani = cpu_has_shani && __builtin_cpu_supports("sse4.1");
+	cpu_has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+	active_engine = cpu_has_shani ? SHA1SUM_ENGINE_SHANI : SHA1SUM_ENGINE_EVP;
+	use_multi_buffer = !cpu_has_shani && cpu_has_avx2;
+}
+
+int sha1sum_engine_available(enum sha1sum_engine engine) {
+	pthread_once(&engine_once, detect_engines);
+	switch (engine) {
+	case SHA1SUM_ENGINE_EVP:
+		return 1;
+	case SHA1SUM_ENGINE_SHANI:
+		return cpu_has_shani;
+	case SHA1SUM_ENGINE_AVX2_MB:
+		return cpu_has_avx2;
+	}
+	return 0;
+}
+
+int sha1sum_select_engine(enum sha1sum_engine engine, int multi_buffer) {
+	if (!sha1sum_engine_available(engine)) {
+		return 1;
+	}
+	if (multi_buffer && !cpu_has_avx2) {
+		return 1;
+	}
+	/* The multi-buffer kernel only hashes batches, single streams keep the best engine */
+	active_engine = engine == SHA1SUM_ENGINE_AVX2_MB ? (cpu_has_shani ? SHA1SUM_ENGINE_SHANI : SHA1SUM_ENGINE_EVP) : engine;
+	use_multi_buffer = multi_buffer || engine == SHA1SUM_ENGINE_AVX2_MB;
+	return 0;
+}
+
+const char *sha1sum_engine_name(void) {
+	pthread_once(&engine_once, detect_engines);
+	if (active_engine == SHA1SUM_ENGINE_SHANI) {
+		return use_multi_buffer ? "sha-ni (avx2 multi-buffer batches)" : "sha-ni";
+	}
+	return use_multi_buffer ? "evp (avx2 multi-buffer batches)" : "evp";
+}
+
+/* Native engines: buffer partial blocks, compress full ones straight from the payload */
+static void native_compress(struct sha1sum_ctx *csm, const uint8_t *data, size_t blocks) {
+#ifdef SHA1_HAVE_X86
+	sha1_compress_shani(csm->state, data, blocks);
+#else
+	(void)csm; (void)data; (void)blocks;
+#endif
+}
+
+static void native_update(struct sha1sum_ctx *csm, const uint8_t *payload, size_t len) {
+	csm->total_len += len;
+	if (csm->block_len) {
+		size_t take = 64 - csm->block_len < len ? 64 - csm->block_len : len;
+		memcpy(csm->block + csm->block_len, payload, take);
+		csm->block_len += take;
+		payload += take;
+		len -= take;
+		if (csm->block_len < 64) {
+			return;
+		}
+		native_compress(csm, csm->block, 1);
+		csm->block_len = 0;
+	}
+	if (len >= 64) {
+		native_compress(csm, payload, len / 64);
+		payload += len & ~(size_t)63;
+		len &= 63;
+	}
+	if (len) {
+		memcpy(csm->block, payload, len);
+		csm->block_len = len;
+	}
+}
+
+static void native_final(struct sha1sum_ctx *csm, uint8_t *out) {
+	uint64_t bit_len = htobe64(csm->total_len * 8);
+	csm->block[csm->block_len++] = 0x80;
+	if (csm->block_len > 56) {
+		memset(csm->block + csm->block_len, 0, 64 - csm->block_len);
+		native_compress(csm, csm->block, 1);
+		csm->block_len = 0;
+	}
+	memset(csm->block + csm->block_len, 0, 56 - csm->block_len);
+	memcpy(csm->block + 56, &bit_len, 8);
+	native_compress(csm, csm->block, 1);
+	for (int i = 0; i < 5; i++) {
+		uint32_t be = htobe32(csm->state[i]);
+		memcpy(out + i * 4, &be, 4);
+	}
+}
+
 
 struct sha1sum_ctx * sha1sum_create(const uint8_t *salt, size_t len) {
+	pthread_once(&engine_once, detect_engines);
+
 	struct sha1sum_ctx *csm = (struct sha1sum_ctx *)malloc(sizeof(*csm));
 	if (!csm) {
 		goto err;
 	}
 	bzero(csm, sizeof(*csm));
-	csm->ctx = EVP_MD_CTX_new();
-	csm->md = EVP_sha1();
+	csm->engine = active_engine;
+	if (csm->engine == SHA1SUM_ENGINE_EVP) {
+		csm->ctx = EVP_MD_CTX_new();
+		csm->md = EVP_sha1();
+		if (!csm->ctx) {
+			goto err;
+		}
+	}
 	csm->len = len;
 	if (len > 0) {
 		csm->salt = (uint8_t *)malloc(len);
@@ -42,6 +389,7 @@ struct sha1sum_ctx * sha1sum_create(const uint8_t *salt, size_t len) {
 
   err:
 	if (csm) {
+		EVP_MD_CTX_free(csm->ctx);
 		if (csm->salt) {
 			free(csm->salt);
 		}
@@ -54,10 +402,21 @@ struct sha1sum_ctx * sha1sum_create(const uint8_t *salt, size_t len) {
 }
 
 int sha1sum_update(struct sha1sum_ctx *csm, const uint8_t *payload, size_t len) {
+	if (csm->engine != SHA1SUM_ENGINE_EVP) {
+		native_update(csm, payload, len);
+		return 0;
+	}
 	return EVP_DigestUpdate(csm->ctx, payload, len) != 1;
 }
 
 int sha1sum_finish(struct sha1sum_ctx *csm, const uint8_t *payload, size_t len, uint8_t *out) {
+	if (csm->engine != SHA1SUM_ENGINE_EVP) {
+		if (len) {
+			native_update(csm, payload, len);
+		}
+		native_final(csm, out);
+		return 0;
+	}
 	int ret = 1;
 	if (len) {
 		ret = EVP_DigestUpdate(csm->ctx, payload, len);
@@ -70,13 +429,22 @@ int sha1sum_finish(struct sha1sum_ctx *csm, const uint8_t *payload, size_t len,
 }
 
 int sha1sum_reset(struct sha1sum_ctx *csm) {
+	if (csm->engine != SHA1SUM_ENGINE_EVP) {
+		memcpy(csm->state, sha1_iv, sizeof(sha1_iv));
+		csm->block_len = 0;
+		csm->total_len = 0;
+		if (csm->len) {
+			native_update(csm, csm->salt, csm->len);
+		}
+		return 0;
+	}
 	EVP_DigestInit_ex(csm->ctx, csm->md, NULL);
 	if (csm->len) {
 		return EVP_DigestUpdate(csm->ctx, csm->salt, csm->len) != 1;
 	} else {
 		return 0;
 	}
-	
+
 }
 
 int sha1sum_destroy(struct sha1sum_ctx *csm) {
@@ -87,6 +455,65 @@ int sha1sum_destroy(struct sha1sum_ctx *csm) {
 	return 0;
 }
 
+/* One unsalted context per thread, created on first use and freed when the
+ * thread exits, so one-shot hashing never allocates after warm-up. */
+static pthread_key_t thread_ctx_key;
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+
+static void thread_ctx_free(void *csm) {
+	sha1sum_destroy((struct sha1sum_ctx *)csm);
+}
+
+static void thread_ctx_key_create(void) {
+	pthread_key_create(&thread_ctx_key, thread_ctx_free);
+}
+
+int sha1sum_oneshot(const uint8_t *payload, size_t len, uint8_t *out) {
+	pthread_once(&thread_ctx_once, thread_ctx_key_create);
+	struct sha1sum_ctx *csm = pthread_getspecific(thread_ctx_key);
+	if (csm && csm->engine != active_engine) {
+		/* Engine was switched (benchmarks), start a fresh context */
+		sha1sum_destroy(csm);
+		csm = NULL;
+	}
+	if (!csm) {
+		csm = sha1sum_create(NULL, 0);
+		if (!csm) {
+			return 1;
+		}
+		pthread_setspecific(thread_ctx_key, csm);
+	}
+	int ret = sha1sum_finish(csm, payload, len, out);
+	return sha1sum_reset(csm) || ret;
+}
+
+int sha1sum_many(const uint8_t *const *payloads, size_t len, uint8_t (*out)[20], size_t count) {
+	pthread_once(&engine_once, detect_engines);
+	size_t done = 0;
+#ifdef SHA1_HAVE_X86
+	if (use_multi_buffer) {
+		/* A partial batch still pays for eight lanes, so only use it while at least half are real */
+		while (count - done >= SHA1_LANES / 2) {
+			const uint8_t *lanes[SHA1_LANES];
+			uint8_t lane_out[SHA1_LANES][20];
+			size_t real = count - done < SHA1_LANES ? count - done : SHA1_LANES;
+			for (size_t lane = 0; lane < SHA1_LANES; lane++) {
+				lanes[lane] = payloads[done + (lane < real ? lane : 0)];
+			}
+			sha1_many_x8_avx2(lanes, len, lane_out);
+			memcpy(out + done, lane_out, real * 20);
+			done += real;
+		}
+	}
+#endif
+	for (; done < count; done++) {
+		if (sha1sum_oneshot(payloads[done], len, out[done])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 uint64_t sha1sum_truncated_head(uint8_t *sha1_hash)
 {
     uint64_t truncated_sha1 = 0;
@@ -95,4 +522,3 @@ uint64_t sha1sum_truncated_head(uint8_t *sha1_hash)
     // Really just so it aligns with the previous example specification
     return be64toh(truncated_sha1);
 }
-
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "hash_pool.h"
+#include "hash.h"
+#include "btclient.h"   // For get_args() for debug mode
+
+// Bounded multi-producer/multi-consumer ring (Vyukov style). Each cell's sequence number says whether it is
+// free for the producer at that position or filled for the consumer at that position, so no locks are needed.
+typedef struct {
+    _Atomic size_t sequence;
+    HashJob job;
+} RingCell;
+
+typedef struct {
+    RingCell cells[HASH_POOL_QUEUE_SIZE];
+    _Atomic size_t enqueue_pos;
+    _Atomic size_t dequeue_pos;
+} JobRing;
+
+static JobRing job_queue;                           // Event loop -> workers
+static JobRing result_queue;                        // Workers -> event loop
+static sem_t jobs_available;                        // Lets idle workers sleep instead of spinning
+
+static pthread_t workers[HASH_POOL_MAX_WORKERS];
+static int num_workers_running = 0;
+static atomic_bool stopping = false;
+static atomic_int jobs_in_flight = 0;
+
+#define HASH_POOL_READ_CHUNK (256 * 1024)   // Read-back buffer per worker for payloads that are on disk
+
+static void ring_init(JobRing *ring) {
+    for (size_t i = 0; i < HASH_POOL_QUEUE_SIZE; i++) {
+        atomic_store_explicit(&ring->cells[i].sequence, i, memory_order_relaxed);
+    }
+    atomic_store_explicit(&ring->enqueue_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->dequeue_pos, 0, memory_order_relaxed);
+}
+
+static bool ring_push(JobRing *ring, const HashJob *job) {
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        RingCell *cell = &ring->cells[pos & (HASH_POOL_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->job = *job;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;   // Full
+        } else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static bool ring_pop(JobRing *ring, HashJob *job) {
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        RingCell *cell = &ring->cells[pos & (HASH_POOL_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *job = cell->job;
+                atomic_store_explicit(&cell->sequence, pos + HASH_POOL_QUEUE_SIZE, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;   // Empty
+        } else {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Worker thread: hash queued pieces and post the verdict back to the event loop
+static void *hash_worker(void *arg) {
+    (void)arg;
+    uint8_t *read_buffer = NULL;            // Allocated on the first on-disk payload
+
+    while (1) {
+        sem_wait(&jobs_available);
+        if (atomic_load(&stopping)) break;
+
+        HashJob job;
+        if (!ring_pop(&job_queue, &job)) continue;
+
+        // Continue the piece's own running hash if it has one (the piece manager recycles that context),
+        // otherwise hash from scratch with this thread's reusable context
+        uint8_t calculated_hash[20];
+        int hash_status;
+        if (!job.data && job.read_payload) {
+            // Stream the payload back from disk (normally still in the page cache) a chunk at a time
+            if (!read_buffer) read_buffer = malloc(HASH_POOL_READ_CHUNK);
+            hash_status = job.ctx && read_buffer ? 0 : -1;
+            for (size_t done = 0; hash_status == 0 && done < job.length; done += HASH_POOL_READ_CHUNK) {
+                size_t chunk = job.length - done < HASH_POOL_READ_CHUNK ? job.length - done : HASH_POOL_READ_CHUNK;
+                hash_status = job.read_payload(job.payload_offset + done, read_buffer, chunk) == 0 ? sha1sum_update(job.ctx, read_buffer, chunk) : -1;
+            }
+            if (hash_status == 0) hash_status = sha1sum_finish(job.ctx, NULL, 0, calculated_hash);
+        } else {
+            hash_status = job.ctx ? sha1sum_finish(job.ctx, job.data, job.length, calculated_hash)
+                                  : sha1sum_oneshot(job.data, job.length, calculated_hash);
+        }
+        job.verified = hash_status == 0 && memcmp(calculated_hash, job.expected_hash, 20) == 0;
+
+        // The result queue has the same capacity as the job queue, so this only spins if the event loop stops draining
+        while (!ring_push(&result_queue, &job)) {
+            if (atomic_load(&stopping)) break;
+            sched_yield();
+        }
+    }
+    free(read_buffer);
+    return NULL;
+}
+
+int hash_pool_init(int num_workers) {
+    if (num_workers_running > 0) return 0;   // Already running
+
+    if (num_workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = cores > 1 ? (int)cores - 1 : 1;
+    }
+    if (num_workers > HASH_POOL_MAX_WORKERS) num_workers = HASH_POOL_MAX_WORKERS;
+
+    ring_init(&job_queue);
+    ring_init(&result_queue);
+    atomic_store(&stopping, false);
+    atomic_store(&jobs_in_flight, 0);
+    if (sem_init(&jobs_available, 0, 0) != 0) {
+        if (get_args().debug_mode) perror("[HASH_POOL] Error sem_init");
+        return -1;
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&workers[i], NULL, hash_worker, NULL) != 0) {
+            if (get_args().debug_mode) fprintf(stderr, "[HASH_POOL] Error: could only start %d of %d workers.\n", i, num_workers);
+            break;
+        }
+        num_workers_running++;
+    }
+    if (num_workers_running == 0) {
+        sem_destroy(&jobs_available);
+        return -1;
+    }
+
+    if (get_args().debug_mode) fprintf(stderr, "[HASH_POOL] Started %d hashing workers.\n", num_workers_running);
+    return 0;
+}
+
+void hash_pool_destroy(void) {
+    if (num_workers_running == 0) return;
+
+    atomic_store(&stopping, true);
+    for (int i = 0; i < num_workers_running; i++) {
+        sem_post(&jobs_available);
+    }
+    for (int i = 0; i < num_workers_running; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    sem_destroy(&jobs_available);
+    num_workers_running = 0;
+    atomic_store(&jobs_in_flight, 0);
+}
+
+int hash_pool_submit(const HashJob *job) {
+    if (num_workers_running == 0 || !job) return -1;
+    if (!ring_push(&job_queue, job)) return -1;
+
+    atomic_fetch_add(&jobs_in_flight, 1);
+    sem_post(&jobs_available);
+    return 0;
+}
+
+bool hash_pool_poll_result(HashJob *job) {
+    if (num_workers_running == 0 || !job) return false;
+    if (!ring_pop(&result_queue, job)) return false;
+
+    atomic_fetch_sub(&jobs_in_flight, 1);
+    return true;
+}
+
+int hash_pool_in_flight(void) {
+    return atomic_load(&jobs_in_flight);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // For splice and pipe2
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,11 +12,15 @@
 #include <poll.h>
 #include <netinet/tcp.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #include "peer_manager.h"
 #include "btclient.h"
 #include "torrent_parser.h"
 #include "piece_manager.h"
+#include "storage.h"    // For splicing PIECE payloads into the output file
+#include "buffer_pool.h"    // For outgoing PIECE and BITFIELD messages
+#include "peer_pool.h"      // For ranking the peers we connected to
 
 enum MSG_ID {
     CHOKE,
@@ -32,6 +37,10 @@ enum MSG_ID {
 
 static const char *PROTOCOL = "BitTorrent protocol";
 
+#define PIECE_HEADER_LENGTH 13      // Length prefix, id, index and begin in front of a PIECE payload
+
+static int splice_pipe[2] = {-1, -1};   // Shared by all peers: each splice is drained into the file before the next
+
 // Send a message via socket fd, returning the number of bytes sent (helper function)
 static int send_message(Peer *peer, const unsigned char *message, size_t message_len) {
     size_t sent = 0;
@@ -114,11 +123,10 @@ static int send_handshake(Peer *peer) {
 }
 
 // Send piece message to the peer the sent an incoming request message
+// message is a pooled buffer of PIECE_HEADER_LENGTH + length bytes with the block already at its end; it is freed here.
 // Returns 0 if successful, -1 if message is not sent.
 // NOTE: The "piece" message actually holds a block
-static int send_piece(Peer *peer, uint32_t index, uint32_t begin, uint32_t length, uint8_t *block) {
-    uint8_t *message = malloc(13 + length);
-
+static int send_piece(Peer *peer, uint32_t index, uint32_t begin, uint32_t length, uint8_t *message) {
     uint32_t length_prefix = htonl(9 + (unsigned long)length);
     memcpy(message, &length_prefix, 4);
     message[4] = PIECE;
@@ -126,7 +134,6 @@ static int send_piece(Peer *peer, uint32_t index, uint32_t begin, uint32_t lengt
     memcpy(message + 5,  &index, 4);
     begin = htonl(begin);
     memcpy(message + 9,  &begin, 4);
-    memcpy(message + 13, block, length);
 
     if (get_args().debug_mode) {
         struct in_addr ia = { .s_addr = peer->address };
@@ -138,16 +145,37 @@ static int send_piece(Peer *peer, uint32_t index, uint32_t begin, uint32_t lengt
         if (get_args().debug_mode) {
             fprintf(stderr, "[PEER_MANAGER]: Failed to send PIECE idx=%u to peer\n", index);
         }
-        free(block);
-        free(message);
+        buffer_pool_free(message, PIECE_HEADER_LENGTH + length);
         return -1;
     }
 
-    free(block);
-    free(message);
+    buffer_pool_free(message, PIECE_HEADER_LENGTH + length);
     return 0;
 }
 
+// Remove the outstanding request at circular array index found_index, shift everything to fill the empty hole
+static void remove_outstanding_request(Peer *peer, int found_index) {
+    int curr_index = found_index;
+    while (curr_index != peer->requests_head) {
+        int prev_index = (curr_index - 1 + MAX_OUTSTANDING_REQUESTS) % MAX_OUTSTANDING_REQUESTS;
+        peer->outstanding_requests[curr_index] = peer->outstanding_requests[prev_index];
+        curr_index = prev_index;
+    }
+    peer->requests_head = (peer->requests_head + 1) % MAX_OUTSTANDING_REQUESTS;
+    peer->num_outstanding_requests--;
+}
+
+// Check the peer's announced bitfield for a piece (helper function)
+static bool peer_has_piece(const Peer *peer, uint32_t piece_index) {
+    if (!peer->bitfield || (piece_index / 8) >= peer->bitfield_bytes) return false;
+    return (peer->bitfield[piece_index / 8] >> (7 - (piece_index % 8))) & 1;
+}
+
+// Milliseconds elapsed between two timevals (helper function)
+static double elapsed_ms(const struct timeval *from, const struct timeval *to) {
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_usec - from->tv_usec) / 1000.0;
+}
+
 // Dequeue an outstanding request for peer (when a response is confirmed for that request), and write the response data
 static void dequeue_and_process_outstanding(Peer *peer, uint32_t piece_index, uint32_t piece_begin, const uint8_t *block, size_t length) {
     int found_index = -1;
@@ -164,8 +192,11 @@ static void dequeue_and_process_outstanding(Peer *peer, uint32_t piece_index, ui
         return;
     }
 
-    // Write block (the block data from the piece message) with length "length" at piece_index, piece_begin in file
-    if (piece_manager_record_block_received(piece_index, piece_begin, block, length) == -1) {
+    // Write block (the block data from the piece message) with length "length" at piece_index, piece_begin in file.
+    // A NULL block was spliced into the file already.
+    int recorded = block ? piece_manager_record_block_received(piece_index, piece_begin, block, length)
+                         : piece_manager_record_block_on_disk(piece_index, piece_begin, length);
+    if (recorded == -1) {
         if (get_args().debug_mode) {
             fprintf(stderr, "[PEER_MANAGER]: Attempted to dequeue outstanding request, but received verification failure when writing received piece. Requeuing...\n");
             fflush(stderr);
@@ -175,15 +206,22 @@ static void dequeue_and_process_outstanding(Peer *peer, uint32_t piece_index, ui
     }
     
 
-    // Dequeue the request element, shift everything to fill the empty hole
-    int curr_index = found_index;
-    while (curr_index != peer->requests_head) {
-        int prev_index = (curr_index - 1 + MAX_OUTSTANDING_REQUESTS) % MAX_OUTSTANDING_REQUESTS;
-        peer->outstanding_requests[curr_index] = peer->outstanding_requests[prev_index];
-        curr_index = prev_index;
+    remove_outstanding_request(peer, found_index);
+}
+
+// A PIECE payload has arrived (block is NULL if it was spliced into the file): settle its request
+static void process_received_block(Peer *peer, uint32_t index, uint32_t begin, const uint8_t *block, size_t block_length) {
+    dequeue_and_process_outstanding(peer, index, begin, block, block_length);
+
+    if (get_endgame()) {
+        // broadcast CANCEL for this block to everyone else
+        for (int i = 0; i < *get_num_peers(); ++i) {
+            Peer *other = &get_peers()[i];
+            if (other != peer) {
+                peer_manager_send_cancel(other, index, begin, block_length);
+            }
+        }
     }
-    peer->requests_head = (peer->requests_head + 1) % MAX_OUTSTANDING_REQUESTS;
-    peer->num_outstanding_requests--;
 }
 
 // Handle a single message (with length prefix attached)
@@ -284,26 +322,31 @@ static void handle_peer_message(Peer *peer, uint8_t msg_id, const uint8_t *paylo
                 break;
             }
 
-            
-            uint8_t *block = malloc(length);
-            /*
-            if (!piece_manager_read_block(index, begin, length, block)) {
+            // The length comes from the peer: check it before it sizes an allocation
+            uint32_t piece_length = piece_manager_get_piece_length(index);
+            if (length == 0 || length > MAX_REQUEST_LENGTH || begin > piece_length || length > piece_length - begin) {
                 if (get_args().debug_mode) {
-                    fprintf(stderr, "[PEER_MANAGER]: Ignoring REQUEST for idx=%u block could not be read from file\n", index);
+                    fprintf(stderr, "[PEER_MANAGER]: Ignoring REQUEST for idx=%u begin=%u len=%u, out of bounds\n", index, begin, length);
                     fflush(stderr);
                 }
-                free(block);
                 break;
             }
-                */
-            if (piece_manager_get_all_managed_pieces()[index].data_buffer) {
-                memcpy(block, piece_manager_get_all_managed_pieces()[index].data_buffer + begin, length);
-            } else {
-                piece_manager_read_block(index, begin, length, block);
+
+            // Read the block straight into its place in the outgoing message
+            uint8_t *message = buffer_pool_alloc(PIECE_HEADER_LENGTH + (size_t)length);
+            if (!message) break;
+            uint8_t *block = message + PIECE_HEADER_LENGTH;
+            if (!piece_manager_read_block(index, begin, length, block)) {
+                if (get_args().debug_mode) {
+                    fprintf(stderr, "[PEER_MANAGER]: Ignoring REQUEST for idx=%u block could not be read\n", index);
+                    fflush(stderr);
+                }
+                buffer_pool_free(message, PIECE_HEADER_LENGTH + (size_t)length);
+                break;
             }
 
             // respond to peer with piece message of requested block
-            send_piece(peer, index, begin, length, block);
+            send_piece(peer, index, begin, length, message);
             break;
         }
         case PIECE: {
@@ -320,18 +363,7 @@ static void handle_peer_message(Peer *peer, uint8_t msg_id, const uint8_t *paylo
             begin = ntohl(begin);
             const unsigned char *block = payload + 8;
             size_t block_length = payload_length - 8;   // 8 is the length of index and begin combined
-            dequeue_and_process_outstanding(peer, index, begin, block, block_length);
-
-            if (get_endgame()) {
-                // broadcast CANCEL for this block to everyone else
-                for (int i = 0; i < *get_num_peers(); ++i) {
-                    Peer *other = &get_peers()[i];
-                    if (other != peer) {
-                        peer_manager_send_cancel(other, index, begin, block_length);
-                    }
-                }
-            }
-
+            process_received_block(peer, index, begin, block, block_length);
             break;
         }
         case CANCEL: {
@@ -393,6 +425,7 @@ static int parse_peer_incoming_buffer(Peer *peer) {
             offset += 68;
             available_bytes -= 68;
             peer->handshake_done = true;
+            if (peer->we_initiated) peer_pool_connect_result(ntohl(peer->address), ntohs(peer->port), true);
         } else {
             if (get_args().debug_mode) {
                 fprintf(stderr, "[PEER_MANAGER]: Expected a handshake message, but got something else. Peer marked for removal\n"); 
@@ -513,6 +546,25 @@ int peer_manager_unchoke_peer(Peer *peer) {
     return 0;
 }
 
+// Send have message to peer
+int peer_manager_send_have(Peer *peer, uint32_t piece_index) {
+    uint8_t message[9];
+    uint32_t length_prefix = htonl(5);      // 4 length bytes
+    memcpy(message, &length_prefix, 4);
+    message[4] = HAVE;                      // id byte
+    uint32_t index = htonl(piece_index);
+    memcpy(message + 5, &index, 4);
+
+    if (send_message(peer, message, 9) == -1) {
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[PEER_MANAGER]: Failed to send HAVE for piece %u\n", piece_index);
+            fflush(stderr);
+        }
+        return -1;
+    }
+    return 0;
+}
+
 // Send bitfield to peer
 int send_bitfield(Peer *peer) {
     const uint8_t *our_bitfield;
@@ -527,7 +579,7 @@ int send_bitfield(Peer *peer) {
         return 0;
     }
 
-    uint8_t *message = malloc(5 + bitfield_length);
+    uint8_t *message = buffer_pool_alloc(5 + bitfield_length);
     if (!message) return -1;
 
     uint32_t length_prefix = htonl(1 + bitfield_length);
@@ -540,10 +592,10 @@ int send_bitfield(Peer *peer) {
             fprintf(stderr, "[PEER_MANAGER]: Failed to send bitfield\n"); 
             fflush(stderr);
         }
-        free(message);
+        buffer_pool_free(message, 5 + bitfield_length);
         return -1;
     }
-    free(message);
+    buffer_pool_free(message, 5 + bitfield_length);
     return 0;
 }
 
@@ -602,12 +654,86 @@ int peer_manager_send_request(Peer *peer, uint32_t request_index, uint32_t reque
     peer->outstanding_requests[peer->requests_tail].index = request_index;
     peer->outstanding_requests[peer->requests_tail].begin = request_begin;
     peer->outstanding_requests[peer->requests_tail].length = request_length;
+    gettimeofday(&peer->outstanding_requests[peer->requests_tail].requested_at, NULL);
     peer->requests_tail = (peer->requests_tail + 1) % MAX_OUTSTANDING_REQUESTS;
     peer->num_outstanding_requests++;
 
     return 0;
 }
 
+// Work stealing: take over the oldest request whose holder is expected to finish it much later than peer would
+int peer_manager_steal_request(Peer *peer) {
+    if (get_endgame()) return -1;       // Endgame already duplicates every remaining request
+    if (!peer->handshake_done || peer->choked || peer->num_outstanding_requests >= MAX_OUTSTANDING_REQUESTS) return -1;
+
+    // Our own expected completion time for one more block, from the last measured rate (bits/sec)
+    double our_rate = get_download_rate(peer) / 8.0;
+    if (our_rate <= 0) return -1;       // Not proven fast yet, nothing to compare against
+    double our_queued_bytes = (double)peer->num_outstanding_requests * DEFAULT_BLOCK_LENGTH;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    Peer *peers = get_peers();
+    int num_peers = *get_num_peers();
+    Peer *victim = NULL;
+    int victim_slot = -1;
+    double oldest_age_ms = 0;
+
+    for (int i = 0; i < num_peers; i++) {
+        Peer *holder = &peers[i];
+        if (holder == peer) continue;
+
+        double holder_rate = get_download_rate(holder) / 8.0;
+        double holder_queued_bytes = 0;
+        for (int j = 0; j < holder->num_outstanding_requests; j++) {
+            int slot = (holder->requests_head + j) % MAX_OUTSTANDING_REQUESTS;
+            struct request *req = &holder->outstanding_requests[slot];
+            holder_queued_bytes += req->length;     // Bytes the holder must deliver before this request is done
+
+            double age_ms = elapsed_ms(&req->requested_at, &now);
+            if (age_ms < STEAL_MIN_AGE_MS || age_ms <= oldest_age_ms) continue;
+            if (!peer_has_piece(peer, req->index)) continue;
+
+            // Holder's expected time left (ms). A holder with no measured rate, or one already past its own estimate, is judged by the age alone
+            double holder_eta_ms = holder_rate > 0 ? holder_queued_bytes * 1000.0 / holder_rate : age_ms;
+            if (holder_eta_ms < age_ms) holder_eta_ms = age_ms;
+            double our_eta_ms = (our_queued_bytes + req->length) * 1000.0 / our_rate;
+            if (holder_eta_ms < STEAL_ETA_RATIO * our_eta_ms) continue;
+
+            // Don't steal something we already asked for
+            bool already_ours = false;
+            for (int k = 0; k < peer->num_outstanding_requests; k++) {
+                struct request *own = &peer->outstanding_requests[(peer->requests_head + k) % MAX_OUTSTANDING_REQUESTS];
+                if (own->index == req->index && own->begin == req->begin) {
+                    already_ours = true;
+                    break;
+                }
+            }
+            if (already_ours) continue;
+
+            victim = holder;
+            victim_slot = slot;
+            oldest_age_ms = age_ms;
+        }
+    }
+    if (!victim) return -1;
+
+    struct request stolen = victim->outstanding_requests[victim_slot];
+    if (peer_manager_send_request(peer, stolen.index, stolen.begin, stolen.length) != 0) return -1;
+
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[PEER_MANAGER]: Stole request idx=%u begin=%u (in-flight %.0f ms) from socket %d to socket %d\n",
+            stolen.index, stolen.begin, oldest_age_ms, victim->sock_fd, peer->sock_fd);
+        fflush(stderr);
+    }
+
+    // The slower copy is no longer needed
+    peer_manager_send_cancel(victim, stolen.index, stolen.begin, stolen.length);
+    remove_outstanding_request(victim, victim_slot);
+    return 0;
+}
+
 // Get the last time (seconds) a keepalive message was sent to peer
 double peer_manager_last_keepalive_message(Peer *peer) {
     return difftime(time(NULL), peer->last_keepalive_to_peer);
@@ -630,8 +756,111 @@ int peer_manager_send_keepalive_message(Peer *peer) {
     return 0;
 }
 
+// Experimental splice() receive path (--splice, write-through mode): once the header of a PIECE message we asked for
+// is in incoming_buffer, the rest of its payload moves socket -> pipe -> output file without entering user space.
+// Payload bytes that arrived with the header are written from the buffer.
+static void start_spliced_payload(Peer *peer) {
+    if (!get_args().splice_receive || !peer->handshake_done || peer->incoming_buffer_offset < PIECE_HEADER_LENGTH) return;
+    if (peer->incoming_buffer[4] != PIECE) return;
+
+    uint32_t length_prefix, index, begin;
+    memcpy(&length_prefix, peer->incoming_buffer, 4);
+    memcpy(&index, peer->incoming_buffer + 5, 4);
+    memcpy(&begin, peer->incoming_buffer + 9, 4);
+    length_prefix = ntohl(length_prefix);
+    index = ntohl(index);
+    begin = ntohl(begin);
+    if (length_prefix <= 9) return;
+    uint32_t block_length = length_prefix - 9;
+    size_t buffered = peer->incoming_buffer_offset - PIECE_HEADER_LENGTH;
+    if (buffered >= block_length) return;      // Whole message is here, the normal path handles it
+
+    bool requested = false;
+    for (int i = 0; i < peer->num_outstanding_requests && !requested; i++) {
+        struct request *element = &peer->outstanding_requests[(peer->requests_head + i) % MAX_OUTSTANDING_REQUESTS];
+        requested = element->index == index && element->begin == begin && element->length == block_length;
+    }
+    uint64_t file_offset;
+    if (!requested || !piece_manager_splice_target(index, begin, block_length, &file_offset)) return;
+    if (splice_pipe[0] < 0 && pipe2(splice_pipe, O_CLOEXEC) != 0) {
+        splice_pipe[0] = splice_pipe[1] = -1;
+        return;
+    }
+    if (buffered > 0 && storage_write(file_offset, peer->incoming_buffer + PIECE_HEADER_LENGTH, buffered) != 0) return;
+
+    peer->splice_active = true;
+    peer->splice_failed = false;
+    peer->splice_index = index;
+    peer->splice_begin = begin;
+    peer->splice_length = block_length;
+    peer->splice_received = (uint32_t)buffered;
+    peer->splice_offset = file_offset;
+    peer->incoming_buffer_offset = 0;
+}
+
+// Stop putting a spliced payload in the file: the rest is read and dropped to stay in sync with the stream, and the
+// block goes back to be requested again (if it hasn't arrived from someone else in the meantime)
+static void abandon_spliced_payload(Peer *peer) {
+    peer->splice_failed = true;
+    for (int i = 0; i < peer->num_outstanding_requests; i++) {
+        int index = (peer->requests_head + i) % MAX_OUTSTANDING_REQUESTS;
+        if (peer->outstanding_requests[index].index == peer->splice_index && peer->outstanding_requests[index].begin == peer->splice_begin) {
+            remove_outstanding_request(peer, index);
+            break;
+        }
+    }
+    piece_manager_release_block_request(peer->splice_index, peer->splice_begin);
+}
+
+// Continue a spliced payload. Returns like peer_manager_receive_messages.
+static int receive_spliced_payload(Peer *peer) {
+    size_t remaining = peer->splice_length - peer->splice_received;
+    uint64_t file_offset;
+    if (!peer->splice_failed && !piece_manager_splice_target(peer->splice_index, peer->splice_begin, peer->splice_length, &file_offset)) {
+        // The block arrived from another peer (endgame) and its piece may be verified already; don't overwrite it
+        abandon_spliced_payload(peer);
+    }
+    if (!peer->splice_failed && splice_pipe[0] < 0 && pipe2(splice_pipe, O_CLOEXEC) != 0) {
+        splice_pipe[0] = splice_pipe[1] = -1;
+        abandon_spliced_payload(peer);
+    }
+
+    ssize_t moved;
+    if (peer->splice_failed) {
+        moved = recv(peer->sock_fd, peer->incoming_buffer, remaining, MSG_DONTWAIT);
+    } else {
+        moved = splice(peer->sock_fd, NULL, splice_pipe[1], NULL, remaining, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0 && storage_splice_from(splice_pipe[0], peer->splice_offset + peer->splice_received, (size_t)moved) != 0) {
+            if (get_args().debug_mode) {
+                fprintf(stderr, "[PEER_MANAGER]: splice into the output file failed, dropping block %u:%u\n", peer->splice_index, peer->splice_begin);
+                fflush(stderr);
+            }
+            // Whatever is left in the pipe belongs to no one now, start over with a fresh one (other peers part way
+            // through a payload use it next)
+            close(splice_pipe[0]);
+            close(splice_pipe[1]);
+            if (pipe2(splice_pipe, O_CLOEXEC) != 0) splice_pipe[0] = splice_pipe[1] = -1;
+            abandon_spliced_payload(peer);
+        }
+    }
+    if (moved == 0) return 0;       // Disconnected
+    if (moved < 0) return -1;       // Nothing to receive yet, or an error the caller treats like recv's
+
+    peer->splice_received += (uint32_t)moved;
+    peer->bytes_recv += moved;
+    peer->total_bytes_recv += moved;
+    if (peer->splice_received == peer->splice_length) {
+        peer->splice_active = false;
+        if (!peer->splice_failed) {
+            process_received_block(peer, peer->splice_index, peer->splice_begin, NULL, peer->splice_length);
+        }
+    }
+    return (int)moved;
+}
+
 // Receive incoming, store in buffer, and process
 int peer_manager_receive_messages(Peer *peer) {
+    if (peer->splice_active) return receive_spliced_payload(peer);
     if (MAX_INCOMING_BYTES - peer->incoming_buffer_offset == 0) {
         int parse = parse_peer_incoming_buffer(peer);
         if (parse == -1) {      // Peer marked for disconnect and removal, could be for many reasons
@@ -667,13 +896,73 @@ int peer_manager_receive_messages(Peer *peer) {
 
     peer->incoming_buffer_offset += received;
     peer->bytes_recv += received;
+    peer->total_bytes_recv += received;
     int parse = parse_peer_incoming_buffer(peer);
     if (parse == -1) {      // Peer marked for disconnect and removal, could be for many reasons
         return 0;
     }
+    start_spliced_payload(peer);
     return received;
 }
 
+// Append a connected (or connecting) peer to the fds and peers arrays with its fields initialized
+static Peer *track_peer(Torrent torrent, int sock, uint32_t address, uint16_t port, bool we_initiated) {
+    struct pollfd *fds = get_fds();
+    Peer *peers = get_peers();
+    int *num_fds = get_num_fds();
+    int *num_peers = get_num_peers();
+    Peer *peer = &peers[*num_peers];
+
+    // Add the new peers socket to the pollfd array and peers array
+    fds[*num_fds].fd = sock;
+    fds[*num_fds].events = POLLIN;
+    (*num_fds)++;
+    
+    // Initializing all the fields for the peers array
+    peer->bitfield = NULL;      // We can expect this to be initialized later
+    peer->bitfield_bytes = 0;
+    // incoming_buffer doesn't need assignment
+    peer->incoming_buffer_offset = 0;
+    peer->splice_active = false;
+    peer->torrent = torrent;
+    peer->sock_fd = sock;
+    peer->address = address;
+    peer->port = port;
+    // don't assign id until handshake is received
+    peer->we_initiated = we_initiated;
+    peer->connecting = false;
+    peer->bytes_sent = 0;
+    peer->bytes_recv = 0;
+    gettimeofday(&peer->last_rate_time, NULL);
+    peer->upload_rate = 0;
+    peer->download_rate = 0;
+    peer->total_bytes_recv = 0;
+    peer->connected_at = time(NULL);
+    peer->last_keepalive_to_peer = time(NULL);
+    peer->num_outstanding_requests = 0;
+    peer->requests_tail = 0;
+    peer->requests_head = 0;
+    // outstanding_requests doesn't need assignment
+    peer->handshake_done = false;
+    peer->choking = true;
+    peer->is_interesting = false;
+    peer->choked = true;
+    peer->is_interested = false;
+
+    (*num_peers)++;
+    
+    if (get_args().debug_mode) {
+        char addr_str[INET_ADDRSTRLEN];
+        struct in_addr addr;
+        addr.s_addr = peer->address;
+        inet_ntop(AF_INET, &addr, addr_str, sizeof(addr_str));
+        fprintf(stderr, "[PEER_MANAGER]: New peer from %s on socket %d\n", addr_str, sock);
+        fflush(stderr);
+    }
+
+    return peer;
+}
+
 // Add and connect to a new peer, sending it a handshake
 int peer_manager_add_peer(Torrent torrent, const struct sockaddr_in *addr, socklen_t addr_len) {
     int new_sock;
@@ -682,9 +971,6 @@ int peer_manager_add_peer(Torrent torrent, const struct sockaddr_in *addr, sockl
     memset(&new_addr, 0, sizeof(new_addr));     // Initialize
 
     struct pollfd *fds = get_fds();
-    Peer *peers = get_peers();
-    int *num_fds = get_num_fds();
-    int *num_peers = get_num_peers();
 
     new_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (new_sock == -1) {
@@ -767,58 +1053,76 @@ int peer_manager_add_peer(Torrent torrent, const struct sockaddr_in *addr, sockl
         }
     }
 
-    // Add the new peers socket to the pollfd array and peers array
-    fds[*num_fds].fd = new_sock;
-    fds[*num_fds].events = POLLIN;
-    (*num_fds)++;
-    
-    // Initializing all the fields for the peers array
-    peers[*num_peers].bitfield = NULL;      // We can expect this to be initialized later
-    peers[*num_peers].bitfield_bytes = 0;
-    // incoming_buffer doesn't need assignment
-    peers[*num_peers].incoming_buffer_offset = 0;
-    peers[*num_peers].torrent = torrent;
-    peers[*num_peers].sock_fd = new_sock;
-    if (addr == NULL) {
-        peers[*num_peers].address = new_addr.sin_addr.s_addr;
-        peers[*num_peers].port = new_addr.sin_port;
-    } else {
-        peers[*num_peers].address = addr->sin_addr.s_addr;
-        peers[*num_peers].port = addr->sin_port;
+    Peer *peer = addr == NULL ? track_peer(torrent, new_sock, new_addr.sin_addr.s_addr, new_addr.sin_port, false) :
+        track_peer(torrent, new_sock, addr->sin_addr.s_addr, addr->sin_port, true);
+
+    // Send handshake immediately after connection is made
+    send_handshake(peer);
+
+    return new_sock;
+}
+
+// Start connecting to a peer without waiting for the connection; the event loop finishes it on POLLOUT
+int peer_manager_connect_peer(Torrent torrent, const struct sockaddr_in *addr, socklen_t addr_len) {
+    int new_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (new_sock == -1) {
+        return -1;
+    }
+    int flags = fcntl(new_sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(new_sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+        close(new_sock);
+        return -1;
+    }
+    if (connect(new_sock, (struct sockaddr *)addr, addr_len) == -1 && errno != EINPROGRESS) {
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[PEER_MANAGER]: Failed to create connection with %s\n", inet_ntoa(addr->sin_addr)); 
+            fflush(stderr);
+        }
+        close(new_sock);
+        return -1;
     }
-    // don't assign id until handshake is received
-    peers[*num_peers].we_initiated = (addr != NULL);
-    peers[*num_peers].bytes_sent = 0;
-    peers[*num_peers].bytes_recv = 0;
-    gettimeofday(&peers[*num_peers].last_rate_time, NULL);
-    peers[*num_peers].upload_rate = 0;
-    peers[*num_peers].download_rate = 0;
-    peers[*num_peers].last_keepalive_to_peer = time(NULL);
-    peers[*num_peers].num_outstanding_requests = 0;
-    peers[*num_peers].requests_tail = 0;
-    peers[*num_peers].requests_head = 0;
-    // outstanding_requests doesn't need assignment
-    peers[*num_peers].handshake_done = false;
-    peers[*num_peers].choking = true;
-    peers[*num_peers].is_interesting = false;
-    peers[*num_peers].choked = true;
-    peers[*num_peers].is_interested = false;
 
-    (*num_peers)++;
-    
-    if (get_args().debug_mode) {
-        char addr_str[INET_ADDRSTRLEN];
-        struct in_addr addr;
-        addr.s_addr = peers[(*num_peers) - 1].address;
-        inet_ntop(AF_INET, &addr, addr_str, sizeof(addr_str));
-        fprintf(stderr, "[PEER_MANAGER]: New peer from %s on socket %d\n", addr_str, new_sock);
-        fflush(stderr);
+    Peer *peer = track_peer(torrent, new_sock, addr->sin_addr.s_addr, addr->sin_port, true);
+    peer->connecting = true;
+    get_fds()[peer - get_peers() + 1].events = POLLOUT;
+    return new_sock;
+}
+
+// Finish a connection started by peer_manager_connect_peer once its socket polls writable
+int peer_manager_finish_connect(Peer *peer) {
+    int sock_error = 0;
+    socklen_t error_length = sizeof(sock_error);
+    if (getsockopt(peer->sock_fd, SOL_SOCKET, SO_ERROR, &sock_error, &error_length) == -1 || sock_error) {
+        if (get_args().debug_mode) {
+            struct in_addr addr = { .s_addr = peer->address };
+            fprintf(stderr, "[PEER_MANAGER]: Something went wrong while connecting %s: %s\n", inet_ntoa(addr), strerror(sock_error)); 
+            fflush(stderr);
+        }
+        return -1;
     }
 
-    // Send handshake immediately after connection is made
-    send_handshake(&peers[(*num_peers) - 1]);
+    // Connected: make the socket blocking again like every other peer socket and start the handshake
+    int flags = fcntl(peer->sock_fd, F_GETFL, 0);
+    fcntl(peer->sock_fd, F_SETFL, flags & ~O_NONBLOCK);
+    get_fds()[peer - get_peers() + 1].events = POLLIN;
+    peer->connecting = false;
+    peer->connected_at = time(NULL);
+    send_handshake(peer);       // The candidate pool hears of the connection once the peer's handshake is in
+    return 0;
+}
 
-    return new_sock;
+// Drop connections started by peer_manager_connect_peer that haven't finished within PEER_CONNECT_TIMEOUT_SECONDS
+void peer_manager_drop_stalled_connects(void) {
+    Peer *peers = get_peers();
+    int *num_peers = get_num_peers();
+    time_t now = time(NULL);
+    for (int i = 0; i < *num_peers; ) {
+        if (peers[i].connecting && now - peers[i].connected_at >= PEER_CONNECT_TIMEOUT_SECONDS) {
+            peer_manager_remove_peer(&peers[i]);    // Moves the last peer into slot i
+            continue;
+        }
+        i++;
+    }
 }
 
 // Disconnect and remove a specified peer. Compacts the fds and peers arrays by filling the resulting empty hole when the peer is removed.
@@ -850,6 +1154,16 @@ int peer_manager_remove_peer(Peer *peer) {
     int old_fd = fds[fds_index].fd;
     close(old_fd);
 
+    // Let the candidate pool know whether the connect failed or what the connection delivered. A peer that accepts
+    // the TCP connection but closes it before its handshake (wrong torrent, full, not a BitTorrent client at all)
+    // counts as a failed connect, so it backs off like an unreachable one.
+    if (peers[peer_index].connecting || (peers[peer_index].we_initiated && !peers[peer_index].handshake_done)) {
+        peer_pool_connect_result(ntohl(peers[peer_index].address), ntohs(peers[peer_index].port), false);
+    } else if (peers[peer_index].we_initiated) {
+        peer_pool_disconnected(ntohl(peers[peer_index].address), ntohs(peers[peer_index].port),
+            peers[peer_index].total_bytes_recv, (long)(time(NULL) - peers[peer_index].connected_at));
+    }
+
     uint32_t old_address = peers[peer_index].address;
 
     // The entry is now empty, so compact the fds and clients array (fill in the empty space)
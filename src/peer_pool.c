@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "peer_pool.h"
+#include "btclient.h"   // For get_args() for debug mode
+
+// A peer we can connect to, with what happened the times we tried
+typedef struct {
+    uint32_t address;               // Host byte order
+    uint16_t port;
+    bool in_use;                    // Handed out by peer_pool_next and not yet failed or disconnected
+    int failures;                   // Failed connects in a row
+    int connections;                // Connections made so far
+    time_t retry_at;                // Not picked again before this
+    uint64_t bytes_received;        // Over all earlier connections
+    long seconds_connected;
+    int next;                       // Next candidate in the same bucket, -1 at the end
+} Candidate;
+
+static Candidate *candidates = NULL;
+static int num_candidates = 0;
+static int *buckets = NULL;         // First candidate in each bucket, -1 if empty
+
+static unsigned int bucket_of(uint32_t address, uint16_t port) {
+    uint32_t hash = (address * 2654435761u) ^ ((uint32_t)port * 40503u);
+    return (hash ^ (hash >> 16)) & (PEER_POOL_BUCKETS - 1);
+}
+
+static int find(uint32_t address, uint16_t port) {
+    for (int i = buckets[bucket_of(address, port)]; i != -1; i = candidates[i].next) {
+        if (candidates[i].address == address && candidates[i].port == port) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The link (bucket head or a candidate's next) that points at candidate index
+static int *link_to(int index) {
+    int *link = &buckets[bucket_of(candidates[index].address, candidates[index].port)];
+    while (*link != index) {
+        link = &candidates[*link].next;
+    }
+    return link;
+}
+
+// Drop a candidate, moving the last one into its place
+static void remove_candidate(int index) {
+    *link_to(index) = candidates[index].next;
+    int last = --num_candidates;
+    if (index != last) {
+        *link_to(last) = index;
+        candidates[index] = candidates[last];
+    }
+}
+
+static double throughput(const Candidate *candidate) {
+    long seconds = candidate->seconds_connected > 0 ? candidate->seconds_connected : 1;
+    return (double)candidate->bytes_received / seconds;
+}
+
+// Whether a should be tried before b: faster in earlier connections, then fewer failures, then tried less often
+static bool ranks_before(const Candidate *a, const Candidate *b) {
+    double rate_a = throughput(a), rate_b = throughput(b);
+    if (rate_a != rate_b) return rate_a > rate_b;
+    if (a->failures != b->failures) return a->failures < b->failures;
+    return a->connections < b->connections;
+}
+
+static void log_candidate(const char *what, const Candidate *candidate) {
+    if (!get_args().debug_mode) return;
+    char addr_str[INET_ADDRSTRLEN];
+    struct in_addr addr = { .s_addr = htonl(candidate->address) };
+    inet_ntop(AF_INET, &addr, addr_str, sizeof(addr_str));
+    fprintf(stderr, "[PeerPool] %s %s:%u (%.0f B/s over %d connections, %d failures, %d candidates).\n", what, addr_str,
+        candidate->port, throughput(candidate), candidate->connections, candidate->failures, num_candidates);
+}
+
+int peer_pool_init(void) {
+    peer_pool_destroy();
+    candidates = malloc(PEER_POOL_CAPACITY * sizeof(Candidate));
+    buckets = malloc(PEER_POOL_BUCKETS * sizeof(int));
+    if (!candidates || !buckets) {
+        peer_pool_destroy();
+        return -1;
+    }
+    memset(buckets, 0xff, PEER_POOL_BUCKETS * sizeof(int));    // All -1
+    return 0;
+}
+
+void peer_pool_destroy(void) {
+    free(candidates);
+    free(buckets);
+    candidates = NULL;
+    buckets = NULL;
+    num_candidates = 0;
+}
+
+bool peer_pool_add(uint32_t address, uint16_t port) {
+    if (!candidates || address == 0 || port == 0 || find(address, port) != -1) return false;
+
+    if (num_candidates == PEER_POOL_CAPACITY) {
+        // Full: make room by dropping the lowest ranked candidate that isn't in use
+        int worst = -1;
+        for (int i = 0; i < num_candidates; i++) {
+            if (!candidates[i].in_use && (worst == -1 || ranks_before(&candidates[worst], &candidates[i]))) {
+                worst = i;
+            }
+        }
+        if (worst == -1) return false;
+        remove_candidate(worst);
+    }
+
+    Candidate *candidate = &candidates[num_candidates];
+    memset(candidate, 0, sizeof(*candidate));
+    candidate->address = address;
+    candidate->port = port;
+    unsigned int bucket = bucket_of(address, port);
+    candidate->next = buckets[bucket];
+    buckets[bucket] = num_candidates++;
+    return true;
+}
+
+bool peer_pool_next(uint32_t *address, uint16_t *port) {
+    time_t now = time(NULL);
+    int best = -1;
+    for (int i = 0; i < num_candidates; i++) {
+        const Candidate *candidate = &candidates[i];
+        if (candidate->in_use || candidate->retry_at > now) continue;
+        if (best == -1 || ranks_before(candidate, &candidates[best])) {
+            best = i;
+        }
+    }
+    if (best == -1) return false;
+    candidates[best].in_use = true;
+    *address = candidates[best].address;
+    *port = candidates[best].port;
+    return true;
+}
+
+void peer_pool_connect_result(uint32_t address, uint16_t port, bool connected) {
+    int index = candidates ? find(address, port) : -1;
+    if (index == -1) return;
+    Candidate *candidate = &candidates[index];
+    if (connected) {
+        candidate->failures = 0;
+        candidate->connections++;
+        return;
+    }
+
+    candidate->in_use = false;
+    candidate->failures++;
+    if (candidate->failures >= PEER_POOL_MAX_FAILURES) {
+        log_candidate("Dropping unreachable peer", candidate);
+        remove_candidate(index);
+        return;
+    }
+    candidate->retry_at = time(NULL) + ((long)PEER_POOL_RETRY_SECONDS << (candidate->failures - 1));
+}
+
+void peer_pool_disconnected(uint32_t address, uint16_t port, uint64_t bytes_received, long seconds) {
+    int index = candidates ? find(address, port) : -1;
+    if (index == -1) return;
+    Candidate *candidate = &candidates[index];
+    candidate->in_use = false;
+    candidate->bytes_received += bytes_received;
+    candidate->seconds_connected += seconds;
+    candidate->retry_at = time(NULL) + PEER_POOL_RECONNECT_SECONDS;
+    log_candidate("Disconnected from", candidate);
+}
+
+// Peer cache file layout: PeerCacheHeader followed by num_peers PeerCacheEntry records, best first
+#define PEER_CACHE_MAGIC 0x50505442u    // "BTPP"
+#define PEER_CACHE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t info_hash[20];
+    int64_t saved_at;
+    uint32_t num_peers;
+} PeerCacheHeader;
+
+typedef struct {
+    uint32_t address;               // Host byte order
+    uint16_t port;
+    uint16_t connections;
+    uint64_t bytes_received;
+    int64_t seconds_connected;
+} PeerCacheEntry;
+
+// qsort order for saving: highest throughput first, then longest connected
+static int compare_for_cache(const void *a, const void *b) {
+    const Candidate *x = &candidates[*(const int *)a], *y = &candidates[*(const int *)b];
+    double rate_x = throughput(x), rate_y = throughput(y);
+    if (rate_x != rate_y) return rate_x > rate_y ? -1 : 1;
+    if (x->seconds_connected != y->seconds_connected) return x->seconds_connected > y->seconds_connected ? -1 : 1;
+    return 0;
+}
+
+int peer_pool_save(const char *path, const unsigned char info_hash[20]) {
+    if (!candidates || !path) return -1;
+
+    // Only peers we actually got a connection to are worth a warm start
+    int *order = malloc((num_candidates + 1) * sizeof(int));
+    if (!order) return -1;
+    int num_saved = 0;
+    for (int i = 0; i < num_candidates; i++) {
+        if (candidates[i].connections > 0) order[num_saved++] = i;
+    }
+    qsort(order, num_saved, sizeof(int), compare_for_cache);
+    if (num_saved > PEER_CACHE_MAX_PEERS) num_saved = PEER_CACHE_MAX_PEERS;
+
+    PeerCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = PEER_CACHE_MAGIC;
+    header.version = PEER_CACHE_VERSION;
+    memcpy(header.info_hash, info_hash, sizeof(header.info_hash));
+    header.saved_at = time(NULL);
+    header.num_peers = num_saved;
+
+    // Write beside the old file and rename over it, so a crash mid-save leaves the previous cache intact
+    size_t tmp_name_len = strlen(path) + sizeof(".tmp");
+    char *tmp_name = malloc(tmp_name_len);
+    FILE *cache_file = NULL;
+    if (tmp_name) {
+        snprintf(tmp_name, tmp_name_len, "%s.tmp", path);
+        cache_file = fopen(tmp_name, "wb");
+    }
+    if (!cache_file) {
+        if (get_args().debug_mode) fprintf(stderr, "[PeerPool] Warn: Could not create '%s.tmp': %s\n", path, strerror(errno));
+        free(tmp_name);
+        free(order);
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, cache_file) == 1;
+    for (int i = 0; ok && i < num_saved; i++) {
+        const Candidate *candidate = &candidates[order[i]];
+        PeerCacheEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.address = candidate->address;
+        entry.port = candidate->port;
+        entry.connections = candidate->connections < UINT16_MAX ? candidate->connections : UINT16_MAX;
+        entry.bytes_received = candidate->bytes_received;
+        entry.seconds_connected = candidate->seconds_connected;
+        ok = fwrite(&entry, sizeof(entry), 1, cache_file) == 1;
+    }
+    free(order);
+    ok = ok && fflush(cache_file) == 0 && fsync(fileno(cache_file)) == 0;
+    ok = fclose(cache_file) == 0 && ok;
+    if (!ok || rename(tmp_name, path) != 0) {
+        if (get_args().debug_mode) fprintf(stderr, "[PeerPool] Warn: Could not write peer cache '%s'.\n", path);
+        remove(tmp_name);
+        free(tmp_name);
+        return -1;
+    }
+    free(tmp_name);
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[PeerPool] Saved %d peers to '%s'.\n", num_saved, path);
+    }
+    return num_saved;
+}
+
+int peer_pool_load(const char *path, const unsigned char info_hash[20]) {
+    if (!candidates || !path) return -1;
+    FILE *cache_file = fopen(path, "rb");
+    if (!cache_file) return -1;
+
+    PeerCacheHeader header;
+    time_t now = time(NULL);
+    bool valid = fread(&header, sizeof(header), 1, cache_file) == 1 &&
+                 header.magic == PEER_CACHE_MAGIC && header.version == PEER_CACHE_VERSION &&
+                 memcmp(header.info_hash, info_hash, sizeof(header.info_hash)) == 0 &&
+                 header.saved_at <= now && now - header.saved_at <= PEER_CACHE_MAX_AGE_SECONDS &&
+                 header.num_peers <= PEER_CACHE_MAX_PEERS;
+    if (!valid) {
+        fclose(cache_file);
+        if (get_args().debug_mode) fprintf(stderr, "[PeerPool] Peer cache '%s' is stale or invalid, ignoring it.\n", path);
+        return -1;
+    }
+
+    int loaded = 0;
+    PeerCacheEntry entry;
+    for (uint32_t i = 0; i < header.num_peers && fread(&entry, sizeof(entry), 1, cache_file) == 1; i++) {
+        if (!peer_pool_add(entry.address, entry.port)) continue;
+        // Carry the history over, so these rank above peers we know nothing about yet
+        Candidate *candidate = &candidates[find(entry.address, entry.port)];
+        candidate->connections = entry.connections;
+        candidate->bytes_received = entry.bytes_received;
+        candidate->seconds_connected = entry.seconds_connected > 0 ? entry.seconds_connected : 0;
+        loaded++;
+    }
+    fclose(cache_file);
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[PeerPool] Loaded %d cached peers from '%s', saved %ld s ago.\n", loaded, path, (long)(now - header.saved_at));
+    }
+    return loaded;
+}
+
+int peer_pool_size(void) {
+    return num_candidates;
+}
+
+int peer_pool_available(void) {
+    time_t now = time(NULL);
+    int available = 0;
+    for (int i = 0; i < num_candidates; i++) {
+        if (!candidates[i].in_use && candidates[i].retry_at <= now) available++;
+    }
+    return available;
+}
@@ -3,30 +3,212 @@
 #include <string.h>
 #include <math.h>   // For ceil
 #include <errno.h>  // For perror
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "piece_manager.h"
 #include "hash.h"       // For sha1sum functions
+#include "hash_pool.h"  // For off-thread piece verification
+#include "storage.h"    // For output file access
+#include "disk_writer.h"    // For writing verified pieces off the event loop
+#include "read_cache.h"     // For serving uploads from whole cached pieces
+#include "buffer_pool.h"    // For piece and block buffers
 #include "btclient.h"   // For get_args() for debug mode
 
-static ManagedPiece *all_managed_pieces = NULL;     // Array of all pieces
+// Details only a piece in flight needs: created when it leaves MISSING, dropped once it is HAVE with its data on
+// disk (or goes back to MISSING)
+typedef struct {
+    uint32_t index;                 // Piece index
+    uint8_t *data_buffer;           // Buffer for incoming block data (NULL in write-through mode, blocks go straight to disk)
+    uint32_t num_blocks_received;   // Count of blocks successfully received
+
+    // Running SHA-1 over the contiguous prefix of received blocks (out-of-order blocks wait in data_buffer, or on disk
+    // in write-through mode, until the gap fills)
+    struct sha1sum_ctx *hash_ctx;   // NULL until the first block arrives
+    uint32_t num_blocks_hashed;     // Blocks [0, num_blocks_hashed) have been fed to hash_ctx
+} InFlightPiece;
+
+// Piece state is kept as parallel arrays indexed by piece, and block state as two bitsets indexed by global block
+// number (piece * blocks_per_piece + block), so a huge torrent costs a few allocations and a few bits per block
+static uint8_t *piece_states = NULL;                // PieceState of each piece
+static uint8_t (*expected_hashes)[20] = NULL;       // SHA-1 of each piece from the .torrent metafile
+static uint16_t *piece_availability = NULL;         // How many connected peers have each piece (for rarest-first)
+static uint64_t *block_bits = NULL;                 // Arena holding both bitsets below
+static uint64_t *blocks_received = NULL;            // Block has arrived (or its piece is HAVE)
+static uint64_t *blocks_requested = NULL;           // Block has been requested from some peer
+static uint32_t blocks_per_piece = 0;               // Blocks in a standard piece
+
+static InFlightPiece **in_flight = NULL;            // Open-addressed by piece index, NULL slots are empty
+static uint32_t in_flight_capacity = 0;             // Power of two
+static uint32_t in_flight_count = 0;
+
 static uint32_t total_torrent_pieces = 0;           // Total pieces in torrent
 static uint64_t total_torrent_file_length = 0;      // Total size of the file(s) to download
 static uint32_t standard_piece_length = 0;          // Length of a standard piece
+static uint32_t last_piece_length = 0;              // Length of the last piece (can be shorter)
 
 static uint8_t *client_bitfield = NULL;             // Our bitfield of HAVE pieces
 static size_t client_bitfield_length_bytes = 0;     // Length of our bitfield
 
-static FILE *output_file_ptr = NULL;                // File pointer for the download
+static bool output_file_open = false;               // Output file is accessed through the storage module
 static char *output_file_name_global = NULL;        // Name of the output file
+static char *resume_file_name_global = NULL;        // Fast-resume state, "<output>.resume"
+static uint8_t torrent_info_hash[20];               // Ties the resume file to this torrent
 
 static uint32_t pieces_we_have_count = 0;           // Count of pieces we have verified
 static uint64_t bytes_we_have_downloaded = 0;       // Total verified bytes downloaded
 
+static bool write_through_mode = false;             // Blocks are written as they arrive, pieces have no data_buffer
+static int pieces_verifying_count = 0;              // Pieces queued on the hashing pool
+static int pieces_writing_count = 0;                // HAVE pieces whose data is still queued on the disk writer
+static uint32_t newly_verified[HASH_POOL_QUEUE_SIZE];   // Pieces that became HAVE and haven't been announced yet
+static int newly_verified_count = 0;
+
+#define HASH_CTX_CACHE_SIZE 64
+static struct sha1sum_ctx *hash_ctx_cache[HASH_CTX_CACHE_SIZE];  // Reset contexts ready for the next pending piece
+static int hash_ctx_cache_count = 0;
+
+#define IN_FLIGHT_MIN_CAPACITY 64
+
 static uint32_t calculate_num_blocks_for_piece(uint32_t piece_len_bytes);
 static uint32_t calculate_block_length(uint32_t piece_actual_len, uint32_t block_index_in_piece, uint32_t num_total_blocks_for_this_piece);
 static void set_bit_in_bitfield(uint8_t *bitfield_array, uint32_t piece_idx_to_set);
 static bool get_bit_from_bitfield(const uint8_t *bitfield_array, uint32_t piece_idx_to_get, size_t bitfield_total_pieces_count);
 static bool write_piece_data_to_file(uint32_t piece_idx_to_write, const uint8_t *data_to_write, uint32_t data_length);
+static void queue_have_announce(uint32_t piece_index);
+static bool commit_verified_piece(InFlightPiece *piece);
+static void reset_piece_for_redownload(uint32_t piece_index);
+static struct sha1sum_ctx *acquire_hash_ctx(void);
+static void release_hash_ctx(InFlightPiece *piece);
+static void advance_piece_hash(InFlightPiece *piece, uint32_t new_block_index, const uint8_t *new_block_data);
+static int hash_from_storage(struct sha1sum_ctx *ctx, uint64_t offset, uint64_t length);
+static int finish_received_block(InFlightPiece *piece, uint32_t block_index_in_piece, const uint8_t *block_data);
+static void process_completed_writes(void);
+static void mark_piece_have_on_disk(uint32_t piece_index);
+static void recheck_existing_data(void);
+static bool load_resume_state(void);
+static StorageFileSpec *build_storage_specs(const Torrent *torrent, const char *output_filename, int *num_specs_out);
+static void free_storage_specs(StorageFileSpec *specs, int num_specs);
+
+// --- Piece and block state ---
+static uint32_t piece_length_of(uint32_t piece_index) {
+    return piece_index == total_torrent_pieces - 1 ? last_piece_length : standard_piece_length;
+}
+
+static uint32_t num_blocks_of(uint32_t piece_index) {
+    return piece_index == total_torrent_pieces - 1 ? calculate_num_blocks_for_piece(last_piece_length) : blocks_per_piece;
+}
+
+static uint64_t first_block_of(uint32_t piece_index) {
+    return (uint64_t)piece_index * blocks_per_piece;
+}
+
+static bool test_block(const uint64_t *bits, uint64_t block) {
+    return (bits[block / 64] >> (block % 64)) & 1;
+}
+
+static void set_block(uint64_t *bits, uint64_t block) {
+    bits[block / 64] |= 1ULL << (block % 64);
+}
+
+// Set or clear blocks [first, first + count) a word at a time
+static void fill_blocks(uint64_t *bits, uint64_t first, uint64_t count, bool value) {
+    uint64_t end = first + count;
+    while (first < end) {
+        uint64_t span = 64 - first % 64;
+        if (span > end - first) span = end - first;
+        uint64_t mask = (span == 64 ? ~0ULL : ((1ULL << span) - 1)) << (first % 64);
+        if (value) bits[first / 64] |= mask; else bits[first / 64] &= ~mask;
+        first += span;
+    }
+}
+
+// Offset within a piece's blocks of the first one neither received nor requested, or count if there is none
+static uint32_t first_unrequested_block(uint64_t first, uint32_t count) {
+    uint64_t block = first, end = first + count;
+    while (block < end) {
+        uint64_t span = 64 - block % 64;
+        if (span > end - block) span = end - block;
+        uint64_t open = ~(blocks_received[block / 64] | blocks_requested[block / 64]) >> (block % 64);
+        if (span < 64) open &= (1ULL << span) - 1;
+        if (open) return (uint32_t)(block - first + __builtin_ctzll(open));
+        block += span;
+    }
+    return count;
+}
+
+static uint32_t in_flight_home(uint32_t piece_index) {
+    return (piece_index * 2654435761u) & (in_flight_capacity - 1);     // Fibonacci hashing spreads runs of indices
+}
+
+static InFlightPiece *find_in_flight(uint32_t piece_index) {
+    if (in_flight_capacity == 0) return NULL;
+    for (uint32_t slot = in_flight_home(piece_index); in_flight[slot]; slot = (slot + 1) & (in_flight_capacity - 1)) {
+        if (in_flight[slot]->index == piece_index) return in_flight[slot];
+    }
+    return NULL;
+}
+
+static bool grow_in_flight(void) {
+    uint32_t old_capacity = in_flight_capacity;
+    InFlightPiece **old_table = in_flight;
+    uint32_t new_capacity = old_capacity ? old_capacity * 2 : IN_FLIGHT_MIN_CAPACITY;
+    InFlightPiece **new_table = calloc(new_capacity, sizeof(InFlightPiece *));
+    if (!new_table) return false;
+
+    in_flight = new_table;
+    in_flight_capacity = new_capacity;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (!old_table[i]) continue;
+        uint32_t slot = in_flight_home(old_table[i]->index);
+        while (in_flight[slot]) slot = (slot + 1) & (in_flight_capacity - 1);
+        in_flight[slot] = old_table[i];
+    }
+    free(old_table);
+    return true;
+}
+
+// The piece's in-flight details, created empty if it has none yet. NULL if out of memory.
+static InFlightPiece *get_in_flight(uint32_t piece_index) {
+    InFlightPiece *piece = find_in_flight(piece_index);
+    if (piece) return piece;
+    if ((in_flight_count + 1) * 2 > in_flight_capacity && !grow_in_flight()) return NULL;     // Keep probes short
+
+    piece = calloc(1, sizeof(InFlightPiece));
+    if (!piece) return NULL;
+    piece->index = piece_index;
+    uint32_t slot = in_flight_home(piece_index);
+    while (in_flight[slot]) slot = (slot + 1) & (in_flight_capacity - 1);
+    in_flight[slot] = piece;
+    in_flight_count++;
+    return piece;
+}
+
+// Release a piece's buffer and running hash and forget its details
+static void drop_in_flight(InFlightPiece *piece) {
+    uint32_t mask = in_flight_capacity - 1;
+    uint32_t hole = in_flight_home(piece->index);
+    while (in_flight[hole] != piece) hole = (hole + 1) & mask;
+    in_flight[hole] = NULL;
+    in_flight_count--;
+
+    // Backward-shift deletion: pull later entries of the probe run into the hole unless their home lies after it
+    for (uint32_t slot = (hole + 1) & mask; in_flight[slot]; slot = (slot + 1) & mask) {
+        uint32_t home = in_flight_home(in_flight[slot]->index);
+        bool stays = hole < slot ? (home > hole && home <= slot) : (home > hole || home <= slot);
+        if (stays) continue;
+        in_flight[hole] = in_flight[slot];
+        in_flight[slot] = NULL;
+        hole = slot;
+    }
+
+    release_hash_ctx(piece);
+    buffer_pool_free(piece->data_buffer, piece_length_of(piece->index));
+    free(piece);
+}
 
 int piece_manager_init(const Torrent *torrent, const char *output_filename) {
     if (!torrent || !output_filename) {
@@ -43,131 +225,101 @@ int piece_manager_init(const Torrent *torrent, const char *output_filename) {
 
     if (torrent->info.mode_type == MODE_SINGLE_FILE) {
         total_torrent_file_length = torrent->info.mode.single_file.length;
-    } else { 
+    } else {
         total_torrent_file_length = torrent->info.mode.multi_file.total_length;
-        if (get_args().debug_mode) {
-            fprintf(stderr, "[PieceManager] Warning: Multi-file torrent. Treating as single concatenated file '%s'.\n", output_filename);
-        }
     }
 
     if (total_torrent_pieces == 0 || standard_piece_length == 0 ) {
         if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Error: Zero pieces or piece length in torrent.\n");
         return -1;
     }
-
-    all_managed_pieces = calloc(total_torrent_pieces, sizeof(ManagedPiece));
-    if (!all_managed_pieces) {
-        if (get_args().debug_mode) perror("[PieceManager] Error alloc managed_pieces");
+    if (!torrent->info.pieces) {
+        if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Error: Torrent piece hashes are NULL.\n");
         return -1;
     }
 
-    const unsigned char *torrent_piece_hashes_ptr = torrent->info.pieces;
-
-    for (uint32_t i = 0; i < total_torrent_pieces; ++i) {
-        all_managed_pieces[i].index = i;
-        all_managed_pieces[i].state = PIECE_STATE_MISSING;
-        all_managed_pieces[i].data_buffer = NULL;
-
-        // Calculate actual length of this piece (last piece can be shorter)
-        if (i == total_torrent_pieces - 1) {
-            all_managed_pieces[i].piece_length = total_torrent_file_length - (standard_piece_length * (total_torrent_pieces - 1));
-            if (total_torrent_file_length == 0 && total_torrent_pieces == 1) {
-                all_managed_pieces[i].piece_length = 0; 
-            }
-        } else {
-            all_managed_pieces[i].piece_length = standard_piece_length;
-        }
-        
-        if (torrent_piece_hashes_ptr) {
-            memcpy(all_managed_pieces[i].expected_hash, torrent_piece_hashes_ptr + (i * 20), 20);
-        } else {
-            if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Error: Torrent piece hashes are NULL.\n");
-            free(all_managed_pieces); all_managed_pieces = NULL;
-            return -1;
-        }
-
-        all_managed_pieces[i].num_total_blocks = calculate_num_blocks_for_piece(all_managed_pieces[i].piece_length);
-        if (all_managed_pieces[i].num_total_blocks > 0) {
-            all_managed_pieces[i].block_status_received = calloc(all_managed_pieces[i].num_total_blocks, sizeof(bool));
-            all_managed_pieces[i].block_requested = calloc(all_managed_pieces[i].num_total_blocks, sizeof(bool));
-            if (!all_managed_pieces[i].block_status_received) {
-                if (get_args().debug_mode) perror("[PieceManager] Error alloc block_status");
-                for(uint32_t j=0; j<i; ++j) free(all_managed_pieces[j].block_status_received);
-                free(all_managed_pieces); all_managed_pieces = NULL;
-                return -1;
-            }
-        } else {
-            all_managed_pieces[i].block_status_received = NULL;
-        }
-        all_managed_pieces[i].num_blocks_received = 0;
-        all_managed_pieces[i].peer_availability_count = 0;
-    }
+    // Last piece can be shorter
+    last_piece_length = total_torrent_file_length - (uint64_t)standard_piece_length * (total_torrent_pieces - 1);
+    if (total_torrent_file_length == 0) last_piece_length = 0;
+    blocks_per_piece = calculate_num_blocks_for_piece(standard_piece_length);
+    uint64_t total_blocks = first_block_of(total_torrent_pieces - 1) + calculate_num_blocks_for_piece(last_piece_length);
+    size_t block_words = (total_blocks + 63) / 64;
 
     client_bitfield_length_bytes = (total_torrent_pieces + 7) / 8;
-    if (client_bitfield_length_bytes > 0) {
-        client_bitfield = calloc(client_bitfield_length_bytes, sizeof(uint8_t));
-        if (!client_bitfield) {
-            if (get_args().debug_mode) perror("[PieceManager] Error alloc client_bitfield");
-            for(uint32_t i=0; i<total_torrent_pieces; ++i) free(all_managed_pieces[i].block_status_received);
-            free(all_managed_pieces); all_managed_pieces = NULL;
-            return -1;
-        }
-    } else {
-        client_bitfield = NULL;
-    }
-    
+    piece_states = calloc(total_torrent_pieces, sizeof(uint8_t));       // PIECE_STATE_MISSING is 0
+    expected_hashes = malloc((size_t)total_torrent_pieces * 20);
+    piece_availability = calloc(total_torrent_pieces, sizeof(uint16_t));
+    block_bits = calloc(block_words > 0 ? 2 * block_words : 1, sizeof(uint64_t));
+    client_bitfield = calloc(client_bitfield_length_bytes, sizeof(uint8_t));
     output_file_name_global = strdup(output_filename);
-    if (!output_file_name_global) {
-        if (get_args().debug_mode) perror("[PieceManager] Error strdup output_filename");
-        if (client_bitfield) {free(client_bitfield); client_bitfield = NULL;}
-        for(uint32_t i=0; i<total_torrent_pieces; ++i) free(all_managed_pieces[i].block_status_received);
-        free(all_managed_pieces); all_managed_pieces = NULL;
+    if (!piece_states || !expected_hashes || !piece_availability || !block_bits || !client_bitfield || !output_file_name_global) {
+        if (get_args().debug_mode) perror("[PieceManager] Error alloc piece state");
+        free(piece_states); piece_states = NULL;
+        free(expected_hashes); expected_hashes = NULL;
+        free(piece_availability); piece_availability = NULL;
+        free(block_bits); block_bits = NULL;
+        free(client_bitfield); client_bitfield = NULL;
+        free(output_file_name_global); output_file_name_global = NULL;
         return -1;
     }
-
-    // Open/create the output file// If the file already exists, open it for read/write without truncating.
-    // Otherwise create & truncate a brand‑new file.
-    if (access(output_file_name_global, F_OK) == 0) {
-        // resume/seeding mode
-        output_file_ptr = fopen(output_file_name_global, "r+b");
-        if (!output_file_ptr && get_args().debug_mode) {
-            fprintf(stderr, "[PieceManager] Error: could not open existing file '%s' for seeding: %s\n", output_file_name_global, strerror(errno));
-        }
-    } else {
-        // first‑time download
-        output_file_ptr = fopen(output_file_name_global, "wb+");
-        if (output_file_ptr && total_torrent_file_length > 0) {
-            // your existing pre‑allocation logic:
-            if (fseeko(output_file_ptr, total_torrent_file_length - 1, SEEK_SET) == 0) {
-                fwrite("\0", 1, 1, output_file_ptr);
-                fflush(output_file_ptr);
-                rewind(output_file_ptr);
-            }
-        }
-    }
-    if (!output_file_ptr) {
+    memcpy(expected_hashes, torrent->info.pieces, (size_t)total_torrent_pieces * 20);
+    blocks_received = block_bits;
+    blocks_requested = block_bits + block_words;
+
+    memcpy(torrent_info_hash, torrent->info_hash, 20);
+    size_t resume_name_len = strlen(output_filename) + sizeof(RESUME_FILE_SUFFIX);
+    resume_file_name_global = malloc(resume_name_len);
+    if (resume_file_name_global) snprintf(resume_file_name_global, resume_name_len, "%s%s", output_filename, RESUME_FILE_SUFFIX);
+
+    // Open the output file(s), keeping what an earlier run left, and grow them to full size
+    bool file_existed = false;
+    int num_specs = 0;
+    StorageFileSpec *specs = build_storage_specs(torrent, output_file_name_global, &num_specs);
+    output_file_open = specs && storage_open(specs, num_specs, get_args().storage_backend, get_args().sparse_file, &file_existed) == 0;
+    free_storage_specs(specs, num_specs);
+    if (!output_file_open) {
         if (get_args().debug_mode) {
             fprintf(stderr, "[PieceManager] CRITICAL: Could not open/create file '%s': %s.\n",
                 output_file_name_global, strerror(errno));
         }
-    } else {
-        if (total_torrent_file_length > 0) {
-            if (fseeko(output_file_ptr, total_torrent_file_length - 1, SEEK_SET) == 0) {
-                if (fwrite("\0", 1, 1, output_file_ptr) != 1) {
-                    if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Warn: Pre-alloc write failed for '%s'.\n", output_file_name_global);
-                }
-                fflush(output_file_ptr);
-                rewind(output_file_ptr);
-            } else if (errno != 0) {
-                if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Warn: Pre-alloc fseeko failed for '%s': %s\n", output_file_name_global, strerror(errno));
-            }
-        } else {
-            fflush(output_file_ptr);
-        }
+    } else if (get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Output '%s' opened with %s storage (%d files).\n",
+            output_file_name_global, storage_backend_name(storage_get_backend()), storage_num_files());
     }
-    
+
     pieces_we_have_count = 0;
     bytes_we_have_downloaded = 0;
+    pieces_verifying_count = 0;
+    newly_verified_count = 0;
+
+    // Huge pieces would tie up piece_length bytes each while in flight, so their blocks go straight to disk
+    write_through_mode = get_args().write_through || standard_piece_length >= WRITE_THROUGH_AUTO_PIECE_LENGTH;
+    if (write_through_mode && get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Write-through mode: blocks are written as they arrive (piece length %u).\n", standard_piece_length);
+    }
+    // Piece buffers come from slabs sized for the standard and the last piece, up to the --buffer-memory budget
+    if (buffer_pool_init(write_through_mode ? 0 : standard_piece_length, write_through_mode ? 0 : last_piece_length,
+                         (size_t)get_args().buffer_memory_mb * 1024 * 1024, get_args().huge_pages) != 0 && get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Warn: Buffer pool unavailable, piece buffers come from the heap.\n");
+    }
+
+    // Data left by an earlier run is trusted only after its hashes check out, unless the resume file
+    // vouches for it (written by this client after the last change to the output file)
+    if (file_existed && output_file_open && total_torrent_file_length > 0 && !load_resume_state()) {
+        recheck_existing_data();
+    }
+
+    // Completed pieces are hashed off the network thread; without the pool they are verified inline
+    if (hash_pool_init(0) != 0 && get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Warn: Hashing pool unavailable, verifying pieces inline.\n");
+    }
+    if (read_cache_init(total_torrent_pieces, (size_t)get_args().read_cache_mb * 1024 * 1024) != 0 && get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Warn: Read cache unavailable, uploads read blocks from disk.\n");
+    }
+    // Likewise verified pieces are written by the disk I/O thread, or inline with the stdio backend
+    if (output_file_open && disk_writer_init() != 0 && get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Warn: Disk writer not running, writing pieces inline.\n");
+    }
 
     if (get_args().debug_mode) {
         fprintf(stderr, "[PIECE_MANAGER] Initialized. Pieces: %u, File size: %lu, Output: %s\n",
@@ -177,136 +329,247 @@ int piece_manager_init(const Torrent *torrent, const char *output_filename) {
 }
 
 void piece_manager_destroy(void) {
-    if (all_managed_pieces) {
-        for (uint32_t i = 0; i < total_torrent_pieces; ++i) {
-            free(all_managed_pieces[i].data_buffer);
-            free(all_managed_pieces[i].block_status_received);
-        }
-        free(all_managed_pieces);
-        all_managed_pieces = NULL;
+    hash_pool_destroy();    // Workers may still be reading piece buffers
+    disk_writer_destroy();  // Writes out whatever is still queued before the buffers go away
+
+    if (get_args().debug_mode && read_cache_enabled()) {
+        ReadCacheStats cache_stats;
+        read_cache_get_stats(&cache_stats);
+        uint64_t lookups = cache_stats.hits + cache_stats.misses;
+        fprintf(stderr, "[PieceManager] Read cache: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, %zu/%zu bytes used.\n",
+            cache_stats.hits, cache_stats.misses, lookups > 0 ? cache_stats.hits * 100.0 / lookups : 0.0,
+            cache_stats.evictions, cache_stats.bytes_cached, cache_stats.capacity_bytes);
+    }
+    if (get_args().debug_mode && output_file_open) {
+        StorageFdCacheStats fd_stats;
+        storage_get_fd_cache_stats(&fd_stats);
+        fprintf(stderr, "[PieceManager] File handles: %lu hits, %lu opens, %lu evictions, %d/%d open.\n",
+            fd_stats.hits, fd_stats.misses, fd_stats.evictions, fd_stats.open_fds, fd_stats.capacity);
     }
+    read_cache_destroy();
+    if (get_args().debug_mode) {
+        BufferPoolStats pool_stats;
+        buffer_pool_get_stats(&pool_stats);
+        fprintf(stderr, "[PieceManager] Buffer pool: %lu slab allocations, %lu heap fallbacks, peak %zu/%zu piece bytes%s.\n",
+            pool_stats.slab_allocations, pool_stats.heap_fallbacks, pool_stats.peak_piece_bytes, pool_stats.budget_bytes,
+            pool_stats.huge_pages ? ", huge pages" : "");
+    }
+
+    for (uint32_t i = 0; i < in_flight_capacity; i++) {
+        if (!in_flight[i]) continue;
+        if (in_flight[i]->hash_ctx) sha1sum_destroy(in_flight[i]->hash_ctx);
+        buffer_pool_free(in_flight[i]->data_buffer, piece_length_of(in_flight[i]->index));
+        free(in_flight[i]);
+    }
+    free(in_flight);
+    in_flight = NULL;
+    in_flight_capacity = in_flight_count = 0;
+    free(piece_states);
+    piece_states = NULL;
+    free(expected_hashes);
+    expected_hashes = NULL;
+    free(piece_availability);
+    piece_availability = NULL;
+    free(block_bits);
+    block_bits = blocks_received = blocks_requested = NULL;
+    buffer_pool_destroy();
     free(client_bitfield);
     client_bitfield = NULL;
+    while (hash_ctx_cache_count > 0) {
+        sha1sum_destroy(hash_ctx_cache[--hash_ctx_cache_count]);
+    }
 
-    if (output_file_ptr) {
-        fclose(output_file_ptr);
-        output_file_ptr = NULL;
+    if (output_file_open) {
+        storage_close();
+        output_file_open = false;
     }
     free(output_file_name_global);
     output_file_name_global = NULL;
+    free(resume_file_name_global);
+    resume_file_name_global = NULL;
 
     // Reset counters
     total_torrent_pieces = 0;
     standard_piece_length = 0;
+    last_piece_length = 0;
+    blocks_per_piece = 0;
     total_torrent_file_length = 0;
     client_bitfield_length_bytes = 0;
     pieces_we_have_count = 0;
     bytes_we_have_downloaded = 0;
+    pieces_verifying_count = 0;
+    pieces_writing_count = 0;
+    write_through_mode = false;
+    newly_verified_count = 0;
     if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Destroyed.\n");
 }
 
 int piece_manager_record_block_received(uint32_t piece_index, uint32_t begin, const uint8_t *block_data, uint32_t block_length) {
-    if (piece_index >= total_torrent_pieces || !all_managed_pieces) {
+    if (piece_index >= total_torrent_pieces || !piece_states) {
         // Invalid piece index
         return -1;
     }
 
-    ManagedPiece *piece = &all_managed_pieces[piece_index];
+    uint32_t piece_length = piece_length_of(piece_index);
+    uint32_t num_blocks = num_blocks_of(piece_index);
 
-    if (piece->state == PIECE_STATE_HAVE) return 0; // Already have, ignore
-    if (block_length == 0 && piece->piece_length > 0) return 0; // Empty block for non-empty piece
-    if (begin + block_length > piece->piece_length) return -1; // Block out of bounds
+    if (piece_states[piece_index] == PIECE_STATE_HAVE) return 0; // Already have, ignore
+    if (piece_states[piece_index] == PIECE_STATE_VERIFYING) return 0; // Buffer is being hashed, late duplicate block
+    if (block_length == 0 && piece_length > 0) return 0; // Empty block for non-empty piece
+    if (begin + block_length > piece_length) return -1; // Block out of bounds
 
     uint32_t block_index_in_piece = (DEFAULT_BLOCK_LENGTH > 0) ? (begin / DEFAULT_BLOCK_LENGTH) : 0;
-    if (DEFAULT_BLOCK_LENGTH == 0 && begin != 0 && piece->piece_length > 0) return -1;
+    if (DEFAULT_BLOCK_LENGTH == 0 && begin != 0 && piece_length > 0) return -1;
+
+    if (block_index_in_piece >= num_blocks && num_blocks > 0) return -1; // Invalid block index
+    // Duplicate (endgame): the copy we have may already be hashed, so it must not be overwritten in the buffer or file
+    if (num_blocks > 0 && test_block(blocks_received, first_block_of(piece_index) + block_index_in_piece)) return 0;
 
-    if (block_index_in_piece >= piece->num_total_blocks && piece->num_total_blocks > 0) return -1; // Invalid block index
+    InFlightPiece *piece = get_in_flight(piece_index);
+    if (!piece) return -1;
 
     // Allocate piece data buffer if needed
-    if (!piece->data_buffer && piece->piece_length > 0) {
-        piece->data_buffer = malloc(piece->piece_length);
+    if (!piece->data_buffer && piece_length > 0 && !write_through_mode) {
+        piece->data_buffer = buffer_pool_alloc(piece_length);
         if (!piece->data_buffer) return -1; // Malloc failed
     }
-    
-    if(piece->state == PIECE_STATE_MISSING) piece->state = PIECE_STATE_PENDING;
 
-    // Copy block data
-    if (piece->piece_length > 0 && piece->data_buffer) {
+    if (piece_states[piece_index] == PIECE_STATE_MISSING) piece_states[piece_index] = PIECE_STATE_PENDING;
+
+    // Copy block data, or in write-through mode put it in its final place (a page cache copy, like the memcpy)
+    if (piece_length > 0 && piece->data_buffer) {
         memcpy(piece->data_buffer + begin, block_data, block_length);
+    } else if (piece_length > 0 && write_through_mode) {
+        if (!output_file_open || storage_write((uint64_t)piece_index * standard_piece_length + begin, block_data, block_length) != 0) return -1;
     }
+    return finish_received_block(piece, block_index_in_piece, block_data);
+}
+
+bool piece_manager_splice_target(uint32_t piece_index, uint32_t begin, uint32_t block_length, uint64_t *file_offset_out) {
+    if (!write_through_mode || !output_file_open || storage_get_backend() == STORAGE_BACKEND_STDIO) return false;
+    if (piece_index >= total_torrent_pieces || !piece_states || !file_offset_out) return false;
+    if (piece_states[piece_index] != PIECE_STATE_PENDING && piece_states[piece_index] != PIECE_STATE_MISSING) return false;
+    uint32_t num_blocks = num_blocks_of(piece_index);
+    if (begin % DEFAULT_BLOCK_LENGTH != 0 || begin / DEFAULT_BLOCK_LENGTH >= num_blocks) return false;
+
+    uint32_t block_index = begin / DEFAULT_BLOCK_LENGTH;
+    if (block_length != calculate_block_length(piece_length_of(piece_index), block_index, num_blocks)) return false;
+    if (test_block(blocks_received, first_block_of(piece_index) + block_index)) return false;    // Duplicate, let the normal path drop it
+    *file_offset_out = (uint64_t)piece_index * standard_piece_length + begin;
+    return true;
+}
+
+int piece_manager_record_block_on_disk(uint32_t piece_index, uint32_t begin, uint32_t block_length) {
+    uint64_t file_offset;
+    if (!piece_manager_splice_target(piece_index, begin, block_length, &file_offset)) return -1;
+    InFlightPiece *piece = get_in_flight(piece_index);
+    if (!piece) return -1;
+    if (piece_states[piece_index] == PIECE_STATE_MISSING) piece_states[piece_index] = PIECE_STATE_PENDING;
+    return finish_received_block(piece, begin / DEFAULT_BLOCK_LENGTH, NULL);
+}
+
+// Mark a block received once its bytes are in place, then keep hashing, or verify the piece if it is now complete.
+// block_data is the block if the caller still has it in memory, NULL if it only went to disk.
+static int finish_received_block(InFlightPiece *piece, uint32_t block_index_in_piece, const uint8_t *block_data) {
+    uint32_t piece_index = piece->index;
+    uint32_t piece_length = piece_length_of(piece_index);
 
     // Update block received status
-    if (piece->num_total_blocks > 0 && !piece->block_status_received[block_index_in_piece]) {
-        piece->block_status_received[block_index_in_piece] = true;
+    if (num_blocks_of(piece_index) > 0 && !test_block(blocks_received, first_block_of(piece_index) + block_index_in_piece)) {
+        set_block(blocks_received, first_block_of(piece_index) + block_index_in_piece);
         piece->num_blocks_received++;
-    } else if (piece->num_total_blocks == 0 && piece->piece_length == 0 && piece->num_blocks_received == 0) {
+    } else if (piece_length == 0 && piece->num_blocks_received == 0) {
         piece->num_blocks_received = 1; // Mark 0-byte piece as "complete"
     }
 
-    // If piece is now complete, verify it
-    if (piece_manager_is_piece_payload_complete(piece_index)) {
-        if (!piece_manager_verify_and_write_piece(piece_index)) {
-            // Verification failed, reset piece for re-download
-            piece->state = PIECE_STATE_MISSING;
-            piece->num_blocks_received = 0;
-            if (piece->num_total_blocks > 0 && piece->block_status_received) {
-                memset(piece->block_status_received, 0, piece->num_total_blocks * sizeof(bool));
-            }
-            return -1; // Indicate failure
+    if (!piece_manager_is_piece_payload_complete(piece_index)) {
+        // Hash whatever is now contiguous while it's still in cache
+        advance_piece_hash(piece, block_index_in_piece, block_data);
+        return 0;
+    }
+    if (write_through_mode) advance_piece_hash(piece, block_index_in_piece, block_data);    // The block in hand saves a read-back
+
+    // Piece is complete. Usually the running hash covers all but the last block or so, which is cheap to finish here.
+    // A long out-of-order tail goes to the hashing pool so the SHA-1 and file write don't stall the network thread.
+    if (!piece->hash_ctx) piece->hash_ctx = acquire_hash_ctx();
+    uint32_t hashed_bytes = piece->hash_ctx ? piece->num_blocks_hashed * DEFAULT_BLOCK_LENGTH : 0;
+    if (hashed_bytes > piece_length) hashed_bytes = piece_length;
+
+    // Write-through tails are streamed back from disk by the worker, which needs a running hash to continue and a
+    // backend that can be read from another thread
+    bool can_offload = piece->data_buffer || (piece->hash_ctx && storage_get_backend() != STORAGE_BACKEND_STDIO);
+    if (piece_length - hashed_bytes > INLINE_HASH_MAX_BYTES && can_offload) {
+        HashJob job = {
+            .piece_index = piece_index,
+            .ctx = piece->hash_ctx,
+            .data = piece->data_buffer ? piece->data_buffer + hashed_bytes : NULL,
+            .length = piece_length - hashed_bytes,
+            .read_payload = piece->data_buffer ? NULL : storage_read,
+            .payload_offset = (uint64_t)piece_index * standard_piece_length + hashed_bytes,
+            .verified = false
+        };
+        memcpy(job.expected_hash, expected_hashes[piece_index], 20);
+        piece_states[piece_index] = PIECE_STATE_VERIFYING;
+        if (hash_pool_submit(&job) == 0) {
+            pieces_verifying_count++;
+            return 0;
         }
+        piece_states[piece_index] = PIECE_STATE_PENDING;     // Pool not running or full, verify inline
+    }
 
-        piece->block_status_received[block_index_in_piece] = true;
-        piece->block_requested[block_index_in_piece] = false;
+    if (!piece_manager_verify_and_write_piece(piece_index)) {
+        // Verification failed, reset piece for re-download
+        reset_piece_for_redownload(piece_index);
+        return -1; // Indicate failure
     }
     return 0;
 }
 
 bool piece_manager_is_piece_payload_complete(uint32_t piece_index) {
-    if (piece_index >= total_torrent_pieces || !all_managed_pieces) return false;
-    ManagedPiece *piece = &all_managed_pieces[piece_index];
-    if (piece->piece_length == 0) return piece->num_blocks_received > 0 || piece->num_total_blocks == 0;
-    return piece->num_blocks_received == piece->num_total_blocks;
+    if (piece_index >= total_torrent_pieces || !piece_states) return false;
+    if (piece_states[piece_index] == PIECE_STATE_HAVE || piece_length_of(piece_index) == 0) return true;
+    InFlightPiece *piece = find_in_flight(piece_index);
+    return piece && piece->num_blocks_received == num_blocks_of(piece_index);
 }
 
 bool piece_manager_verify_and_write_piece(uint32_t piece_index) {
-    if (piece_index >= total_torrent_pieces || !all_managed_pieces) return false;
-    ManagedPiece *piece = &all_managed_pieces[piece_index];
-
-    if (piece->state == PIECE_STATE_HAVE) return true; // Already verified
-    if (piece->state != PIECE_STATE_PENDING || !piece_manager_is_piece_payload_complete(piece_index)) return false; // Not ready
-    if (!piece->data_buffer && piece->piece_length > 0) return false; // No data to verify
+    if (piece_index >= total_torrent_pieces || !piece_states) return false;
+
+    if (piece_states[piece_index] == PIECE_STATE_HAVE) return true; // Already verified
+    if (piece_states[piece_index] != PIECE_STATE_PENDING || !piece_manager_is_piece_payload_complete(piece_index)) return false; // Not ready
+    uint32_t piece_length = piece_length_of(piece_index);
+    InFlightPiece *piece = get_in_flight(piece_index);
+    if (!piece) return false;
+    if (!piece->data_buffer && piece_length > 0 && !write_through_mode) return false; // No data to verify
+
+    // Finish the running hash over the blocks it hasn't seen yet, or hash the whole piece if there is none
+    uint32_t hashed_bytes = 0;
+    if (!piece->hash_ctx) {
+        piece->hash_ctx = acquire_hash_ctx();
+        if (!piece->hash_ctx) return false; // Hash context creation failed
+        piece->num_blocks_hashed = 0;
+    } else {
+        hashed_bytes = piece->num_blocks_hashed * DEFAULT_BLOCK_LENGTH;
+        if (hashed_bytes > piece_length) hashed_bytes = piece_length;
+    }
 
     uint8_t calculated_hash[20];
-    struct sha1sum_ctx *ctx = sha1sum_create(NULL, 0);
-    if (!ctx) return false; // Hash context creation failed
-
-    const uint8_t* data_for_hash = piece->piece_length > 0 ? piece->data_buffer : NULL;
-    if (sha1sum_finish(ctx, data_for_hash, piece->piece_length, calculated_hash) != 0) {
-        sha1sum_destroy(ctx);
-        return false; // Hash calculation failed
+    int hash_status;
+    if (piece->data_buffer || piece_length == 0) {
+        const uint8_t* data_for_hash = piece_length > 0 ? piece->data_buffer + hashed_bytes : NULL;
+        hash_status = sha1sum_finish(piece->hash_ctx, data_for_hash, piece_length - hashed_bytes, calculated_hash);
+    } else {
+        // Write-through: the rest of the piece is only on disk
+        hash_status = hash_from_storage(piece->hash_ctx, (uint64_t)piece_index * standard_piece_length + hashed_bytes,
+                                        piece_length - hashed_bytes);
+        if (hash_status == 0) hash_status = sha1sum_finish(piece->hash_ctx, NULL, 0, calculated_hash);
     }
-    sha1sum_destroy(ctx);
+    release_hash_ctx(piece);
+    if (hash_status != 0) return false; // Hash calculation failed
 
-    if (memcmp(calculated_hash, piece->expected_hash, 20) == 0) {
+    if (memcmp(calculated_hash, expected_hashes[piece_index], 20) == 0) {
         // Hash matches
-        if (piece->piece_length > 0) {
-            if (!write_piece_data_to_file(piece_index, piece->data_buffer, piece->piece_length)) {
-                return false; // File write failed
-            }
-        }
-
-        piece->state = PIECE_STATE_HAVE;
-        if(client_bitfield) set_bit_in_bitfield(client_bitfield, piece_index);
-        pieces_we_have_count++;
-        bytes_we_have_downloaded += piece->piece_length;
-
-        free(piece->data_buffer); // Free memory after successful write
-        piece->data_buffer = NULL;
-        
-        if (get_args().debug_mode && piece_manager_is_download_complete()) {
-             fprintf(stderr, "[PieceManager] ****** DOWNLOAD COMPLETE! ******\n");
-        }
-        return true;
+        return commit_verified_piece(piece);
     } else {
         // Hash mismatch
         if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Piece %u VERIFICATION FAILED.\n", piece_index);
@@ -314,13 +577,56 @@ bool piece_manager_verify_and_write_piece(uint32_t piece_index) {
     }
 }
 
+int piece_manager_process_verified_pieces(uint32_t *verified_out, int max_verified) {
+    if (!piece_states) return 0;
+
+    process_completed_writes();
+
+    HashJob job;
+    while (hash_pool_poll_result(&job)) {
+        pieces_verifying_count--;
+        if (job.piece_index >= total_torrent_pieces) continue;
+        if (piece_states[job.piece_index] != PIECE_STATE_VERIFYING) continue;
+        InFlightPiece *piece = find_in_flight(job.piece_index);
+        if (!piece) continue;
+        release_hash_ctx(piece);
+
+        if (job.verified && commit_verified_piece(piece)) continue;
+
+        if (!job.verified && get_args().debug_mode) fprintf(stderr, "[PieceManager] Piece %u VERIFICATION FAILED.\n", job.piece_index);
+        reset_piece_for_redownload(job.piece_index);
+    }
+
+    // Hand back pieces that became HAVE (whether verified here or inline) so they can be announced
+    int count = 0;
+    while (count < max_verified && count < newly_verified_count) {
+        verified_out[count] = newly_verified[count];
+        count++;
+    }
+    memmove(newly_verified, newly_verified + count, (newly_verified_count - count) * sizeof(uint32_t));
+    newly_verified_count -= count;
+    return count;
+}
+
+int piece_manager_get_pieces_writing_count(void) {
+    return pieces_writing_count;
+}
+
+bool piece_manager_write_backlog_full(void) {
+    return disk_writer_over_budget();
+}
+
+int piece_manager_get_pieces_verifying_count(void) {
+    return pieces_verifying_count;
+}
+
 bool piece_manager_select_piece_for_peer(const uint8_t *peer_bitfield, size_t peer_bitfield_len_bytes, uint32_t *selected_piece_index) {
-    if (!peer_bitfield || !selected_piece_index || !all_managed_pieces) return false;
+    if (!peer_bitfield || !selected_piece_index || !piece_states) return false;
 
     size_t peer_total_pieces = peer_bitfield_len_bytes * 8;
     // Simple sequential scan for a piece the peer has and we need
     for (uint32_t i = 0; i < total_torrent_pieces; ++i) {
-        if (all_managed_pieces[i].state == PIECE_STATE_MISSING) {
+        if (piece_states[i] == PIECE_STATE_MISSING) {
             if (get_bit_from_bitfield(peer_bitfield, i, peer_total_pieces)) {
                 *selected_piece_index = i;
                 return true;
@@ -331,32 +637,44 @@ bool piece_manager_select_piece_for_peer(const uint8_t *peer_bitfield, size_t pe
 }
 
 bool piece_manager_get_block_to_request_from_piece(uint32_t piece_idx, uint32_t *begin_out, uint32_t *length_out) {
-    if (piece_idx >= total_torrent_pieces || !all_managed_pieces || !begin_out || !length_out) return false;
-
-    ManagedPiece *piece = &all_managed_pieces[piece_idx];
-
-    // Transition from MISSING to PENDING
-    if (piece->state == PIECE_STATE_MISSING) {
-        if (!piece->data_buffer && piece->piece_length > 0) {
-             piece->data_buffer = malloc(piece->piece_length);
-             if (!piece->data_buffer) return false; // Malloc failed
+    if (piece_idx >= total_torrent_pieces || !piece_states || !begin_out || !length_out) return false;
+
+    uint32_t piece_length = piece_length_of(piece_idx);
+    uint32_t num_blocks = num_blocks_of(piece_idx);
+
+    // Transition from MISSING to PENDING, unless the pieces in flight already use up the buffer budget
+    if (piece_states[piece_idx] == PIECE_STATE_MISSING) {
+        bool needs_buffer = piece_length > 0 && !write_through_mode;
+        if (needs_buffer && buffer_pool_over_budget(piece_length)) return false;
+        InFlightPiece *piece = get_in_flight(piece_idx);
+        if (!piece) return false;
+        if (needs_buffer && !piece->data_buffer) {
+             piece->data_buffer = buffer_pool_alloc(piece_length);
+             if (!piece->data_buffer) { // Malloc failed
+                 drop_in_flight(piece);
+                 return false;
+             }
         }
-        piece->state = PIECE_STATE_PENDING;
+        piece_states[piece_idx] = PIECE_STATE_PENDING;
     }
 
-    if (piece->state != PIECE_STATE_PENDING) return false; // Not in a state to request blocks
-    if (piece->piece_length == 0 && piece->num_total_blocks == 0) return false; // 0-byte piece
+    if (piece_states[piece_idx] != PIECE_STATE_PENDING) return false; // Not in a state to request blocks
+    if (num_blocks == 0) return false; // 0-byte piece
 
-    // Find first unreceived block
-    for (uint32_t block_i = 0; block_i < piece->num_total_blocks; ++block_i) {
-        if (!piece->block_status_received[block_i] && !piece->block_requested[block_i]) {
-            *begin_out  = block_i * DEFAULT_BLOCK_LENGTH;
-            *length_out = calculate_block_length(piece->piece_length, block_i, piece->num_total_blocks);
-            piece->block_requested[block_i] = true;
-            return true;
-        }
-    }
-    return false; // All blocks for this PENDING piece are already marked received (should be HAVE soon)
+    // Find first block neither received nor requested, a word of blocks at a time
+    uint32_t block_i = first_unrequested_block(first_block_of(piece_idx), num_blocks);
+    if (block_i == num_blocks) return false; // All blocks for this PENDING piece are requested or received
+    *begin_out  = block_i * DEFAULT_BLOCK_LENGTH;
+    *length_out = calculate_block_length(piece_length, block_i, num_blocks);
+    set_block(blocks_requested, first_block_of(piece_idx) + block_i);
+    return true;
+}
+
+void piece_manager_release_block_request(uint32_t piece_index, uint32_t begin) {
+    if (piece_index >= total_torrent_pieces || !piece_states || DEFAULT_BLOCK_LENGTH == 0) return;
+    uint32_t block_index = begin / DEFAULT_BLOCK_LENGTH;
+    if (block_index >= num_blocks_of(piece_index)) return;
+    fill_blocks(blocks_requested, first_block_of(piece_index) + block_index, 1, false);
 }
 
 void piece_manager_get_our_bitfield(const uint8_t **bitfield_out, size_t *length_out) {
@@ -365,27 +683,32 @@ void piece_manager_get_our_bitfield(const uint8_t **bitfield_out, size_t *length
 }
 
 void piece_manager_update_peer_availability(uint32_t piece_index, bool peer_has_it) {
-    if (piece_index >= total_torrent_pieces || !all_managed_pieces) return;
+    if (piece_index >= total_torrent_pieces || !piece_availability) return;
     // Used for rarest-first strategy
     if (peer_has_it) {
-        all_managed_pieces[piece_index].peer_availability_count++;
+        if (piece_availability[piece_index] < UINT16_MAX) piece_availability[piece_index]++;
     } else {
-        if (all_managed_pieces[piece_index].peer_availability_count > 0) {
-            all_managed_pieces[piece_index].peer_availability_count--;
+        if (piece_availability[piece_index] > 0) {
+            piece_availability[piece_index]--;
         }
     }
 }
 
 bool piece_manager_is_download_complete(void) {
-    if (!all_managed_pieces || total_torrent_pieces == 0) {
+    if (!piece_states || total_torrent_pieces == 0) {
         return total_torrent_file_length == 0; // Empty file is complete
     }
     return pieces_we_have_count == total_torrent_pieces;
 }
 
 PieceState piece_manager_get_piece_state(uint32_t piece_index) {
-    if (piece_index >= total_torrent_pieces || !all_managed_pieces) return PIECE_STATE_MISSING;
-    return all_managed_pieces[piece_index].state;
+    if (piece_index >= total_torrent_pieces || !piece_states) return PIECE_STATE_MISSING;
+    return (PieceState)piece_states[piece_index];
+}
+
+uint32_t piece_manager_get_piece_length(uint32_t piece_index) {
+    if (piece_index >= total_torrent_pieces || !piece_states) return 0;
+    return piece_length_of(piece_index);
 }
 
 uint32_t piece_manager_get_total_pieces_count(void) {
@@ -402,37 +725,60 @@ uint64_t piece_manager_get_bytes_left_total(void) {
 }
 
 bool piece_manager_has_block(uint32_t piece_index, uint32_t block_offset) {
-    if (piece_index >= total_torrent_pieces || !all_managed_pieces) return false;
-    ManagedPiece *piece = &all_managed_pieces[piece_index];
-    if (block_offset >= piece->piece_length) return false; 
-    if (DEFAULT_BLOCK_LENGTH == 0) return piece->num_total_blocks > 0 && piece->block_status_received[0];
+    if (piece_index >= total_torrent_pieces || !piece_states) return false;
+    if (block_offset >= piece_length_of(piece_index)) return false;
+    if (DEFAULT_BLOCK_LENGTH == 0) return num_blocks_of(piece_index) > 0 && test_block(blocks_received, first_block_of(piece_index));
 
     uint32_t block_index_in_piece = block_offset / DEFAULT_BLOCK_LENGTH;
-    if (block_index_in_piece >= piece->num_total_blocks) return false;
-    return piece->block_status_received[block_index_in_piece];
+    if (block_index_in_piece >= num_blocks_of(piece_index)) return false;
+    return test_block(blocks_received, first_block_of(piece_index) + block_index_in_piece);
 }
 
 bool piece_manager_read_block(uint32_t piece_index, uint32_t begin, uint32_t block_length, uint8_t *block) {
-    ManagedPiece *piece = &all_managed_pieces[piece_index];
+    if (piece_index >= total_torrent_pieces || !piece_states) return false;
+    uint32_t piece_length = piece_length_of(piece_index);
 
-    if (block_length == 0 && piece->piece_length > 0) return true; // Empty block for non-empty piece
-    if (begin + block_length > piece->piece_length) return false; // Block out of bounds
+    if (block_length == 0 && piece_length > 0) return true; // Empty block for non-empty piece
+    if (begin + block_length > piece_length || begin + block_length < begin) return false; // Block out of bounds
 
     uint32_t block_index_in_piece = (DEFAULT_BLOCK_LENGTH > 0) ? (begin / DEFAULT_BLOCK_LENGTH) : 0;
-    if (block_index_in_piece >= piece->num_total_blocks && piece->num_total_blocks > 0) return false; // Invalid block index
-
-    // calculate file offset to where block is
-    uint64_t file_offset = (uint64_t)piece_index * standard_piece_length + begin;
-    if (fseek(output_file_ptr, file_offset, SEEK_SET) < 0) {
-        return false;
+    if (block_index_in_piece >= num_blocks_of(piece_index) && num_blocks_of(piece_index) > 0) return false; // Invalid block index
+
+    // A verified piece still queued on the disk writer is only complete in its buffer: the file (and so the read
+    // cache below) mustn't be read for it until process_completed_writes has seen the write land
+    InFlightPiece *piece = piece_states[piece_index] == PIECE_STATE_HAVE ? find_in_flight(piece_index) : NULL;
+    if (piece) {
+        if (!piece->data_buffer) return false;
+        memcpy(block, piece->data_buffer + begin, block_length);
+        return true;
     }
 
-    // read block data from file into buffer 
-    if (fread(block, 1, block_length, output_file_ptr) != block_length) {
-        return false;
+    uint64_t piece_offset = (uint64_t)piece_index * standard_piece_length;
+
+    // Peers ask for a piece's blocks one after another, so read the whole piece on the first request and serve the
+    // rest from memory. Not worth it with mmap, where every read is already a copy out of the page cache.
+    if (piece_states[piece_index] == PIECE_STATE_HAVE && read_cache_enabled() && storage_get_backend() != STORAGE_BACKEND_MMAP) {
+        const uint8_t *cached = read_cache_get(piece_index);
+        if (!cached) {
+            uint8_t *piece_data = storage_alloc_buffer(piece_length);
+            if (piece_data && storage_read(piece_offset, piece_data, piece_length) == 0) {
+                cached = read_cache_insert(piece_index, piece_data, piece_length);
+                // Have the kernel start reading the next piece, the likely next request
+                if (piece_index + 1 < total_torrent_pieces) {
+                    storage_advise(piece_offset + piece_length, piece_length_of(piece_index + 1), STORAGE_ACCESS_WILLNEED);
+                }
+            } else {
+                free(piece_data);
+            }
+        }
+        if (cached) {
+            memcpy(block, cached + begin, block_length);
+            return true;
+        }
     }
-    
-    return true;
+
+    // calculate file offset to where block is
+    return storage_read(piece_offset + begin, block, block_length) == 0;
 }
 
 // --- Helper Function Implementations ---
@@ -468,23 +814,657 @@ static bool get_bit_from_bitfield(const uint8_t *bitfield_array, uint32_t piece_
 }
 
 static bool write_piece_data_to_file(uint32_t piece_idx_to_write, const uint8_t *data_to_write, uint32_t data_length) {
-    if (!output_file_ptr) return false; // File not open
+    if (!output_file_open) return false; // File not open
     if (!data_to_write || data_length == 0) return true; // Nothing to write for 0-length piece
 
     uint64_t file_offset = (uint64_t)piece_idx_to_write * standard_piece_length;
+    return storage_write(file_offset, data_to_write, data_length) == 0;
+}
+
+// Queue a piece now safely ours to be announced to peers with HAVE
+static void queue_have_announce(uint32_t piece_index) {
+    if (newly_verified_count < HASH_POOL_QUEUE_SIZE) {
+        newly_verified[newly_verified_count++] = piece_index;
+    } else if (get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Warn: HAVE backlog full, piece %u will not be announced.\n", piece_index);
+    }
+}
+
+// Write a verified piece to file and mark it HAVE
+static bool commit_verified_piece(InFlightPiece *piece) {
+    uint32_t piece_index = piece->index;
+    uint32_t piece_length = piece_length_of(piece_index);
+
+    // Hand the write to the disk I/O thread if it's running; the buffer then stays with the piece (and serves
+    // uploads) until process_completed_writes sees the write finish
+    // In write-through mode the blocks are on disk already
+    bool write_queued = piece_length > 0 && piece->data_buffer &&
+        disk_writer_submit(piece_index, (uint64_t)piece_index * standard_piece_length, piece->data_buffer, piece_length) == 0;
+    if (piece_length > 0 && piece->data_buffer && !write_queued) {
+        if (!write_piece_data_to_file(piece_index, piece->data_buffer, piece_length)) {
+            return false; // File write failed
+        }
+    }
+
+    piece_states[piece_index] = PIECE_STATE_HAVE;
+    if(client_bitfield) set_bit_in_bitfield(client_bitfield, piece_index);
+    pieces_we_have_count++;
+    bytes_we_have_downloaded += piece_length;
+
+    // A queued piece is announced once process_completed_writes sees it on disk, so peers are never told HAVE
+    // for a piece whose write then fails
+    if (write_queued) {
+        pieces_writing_count++;
+    } else {
+        drop_in_flight(piece); // Free memory after successful write
+        queue_have_announce(piece_index);
+    }
 
-    if (fseeko(output_file_ptr, file_offset, SEEK_SET) != 0) return false; // Seek failed
-    if (fwrite(data_to_write, 1, data_length, output_file_ptr) != data_length) return false; // Write failed
-    
-    fflush(output_file_ptr); // Ensure data is on disk
+    if (get_args().debug_mode && piece_manager_is_download_complete()) {
+         fprintf(stderr, "[PieceManager] ****** DOWNLOAD COMPLETE! ******\n");
+    }
     return true;
 }
 
+// Release the buffers of pieces the disk writer has finished with. A piece whose write failed is not on disk
+// after all, so it goes back to MISSING to be downloaded again.
+static void process_completed_writes(void) {
+    DiskWriteResult results[64];
+    int num_results;
+    while ((num_results = disk_writer_poll_completed(results, 64)) > 0) {
+        for (int r = 0; r < num_results; r++) {
+            uint32_t piece_index = results[r].piece_index;
+            if (piece_index >= total_torrent_pieces) continue;
+            pieces_writing_count--;
+            InFlightPiece *piece = find_in_flight(piece_index);
+            if (piece) drop_in_flight(piece);
+            if (piece_states[piece_index] != PIECE_STATE_HAVE) continue;
+            if (results[r].ok) {
+                queue_have_announce(piece_index);
+                continue;
+            }
+
+            if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Piece %u could not be written, downloading it again.\n", piece_index);
+            if (client_bitfield) client_bitfield[piece_index / 8] &= ~(1 << (7 - piece_index % 8));
+            pieces_we_have_count--;
+            bytes_we_have_downloaded -= piece_length_of(piece_index);
+            read_cache_invalidate(piece_index);
+            reset_piece_for_redownload(piece_index);
+        }
+    }
+}
+
+// Forget every block of a piece that failed verification so it gets requested again
+static void reset_piece_for_redownload(uint32_t piece_index) {
+    InFlightPiece *piece = find_in_flight(piece_index);
+    if (piece) drop_in_flight(piece);
+    piece_states[piece_index] = PIECE_STATE_MISSING;
+    fill_blocks(blocks_received, first_block_of(piece_index), num_blocks_of(piece_index), false);
+    fill_blocks(blocks_requested, first_block_of(piece_index), num_blocks_of(piece_index), false);
+}
+
+// Take a reset SHA-1 context from the cache, or create one
+static struct sha1sum_ctx *acquire_hash_ctx(void) {
+    if (hash_ctx_cache_count > 0) return hash_ctx_cache[--hash_ctx_cache_count];
+    return sha1sum_create(NULL, 0);
+}
+
+// Detach the piece's running hash and return its context to the cache
+static void release_hash_ctx(InFlightPiece *piece) {
+    if (!piece->hash_ctx) return;
+    if (hash_ctx_cache_count < HASH_CTX_CACHE_SIZE && sha1sum_reset(piece->hash_ctx) == 0) {
+        hash_ctx_cache[hash_ctx_cache_count++] = piece->hash_ctx;
+    } else {
+        sha1sum_destroy(piece->hash_ctx);
+    }
+    piece->hash_ctx = NULL;
+    piece->num_blocks_hashed = 0;
+}
+
+// Feed the running hash every received block that now follows the hashed prefix without a gap. In write-through
+// mode there is no buffer: the block just received is hashed from the network buffer, and blocks that arrived
+// early are read back from disk (still in the page cache), at most WRITE_THROUGH_CATCHUP_BLOCKS per call so a
+// piece that arrived back to front can't stall the event loop.
+static void advance_piece_hash(InFlightPiece *piece, uint32_t new_block_index, const uint8_t *new_block_data) {
+    uint32_t num_blocks = num_blocks_of(piece->index);
+    if ((!piece->data_buffer && !write_through_mode) || num_blocks == 0) return;
+    if (!piece->hash_ctx) {
+        piece->hash_ctx = acquire_hash_ctx();
+        if (!piece->hash_ctx) return;   // Hashed in full at completion instead
+        piece->num_blocks_hashed = 0;
+    }
+
+    static uint8_t read_back[DEFAULT_BLOCK_LENGTH];
+    uint32_t read_back_budget = WRITE_THROUGH_CATCHUP_BLOCKS;
+    uint64_t first_block = first_block_of(piece->index);
+    while (piece->num_blocks_hashed < num_blocks && test_block(blocks_received, first_block + piece->num_blocks_hashed)) {
+        uint32_t block_i = piece->num_blocks_hashed;
+        uint32_t block_len = calculate_block_length(piece_length_of(piece->index), block_i, num_blocks);
+        const uint8_t *block = NULL;
+        if (piece->data_buffer) {
+            block = piece->data_buffer + (size_t)block_i * DEFAULT_BLOCK_LENGTH;
+        } else if (block_i == new_block_index && new_block_data) {
+            block = new_block_data;
+        } else {
+            uint64_t block_offset = (uint64_t)piece->index * standard_piece_length + (uint64_t)block_i * DEFAULT_BLOCK_LENGTH;
+            if (read_back_budget == 0) return;
+            read_back_budget--;
+            if (storage_read(block_offset, read_back, block_len) != 0) return;     // Picked up again at completion
+            block = read_back;
+        }
+        if (sha1sum_update(piece->hash_ctx, block, block_len) != 0) {
+            release_hash_ctx(piece);    // Start over from scratch at completion
+            return;
+        }
+        piece->num_blocks_hashed++;
+    }
+}
+
+// Add a range of the output file to a running hash, reading it back in chunks
+static int hash_from_storage(struct sha1sum_ctx *ctx, uint64_t offset, uint64_t length) {
+    static uint8_t chunk[16 * DEFAULT_BLOCK_LENGTH];
+    for (uint64_t done = 0; done < length; done += sizeof(chunk)) {
+        size_t chunk_len = length - done < sizeof(chunk) ? (size_t)(length - done) : sizeof(chunk);
+        if (storage_read(offset + done, chunk, chunk_len) != 0 || sha1sum_update(ctx, chunk, chunk_len) != 0) return -1;
+    }
+    return 0;
+}
+
 int piece_manager_get_bytes_downloaded() {
     return bytes_we_have_downloaded;
 }
 
-ManagedPiece *piece_manager_get_all_managed_pieces() {
-    return all_managed_pieces;
+
+// Paths in a torrent come from whoever made it: refuse absolute paths and "." or ".." components, which could
+// escape the download directory
+static bool is_safe_relative_path(const char *path) {
+    if (!path || path[0] == '\0' || path[0] == '/') return false;
+    const char *component = path;
+    while (1) {
+        const char *end = strchr(component, '/');
+        size_t len = end ? (size_t)(end - component) : strlen(component);
+        if (len == 0 || (len == 1 && component[0] == '.') || (len == 2 && component[0] == '.' && component[1] == '.')) return false;
+        if (!end) return true;
+        component = end + 1;
+    }
+}
+
+// List the storage module's files: the output file itself, or for a multi-file torrent "<output>/<path>" for each
+// file in torrent order. Returns NULL if a path is unsafe or the lengths don't add up.
+static StorageFileSpec *build_storage_specs(const Torrent *torrent, const char *output_filename, int *num_specs_out) {
+    *num_specs_out = 0;
+    if (torrent->info.mode_type == MODE_SINGLE_FILE) {
+        StorageFileSpec *spec = calloc(1, sizeof(StorageFileSpec));
+        if (!spec) return NULL;
+        spec->path = strdup(output_filename);
+        spec->length = total_torrent_file_length;
+        *num_specs_out = 1;
+        if (!spec->path) {
+            free_storage_specs(spec, 1);
+            return NULL;
+        }
+        return spec;
+    }
+
+    const MultiFileInfo *multi = &torrent->info.mode.multi_file;
+    if (multi->files_count <= 0 || !is_safe_relative_path(output_filename)) return NULL;
+    StorageFileSpec *specs = calloc(multi->files_count, sizeof(StorageFileSpec));
+    if (!specs) return NULL;
+    *num_specs_out = multi->files_count;
+
+    uint64_t sum = 0;
+    for (int i = 0; i < multi->files_count; i++) {
+        const TorrentFile *file = &multi->files[i];
+        if (!is_safe_relative_path(file->path) || file->length < 0) {
+            if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Error: Refusing file path '%s' in torrent.\n", file->path ? file->path : "(null)");
+            free_storage_specs(specs, multi->files_count);
+            return NULL;
+        }
+        size_t path_len = strlen(output_filename) + 1 + strlen(file->path) + 1;
+        char *path = malloc(path_len);
+        if (!path) {
+            free_storage_specs(specs, multi->files_count);
+            return NULL;
+        }
+        snprintf(path, path_len, "%s/%s", output_filename, file->path);
+        specs[i].path = path;
+        specs[i].length = (uint64_t)file->length;
+        sum += (uint64_t)file->length;
+    }
+    if (sum != total_torrent_file_length) {
+        free_storage_specs(specs, multi->files_count);
+        return NULL;
+    }
+    return specs;
+}
+
+static void free_storage_specs(StorageFileSpec *specs, int num_specs) {
+    if (!specs) return;
+    for (int i = 0; i < num_specs; i++) {
+        free((char *)specs[i].path);
+    }
+    free(specs);
+}
+
+// Mark a piece whose data is already in the output file as HAVE
+static void mark_piece_have_on_disk(uint32_t piece_index) {
+    piece_states[piece_index] = PIECE_STATE_HAVE;
+    fill_blocks(blocks_received, first_block_of(piece_index), num_blocks_of(piece_index), true);
+    if (client_bitfield) set_bit_in_bitfield(client_bitfield, piece_index);
+    pieces_we_have_count++;
+    bytes_we_have_downloaded += piece_length_of(piece_index);
+}
+
+// Startup recheck: threads pull batches of pieces from a shared cursor and hash them straight out of the mapped file,
+// or, when the torrent can't be mapped as one range (several files), out of batches read through the storage module
+#define RECHECK_BATCH_PIECES 8          // Matches the multi-buffer SHA-1 lane count
+#define RECHECK_MAX_THREADS 16
+#define RECHECK_READ_BUFFER (32UL * 1024 * 1024)    // Per-thread buffer cap when reading instead of mapping
+
+typedef struct {
+    const uint8_t *file_map;            // Whole output file, read-only, or NULL to read each batch
+    uint32_t batch_pieces;              // Pieces claimed at a time
+    _Atomic uint32_t next_piece;        // Next piece index nobody has claimed
+    _Atomic uint64_t bytes_checked;     // For the progress indicator
+    bool *piece_ok;                     // Per-piece verdict, each slot written by exactly one thread
+} RecheckJob;
+
+static void *recheck_worker(void *arg) {
+    RecheckJob *job = arg;
+    const uint8_t *batch_data[RECHECK_BATCH_PIECES];
+    uint8_t batch_hash[RECHECK_BATCH_PIECES][20];
+    // Without this buffer the thread still claims and counts batches, it just can't vouch for them
+    uint8_t *read_buffer = job->file_map ? NULL : malloc((size_t)job->batch_pieces * standard_piece_length);
+
+    while (1) {
+        uint32_t first = atomic_fetch_add(&job->next_piece, job->batch_pieces);
+        if (first >= total_torrent_pieces) break;
+        uint32_t count = total_torrent_pieces - first < job->batch_pieces ? total_torrent_pieces - first : job->batch_pieces;
+        uint64_t batch_offset = (uint64_t)first * standard_piece_length;
+        uint64_t batch_bytes = (uint64_t)(count - 1) * standard_piece_length + piece_length_of(first + count - 1);
+
+        const uint8_t *batch_base = job->file_map ? job->file_map + batch_offset : NULL;
+        if (read_buffer && storage_read(batch_offset, read_buffer, batch_bytes) == 0) batch_base = read_buffer;
+        if (!batch_base) {
+            atomic_fetch_add(&job->bytes_checked, batch_bytes);
+            continue;
+        }
+
+        // Full-length pieces go through sha1sum_many together, the shorter last piece is hashed on its own
+        uint32_t full = 0;
+        while (full < count && piece_length_of(first + full) == standard_piece_length) {
+            batch_data[full] = batch_base + (uint64_t)full * standard_piece_length;
+            full++;
+        }
+        if (full > 0 && sha1sum_many(batch_data, standard_piece_length, batch_hash, full) == 0) {
+            for (uint32_t i = 0; i < full; i++) {
+                job->piece_ok[first + i] = memcmp(batch_hash[i], expected_hashes[first + i], 20) == 0;
+            }
+        }
+        for (uint32_t i = full; i < count; i++) {
+            uint32_t piece_length = piece_length_of(first + i);
+            uint8_t hash[20];
+            if (piece_length > 0 &&
+                sha1sum_oneshot(batch_base + (uint64_t)i * standard_piece_length, piece_length, hash) == 0) {
+                job->piece_ok[first + i] = memcmp(hash, expected_hashes[first + i], 20) == 0;
+            }
+        }
+        atomic_fetch_add(&job->bytes_checked, batch_bytes);
+    }
+    free(read_buffer);
+    return NULL;
+}
+
+// Hash whatever an earlier run left in the output file(s) and mark every matching piece HAVE before any peer connects
+static void recheck_existing_data(void) {
+    uint64_t on_disk_size = 0;
+    if (storage_fingerprint(&on_disk_size, NULL, NULL) != 0 || on_disk_size < total_torrent_file_length) return;
+
+    // Reuse the storage mapping if there is one, otherwise map a single output file read-only just for the recheck
+    const uint8_t *file_map = storage_map(0, total_torrent_file_length);
+    void *own_map = NULL;
+    if (!file_map && storage_fd() >= 0) {
+        own_map = mmap(NULL, total_torrent_file_length, PROT_READ, MAP_SHARED, storage_fd(), 0);
+        if (own_map == MAP_FAILED) {
+            if (get_args().debug_mode) perror("[PieceManager] Warn: mmap for recheck failed, reading instead");
+            own_map = NULL;
+        }
+        file_map = own_map;
+    }
+    storage_advise(0, total_torrent_file_length, STORAGE_ACCESS_SEQUENTIAL);
+    if (own_map) madvise(own_map, total_torrent_file_length, MADV_SEQUENTIAL);
+
+    uint32_t read_batch = RECHECK_READ_BUFFER / standard_piece_length;
+    RecheckJob job = {.file_map = file_map, .piece_ok = calloc(total_torrent_pieces, sizeof(bool))};
+    job.batch_pieces = file_map || read_batch > RECHECK_BATCH_PIECES ? RECHECK_BATCH_PIECES : read_batch > 0 ? read_batch : 1;
+    if (!job.piece_ok) {
+        if (own_map) munmap(own_map, total_torrent_file_length);
+        return;
+    }
+    atomic_init(&job.next_piece, 0);
+    atomic_init(&job.bytes_checked, 0);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = cores > 0 ? (int)cores : 1;
+    if (num_threads > RECHECK_MAX_THREADS) num_threads = RECHECK_MAX_THREADS;
+    if (!file_map && storage_get_backend() == STORAGE_BACKEND_STDIO) num_threads = 1;     // One stream position
+    pthread_t threads[RECHECK_MAX_THREADS];
+    int started = 0;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&threads[started], NULL, recheck_worker, &job) != 0) break;
+    }
+    if (started == 0) recheck_worker(&job);   // No threads available, check on this one
+
+    struct timespec start_time, now;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (int tick = 0; started > 0 && atomic_load(&job.bytes_checked) < total_torrent_file_length; tick++) {
+        if (tick % 10 == 0) {
+            printf("\rChecking existing data: %5.1f%%", (double)atomic_load(&job.bytes_checked) * 100.0 / total_torrent_file_length);
+            fflush(stdout);
+        }
+        usleep(10 * 1000);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1e9;
+
+    for (uint32_t i = 0; i < total_torrent_pieces; i++) {
+        if (job.piece_ok[i]) mark_piece_have_on_disk(i);
+    }
+
+    printf("\rChecking existing data: %u/%u pieces valid (%.2f GB/s, %d threads, %s)\n",
+        pieces_we_have_count, total_torrent_pieces,
+        seconds > 0 ? total_torrent_file_length / seconds / 1e9 : 0.0, started > 0 ? started : 1, sha1sum_engine_name());
+    fflush(stdout);
+
+    free(job.piece_ok);
+    if (own_map) munmap(own_map, total_torrent_file_length);
+    storage_advise(0, total_torrent_file_length, STORAGE_ACCESS_RANDOM);    // From here on reads serve peers' requests
+}
+
+// Fast-resume file layout: ResumeHeader, our bitfield, then for each partial piece its index followed by a
+// bitmap of the blocks that were flushed to the output file. Only valid while the output files' total size and
+// latest mtime still match the header, i.e. nothing has written to them since the save.
+#define RESUME_MAGIC 0x53525442u    // "BTRS"
+#define RESUME_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t info_hash[20];
+    uint32_t num_pieces;
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t piece_length;
+    uint32_t num_partial_pieces;
+} ResumeHeader;
+
+// A piece worth recording block by block: some blocks arrived but it isn't HAVE yet
+static bool piece_is_partial(const InFlightPiece *piece) {
+    return (piece_states[piece->index] == PIECE_STATE_PENDING || piece_states[piece->index] == PIECE_STATE_VERIFYING) &&
+           piece->num_blocks_received > 0 && (piece->data_buffer || write_through_mode);
+}
+
+// A received block of a partial piece, copied so it can be flushed into place while its piece keeps changing
+typedef struct {
+    uint64_t file_offset;
+    uint32_t length;
+    size_t data_offset;             // Into ResumeSnapshot.block_data
+} ResumeBlock;
+
+// Everything a resume save writes, taken on the event loop so the disk I/O thread can do the slow part
+typedef struct {
+    uint8_t *contents;              // The resume file; the header's fingerprint is filled in after the sync
+    size_t contents_len;
+    ResumeBlock *blocks;            // Buffered blocks of partial pieces (write-through blocks are on disk already)
+    uint32_t num_blocks;
+    uint8_t *block_data;
+    char *tmp_name;
+    char *resume_name;
+    uint32_t num_have, num_partial;
+} ResumeSnapshot;
+
+static atomic_bool resume_save_queued = false;  // A snapshot is with the disk I/O thread
+
+static void free_resume_snapshot(ResumeSnapshot *snapshot) {
+    if (!snapshot) return;
+    free(snapshot->contents);
+    free(snapshot->blocks);
+    free(snapshot->block_data);
+    free(snapshot->tmp_name);
+    free(snapshot->resume_name);
+    free(snapshot);
+}
+
+// Capture the resume file and the partial pieces' blocks. A HAVE piece still queued on the disk writer isn't on
+// disk yet, so it is left out of the bitfield (the next save records it).
+static ResumeSnapshot *take_resume_snapshot(void) {
+    ResumeSnapshot *snapshot = calloc(1, sizeof(ResumeSnapshot));
+    if (!snapshot) return NULL;
+
+    size_t contents_len = sizeof(ResumeHeader) + client_bitfield_length_bytes;
+    size_t block_data_len = 0;
+    uint32_t num_blocks = 0;
+    for (uint32_t slot = 0; slot < in_flight_capacity; slot++) {
+        InFlightPiece *piece = in_flight[slot];
+        if (!piece || !piece_is_partial(piece)) continue;
+        uint32_t piece_blocks = num_blocks_of(piece->index);
+        contents_len += sizeof(uint32_t) + (piece_blocks + 7) / 8;
+        if (!piece->data_buffer) continue;
+        for (uint32_t b = 0; b < piece_blocks; b++) {
+            if (!test_block(blocks_received, first_block_of(piece->index) + b)) continue;
+            num_blocks++;
+            block_data_len += calculate_block_length(piece_length_of(piece->index), b, piece_blocks);
+        }
+    }
+
+    size_t tmp_name_len = strlen(resume_file_name_global) + sizeof(".tmp");
+    snapshot->contents = calloc(1, contents_len);   // No stray padding bytes in the header
+    snapshot->blocks = malloc((num_blocks ? num_blocks : 1) * sizeof(ResumeBlock));
+    snapshot->block_data = malloc(block_data_len ? block_data_len : 1);
+    snapshot->tmp_name = malloc(tmp_name_len);
+    snapshot->resume_name = strdup(resume_file_name_global);
+    if (!snapshot->contents || !snapshot->blocks || !snapshot->block_data || !snapshot->tmp_name || !snapshot->resume_name) {
+        free_resume_snapshot(snapshot);
+        return NULL;
+    }
+    snprintf(snapshot->tmp_name, tmp_name_len, "%s.tmp", resume_file_name_global);
+    snapshot->contents_len = contents_len;
+
+    uint8_t *bitfield = snapshot->contents + sizeof(ResumeHeader);
+    memcpy(bitfield, client_bitfield, client_bitfield_length_bytes);
+    snapshot->num_have = pieces_we_have_count;
+    uint8_t *record = bitfield + client_bitfield_length_bytes;
+    size_t data_offset = 0;
+    for (uint32_t slot = 0; slot < in_flight_capacity; slot++) {
+        InFlightPiece *piece = in_flight[slot];
+        if (!piece) continue;
+        uint32_t i = piece->index, piece_blocks = num_blocks_of(i);
+        if (piece_states[i] == PIECE_STATE_HAVE) {
+            bitfield[i / 8] &= ~(1 << (7 - i % 8));
+            snapshot->num_have--;
+            continue;
+        }
+        if (!piece_is_partial(piece)) continue;
+
+        snapshot->num_partial++;
+        memcpy(record, &i, sizeof(uint32_t));
+        uint8_t *block_bitmap = record + sizeof(uint32_t);
+        for (uint32_t b = 0; b < piece_blocks; b++) {
+            if (!test_block(blocks_received, first_block_of(i) + b)) continue;
+            block_bitmap[b / 8] |= 1 << (7 - b % 8);    // MSB first, like the bitfield
+            if (!piece->data_buffer) continue;
+            ResumeBlock *block = &snapshot->blocks[snapshot->num_blocks++];
+            block->file_offset = (uint64_t)i * standard_piece_length + (uint64_t)b * DEFAULT_BLOCK_LENGTH;
+            block->length = calculate_block_length(piece_length_of(i), b, piece_blocks);
+            block->data_offset = data_offset;
+            memcpy(snapshot->block_data + data_offset, piece->data_buffer + (size_t)b * DEFAULT_BLOCK_LENGTH, block->length);
+            data_offset += block->length;
+        }
+        record = block_bitmap + (piece_blocks + 7) / 8;
+    }
+
+    ResumeHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RESUME_MAGIC;
+    header.version = RESUME_VERSION;
+    memcpy(header.info_hash, torrent_info_hash, 20);
+    header.num_pieces = total_torrent_pieces;
+    header.piece_length = standard_piece_length;
+    header.num_partial_pieces = snapshot->num_partial;
+    memcpy(snapshot->contents, &header, sizeof(header));
+    return snapshot;
+}
+
+// Flush the partial pieces' blocks into place, sync, and replace the resume file. Runs on the disk I/O thread
+// for periodic saves, so it touches nothing but the snapshot and the storage module.
+static int write_resume_snapshot(ResumeSnapshot *snapshot) {
+    for (uint32_t b = 0; b < snapshot->num_blocks; b++) {
+        const ResumeBlock *block = &snapshot->blocks[b];
+        if (storage_write(block->file_offset, snapshot->block_data + block->data_offset, block->length) != 0) {
+            if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Warn: Could not flush a partial piece for resume.\n");
+            return -1;
+        }
+    }
+    if (storage_sync() != 0) return -1;
+
+    ResumeHeader header;
+    memcpy(&header, snapshot->contents, sizeof(header));
+    if (storage_fingerprint(&header.file_size, &header.mtime_sec, &header.mtime_nsec) != 0) return -1;
+    memcpy(snapshot->contents, &header, sizeof(header));
+
+    // Write beside the old file and rename over it, so a crash mid-save leaves the previous state intact
+    FILE *resume_file = fopen(snapshot->tmp_name, "wb");
+    if (!resume_file) {
+        if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Warn: Could not create '%s': %s\n", snapshot->tmp_name, strerror(errno));
+        return -1;
+    }
+    bool ok = fwrite(snapshot->contents, 1, snapshot->contents_len, resume_file) == snapshot->contents_len;
+    ok = ok && fflush(resume_file) == 0 && fsync(fileno(resume_file)) == 0;
+    ok = fclose(resume_file) == 0 && ok;
+    if (!ok || rename(snapshot->tmp_name, snapshot->resume_name) != 0) {
+        if (get_args().debug_mode) fprintf(stderr, "[PieceManager] Warn: Could not write resume file '%s'.\n", snapshot->resume_name);
+        remove(snapshot->tmp_name);
+        return -1;
+    }
+
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Saved resume state: %u pieces HAVE, %u partial.\n", snapshot->num_have, snapshot->num_partial);
+    }
+    return 0;
+}
+
+static void save_resume_task(void *arg) {
+    write_resume_snapshot(arg);
+    free_resume_snapshot(arg);
+    atomic_store(&resume_save_queued, false);
+}
+
+int piece_manager_save_resume_state(void) {
+    if (!piece_states || !output_file_open || !resume_file_name_global) return -1;
+
+    // Queued pieces must be on disk before the bitfield claims them (this also waits out a periodic save). Collecting
+    // their results drops in-flight records, so it is done before the partial pieces are listed.
+    disk_writer_flush();
+    process_completed_writes();
+
+    ResumeSnapshot *snapshot = take_resume_snapshot();
+    if (!snapshot) return -1;
+    int result = write_resume_snapshot(snapshot);
+    free_resume_snapshot(snapshot);
+    return result;
+}
+
+int piece_manager_queue_resume_save(void) {
+    if (!piece_states || !output_file_open || !resume_file_name_global) return -1;
+    if (!disk_writer_running()) return piece_manager_save_resume_state();
+    if (atomic_load(&resume_save_queued)) return 0;    // The last one is still going
+
+    process_completed_writes();
+    ResumeSnapshot *snapshot = take_resume_snapshot();
+    if (!snapshot) return -1;
+    atomic_store(&resume_save_queued, true);
+    if (disk_writer_submit_task(save_resume_task, snapshot) != 0) {
+        atomic_store(&resume_save_queued, false);
+        free_resume_snapshot(snapshot);
+        return -1;
+    }
+    return 0;
 }
 
+// Restore HAVE pieces and partial pieces from the resume file. Returns false (having changed nothing) if the file
+// is missing, corrupt, for another torrent, or older than the output file's last modification.
+static bool load_resume_state(void) {
+    if (!resume_file_name_global) return false;
+    FILE *resume_file = fopen(resume_file_name_global, "rb");
+    if (!resume_file) return false;
+
+    uint64_t on_disk_size;
+    int64_t mtime_sec, mtime_nsec;
+    ResumeHeader header;
+    bool valid = fread(&header, sizeof(header), 1, resume_file) == 1 &&
+                 storage_fingerprint(&on_disk_size, &mtime_sec, &mtime_nsec) == 0 &&
+                 header.magic == RESUME_MAGIC && header.version == RESUME_VERSION &&
+                 memcmp(header.info_hash, torrent_info_hash, 20) == 0 &&
+                 header.num_pieces == total_torrent_pieces && header.piece_length == standard_piece_length &&
+                 header.file_size == on_disk_size && header.file_size >= total_torrent_file_length &&
+                 header.mtime_sec == mtime_sec && header.mtime_nsec == mtime_nsec &&
+                 header.num_partial_pieces <= total_torrent_pieces;
+
+    // Read everything before touching piece state, so a truncated file is rejected as a whole
+    uint8_t *saved_bitfield = valid ? malloc(client_bitfield_length_bytes) : NULL;
+    uint32_t *partial_index = valid ? calloc(header.num_partial_pieces + 1, sizeof(uint32_t)) : NULL;
+    uint8_t **partial_bitmap = valid ? calloc(header.num_partial_pieces + 1, sizeof(uint8_t *)) : NULL;
+    valid = valid && saved_bitfield && partial_index && partial_bitmap &&
+            fread(saved_bitfield, 1, client_bitfield_length_bytes, resume_file) == client_bitfield_length_bytes;
+    for (uint32_t p = 0; valid && p < header.num_partial_pieces; p++) {
+        valid = fread(&partial_index[p], sizeof(uint32_t), 1, resume_file) == 1 &&
+                partial_index[p] < total_torrent_pieces &&
+                !get_bit_from_bitfield(saved_bitfield, partial_index[p], total_torrent_pieces);
+        if (!valid) break;
+        size_t bitmap_len = (num_blocks_of(partial_index[p]) + 7) / 8;
+        partial_bitmap[p] = malloc(bitmap_len > 0 ? bitmap_len : 1);
+        valid = partial_bitmap[p] && fread(partial_bitmap[p], 1, bitmap_len, resume_file) == bitmap_len;
+    }
+    fclose(resume_file);
+
+    uint32_t partial_restored = 0;
+    if (valid) {
+        for (uint32_t i = 0; i < total_torrent_pieces; i++) {
+            if (get_bit_from_bitfield(saved_bitfield, i, total_torrent_pieces)) mark_piece_have_on_disk(i);
+        }
+
+        // Reload the flushed blocks of partial pieces into fresh buffers, as if they had just arrived
+        uint8_t *block = buffer_pool_alloc(DEFAULT_BLOCK_LENGTH);
+        for (uint32_t p = 0; block && p < header.num_partial_pieces; p++) {
+            uint32_t i = partial_index[p], num_blocks = num_blocks_of(i);
+            if (piece_states[i] != PIECE_STATE_MISSING) continue;  // Listed twice
+            for (uint32_t b = 0; b < num_blocks; b++) {
+                if (!get_bit_from_bitfield(partial_bitmap[p], b, num_blocks)) continue;
+                uint32_t block_len = calculate_block_length(piece_length_of(i), b, num_blocks);
+                if (piece_manager_read_block(i, b * DEFAULT_BLOCK_LENGTH, block_len, block)) {
+                    piece_manager_record_block_received(i, b * DEFAULT_BLOCK_LENGTH, block, block_len);
+                }
+            }
+            if (piece_states[i] != PIECE_STATE_MISSING) partial_restored++;
+        }
+        buffer_pool_free(block, DEFAULT_BLOCK_LENGTH);
+    }
+
+    for (uint32_t p = 0; partial_bitmap && p < header.num_partial_pieces; p++) free(partial_bitmap[p]);
+    free(partial_bitmap);
+    free(partial_index);
+    free(saved_bitfield);
+
+    if (valid) {
+        printf("Resumed from '%s': %u/%u pieces, %u partial pieces restored\n",
+            resume_file_name_global, pieces_we_have_count, total_torrent_pieces, partial_restored);
+        fflush(stdout);
+    } else if (get_args().debug_mode) {
+        fprintf(stderr, "[PieceManager] Resume file '%s' is stale or invalid, rechecking instead.\n", resume_file_name_global);
+    }
+    return valid;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "read_cache.h"
+
+// One cached piece, linked into the LRU list (head is most recently used)
+typedef struct CacheEntry {
+    uint32_t piece_index;
+    uint8_t *data;
+    size_t length;
+    struct CacheEntry *prev;
+    struct CacheEntry *next;
+} CacheEntry;
+
+static CacheEntry **entry_of_piece = NULL;  // Piece index -> entry, NULL if not cached
+static uint32_t total_pieces = 0;
+static CacheEntry *lru_head = NULL;
+static CacheEntry *lru_tail = NULL;
+static ReadCacheStats stats;
+
+static void lru_unlink(CacheEntry *entry) {
+    if (entry->prev) entry->prev->next = entry->next; else lru_head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev; else lru_tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void lru_push_front(CacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = lru_head;
+    if (lru_head) lru_head->prev = entry;
+    lru_head = entry;
+    if (!lru_tail) lru_tail = entry;
+}
+
+static void remove_entry(CacheEntry *entry) {
+    lru_unlink(entry);
+    entry_of_piece[entry->piece_index] = NULL;
+    stats.bytes_cached -= entry->length;
+    free(entry->data);
+    free(entry);
+}
+
+int read_cache_init(uint32_t num_pieces, size_t capacity_bytes) {
+    read_cache_destroy();
+    memset(&stats, 0, sizeof(stats));
+    if (capacity_bytes == 0 || num_pieces == 0) return 0;     // Disabled
+
+    entry_of_piece = calloc(num_pieces, sizeof(CacheEntry *));
+    if (!entry_of_piece) return -1;
+    total_pieces = num_pieces;
+    stats.capacity_bytes = capacity_bytes;
+    return 0;
+}
+
+void read_cache_destroy(void) {
+    while (lru_head) {
+        remove_entry(lru_head);
+    }
+    free(entry_of_piece);
+    entry_of_piece = NULL;
+    total_pieces = 0;
+    stats.capacity_bytes = 0;
+}
+
+const uint8_t *read_cache_get(uint32_t piece_index) {
+    if (!entry_of_piece || piece_index >= total_pieces) return NULL;
+
+    CacheEntry *entry = entry_of_piece[piece_index];
+    if (!entry) {
+        stats.misses++;
+        return NULL;
+    }
+    stats.hits++;
+    if (entry != lru_head) {
+        lru_unlink(entry);
+        lru_push_front(entry);
+    }
+    return entry->data;
+}
+
+const uint8_t *read_cache_insert(uint32_t piece_index, uint8_t *data, size_t length) {
+    if (!entry_of_piece || piece_index >= total_pieces || length > stats.capacity_bytes) {
+        free(data);
+        return NULL;
+    }
+    if (entry_of_piece[piece_index]) remove_entry(entry_of_piece[piece_index]);
+
+    while (lru_tail && stats.bytes_cached + length > stats.capacity_bytes) {
+        remove_entry(lru_tail);
+        stats.evictions++;
+    }
+
+    CacheEntry *entry = malloc(sizeof(CacheEntry));
+    if (!entry) {
+        free(data);
+        return NULL;
+    }
+    entry->piece_index = piece_index;
+    entry->data = data;
+    entry->length = length;
+    lru_push_front(entry);
+    entry_of_piece[piece_index] = entry;
+    stats.bytes_cached += length;
+    return data;
+}
+
+void read_cache_invalidate(uint32_t piece_index) {
+    if (!entry_of_piece || piece_index >= total_pieces || !entry_of_piece[piece_index]) return;
+    remove_entry(entry_of_piece[piece_index]);
+}
+
+bool read_cache_enabled(void) {
+    return entry_of_piece != NULL;
+}
+
+void read_cache_get_stats(ReadCacheStats *out) {
+    if (out) *out = stats;
+}
@@ -0,0 +1,637 @@
+#define _GNU_SOURCE     // For O_DIRECT and fallocate
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdatomic.h>
+
+#include "storage.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define STORAGE_ADVISE_MAX_FILES 16     // Files a single storage_advise call will open to pass the hint on
+
+// One non-empty file of the torrent. The table is in torrent order, so offsets are sorted and a range is found by
+// binary search. Zero-length files are created at open and left out of the table.
+typedef struct {
+    char *path;
+    uint64_t offset;            // Where the file starts in the torrent's byte space
+    uint64_t length;
+    int fd;                     // Buffered descriptor, -1 while closed
+    int direct_fd;              // DIRECT backend: O_DIRECT descriptor for aligned transfers, -1 while closed
+    bool writable;              // fd was opened read-write
+    bool needs_sync;            // Written since its last sync, even if the descriptor has been closed since
+    int users;                  // Transfers using the descriptors right now; only idle files are closed
+    int lru_prev, lru_next;     // Links in the list of open files, most recently used first
+} StorageFile;
+
+static StorageBackend active_backend = STORAGE_BACKEND_STDIO;
+static StorageFile *files = NULL;
+static int num_files = 0;
+static bool storage_is_open = false;
+static FILE *file_ptr = NULL;           // STDIO backend (single file only): stream over files[0].fd
+static uint8_t *file_map = NULL;        // MMAP backend (single file only): the whole file, shared with the page cache
+static uint64_t file_length = 0;        // Sum of all file lengths
+
+static atomic_bool dirty = false;       // Written since the last sync (writes may come from the disk I/O thread)
+static _Atomic time_t last_sync_time = 0; // Syncs run on the disk I/O thread when it is running
+
+// Open descriptor cache. Files are opened on first use and the least recently used idle ones closed once
+// fd_cache_capacity descriptors are open. Everything below is guarded by fd_cache_lock, since the event loop,
+// the disk I/O thread and the recheck threads all transfer data.
+static pthread_mutex_t fd_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t file_idle = PTHREAD_COND_INITIALIZER;    // Some file's users dropped to 0
+static int lru_head = -1, lru_tail = -1;
+static StorageFdCacheStats fd_stats;
+static int *dirty_files = NULL;         // Indices of files with needs_sync set
+static int dirty_files_count = 0, dirty_files_capacity = 0;
+
+// Reserve the file's blocks up front so later writes can't fail with ENOSPC or fragment the file
+static int preallocate(int fd, uint64_t total_length, bool sparse) {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) return -1;
+    if ((uint64_t)file_stat.st_size >= total_length) return 0;     // Already full size; fallocate would bump the mtime resume relies on
+    if (!sparse) {
+        if (fallocate(fd, 0, 0, (off_t)total_length) == 0) return 0;
+        if (errno != EOPNOTSUPP && errno != ENOSYS) return -1;  // Out of space is a real failure
+        // Filesystem can't reserve space, fall through to a sparse file
+    }
+    // ftruncate never touches existing bytes, so an earlier run's data survives
+    return ftruncate(fd, (off_t)total_length) == 0 ? 0 : -1;
+}
+
+static bool is_direct_aligned(uint64_t offset, const void *buffer, size_t length) {
+    return offset % STORAGE_DIRECT_ALIGNMENT == 0 && length % STORAGE_DIRECT_ALIGNMENT == 0 &&
+           (uintptr_t)buffer % STORAGE_DIRECT_ALIGNMENT == 0;
+}
+
+// Create every missing directory leading up to path (like mkdir -p on its dirname)
+static int make_parent_dirs(const char *path) {
+    char *copy = strdup(path);
+    if (!copy) return -1;
+    for (char *slash = strchr(copy + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(copy, 0755) != 0 && errno != EEXIST) {
+            free(copy);
+            return -1;
+        }
+        *slash = '/';
+    }
+    free(copy);
+    return 0;
+}
+
+// Index of the file containing offset, or -1 past the end
+static int find_file(uint64_t offset) {
+    int lo = 0, hi = num_files - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (offset < files[mid].offset) hi = mid - 1;
+        else if (offset >= files[mid].offset + files[mid].length) lo = mid + 1;
+        else return mid;
+    }
+    return -1;
+}
+
+// Size the cache from the process's descriptor limit, leaving most of it to sockets
+static int fd_cache_capacity_for_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) return STORAGE_FD_CACHE_MAX;
+    rlim_t share = limit.rlim_cur / 4;
+    if (share < STORAGE_FD_CACHE_MIN) return STORAGE_FD_CACHE_MIN;
+    return share > STORAGE_FD_CACHE_MAX ? STORAGE_FD_CACHE_MAX : (int)share;
+}
+
+static void lru_unlink(int index) {
+    StorageFile *file = &files[index];
+    if (file->lru_prev >= 0) files[file->lru_prev].lru_next = file->lru_next; else lru_head = file->lru_next;
+    if (file->lru_next >= 0) files[file->lru_next].lru_prev = file->lru_prev; else lru_tail = file->lru_prev;
+    file->lru_prev = file->lru_next = -1;
+}
+
+static void lru_push_front(int index) {
+    files[index].lru_prev = -1;
+    files[index].lru_next = lru_head;
+    if (lru_head >= 0) files[lru_head].lru_prev = index;
+    lru_head = index;
+    if (lru_tail < 0) lru_tail = index;
+}
+
+static void close_file_fds(StorageFile *file) {
+    if (file->fd >= 0) {
+        close(file->fd);
+        fd_stats.open_fds--;
+    }
+    if (file->direct_fd >= 0) {
+        close(file->direct_fd);
+        fd_stats.open_fds--;
+    }
+    file->fd = file->direct_fd = -1;
+}
+
+// Close least recently used idle files until `needed` more descriptors fit under the cap
+static void make_room(int needed) {
+    int index = lru_tail;
+    while (index >= 0 && fd_stats.open_fds + needed > fd_stats.capacity) {
+        int prev = files[index].lru_prev;
+        if (files[index].users == 0) {
+            lru_unlink(index);
+            close_file_fds(&files[index]);
+            fd_stats.evictions++;
+        }
+        index = prev;
+    }
+}
+
+// open() that counts against the cache, evicting first (and once more if the process is out of descriptors)
+static int open_cached(const char *path, int flags) {
+    make_room(1);
+    int fd = open(path, flags);
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE) && fd_stats.open_fds > 0) {
+        make_room(fd_stats.capacity - fd_stats.open_fds + 1);   // Shed one more idle file
+        fd = open(path, flags);
+    }
+    if (fd >= 0) fd_stats.open_fds++;
+    return fd;
+}
+
+// Queue a file for the next sync, once data has been written to it. Caller holds fd_cache_lock.
+static void mark_needs_sync(int index) {
+    dirty = true;
+    if (files[index].needs_sync) return;
+    files[index].needs_sync = true;
+    dirty_files[dirty_files_count++] = index;      // Sized for every file, each listed at most once
+}
+
+// Pin a file and get a descriptor for it, opening it (or reopening it read-write) as needed. Returns -1 if it
+// can't be opened. Every successful call must be paired with release_fd.
+static int acquire_fd(int index, bool for_write, bool want_direct) {
+    StorageFile *file = &files[index];
+    pthread_mutex_lock(&fd_cache_lock);
+
+    // Opened read-only for seeding: once no transfer is using it, reopen it read-write
+    while (for_write && file->fd >= 0 && !file->writable) {
+        if (file->users == 0) {
+            close(file->fd);
+            file->fd = -1;
+            fd_stats.open_fds--;
+            if (file->direct_fd < 0) lru_unlink(index);
+        } else {
+            pthread_cond_wait(&file_idle, &fd_cache_lock);
+        }
+    }
+
+    file->users++;      // Pinned, so making room for its own descriptors can't close it
+    bool was_open = file->fd >= 0 || file->direct_fd >= 0;
+    int fd = -1;
+    if (want_direct) {
+        if (file->direct_fd < 0) file->direct_fd = open_cached(file->path, O_RDWR | O_DIRECT);
+        fd = file->direct_fd;
+    }
+    if (fd < 0) {
+        if (file->fd < 0) {
+            file->fd = open_cached(file->path, for_write ? O_RDWR : O_RDONLY);
+            file->writable = for_write;
+        }
+        fd = file->fd;
+    }
+    if (was_open) {
+        fd_stats.hits++;
+        lru_unlink(index);
+    } else {
+        fd_stats.misses++;
+    }
+    if (file->fd >= 0 || file->direct_fd >= 0) lru_push_front(index);
+
+    if (fd < 0 && --file->users == 0) pthread_cond_broadcast(&file_idle);
+    pthread_mutex_unlock(&fd_cache_lock);
+    return fd;
+}
+
+// Unpin a file from acquire_fd. written queues it for the next sync: only now, after the write, so a sync that
+// took the list in between can't miss it.
+static void release_fd(int index, bool written) {
+    pthread_mutex_lock(&fd_cache_lock);
+    if (written) mark_needs_sync(index);
+    if (--files[index].users == 0) pthread_cond_broadcast(&file_idle);
+    pthread_mutex_unlock(&fd_cache_lock);
+}
+
+// One preadv/pwritev on a single file, repeated until the whole iovec is done
+static int transfer_file(bool is_write, int fd, uint64_t offset, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = is_write ? pwritev(fd, iov, iovcnt, (off_t)offset) : preadv(fd, iov, iovcnt, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        // Short transfer: skip what went through and continue from the first byte that didn't
+        offset += (uint64_t)n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+// Split a torrent range over the files it covers and move each file's share with one vectored call
+static int transfer_range(bool is_write, uint64_t offset, const struct iovec *iov, int iovcnt) {
+    uint64_t remaining = 0;
+    for (int i = 0; i < iovcnt; i++) remaining += iov[i].iov_len;
+    if (offset + remaining > file_length) return -1;
+    if (remaining == 0) return 0;
+
+    int file_index = find_file(offset);
+    int iov_index = 0;
+    size_t iov_pos = 0;             // Bytes of iov[iov_index] already handed out
+    struct iovec segment_iov[IOV_MAX];
+    while (remaining > 0) {
+        if (file_index < 0 || file_index >= num_files) return -1;
+        StorageFile *file = &files[file_index];
+        uint64_t file_offset = offset - file->offset;
+        uint64_t segment_len = file->length - file_offset < remaining ? file->length - file_offset : remaining;
+
+        // Slice the caller's buffers down to the part that lands in this file
+        int segment_count = 0;
+        uint64_t sliced = 0;
+        bool aligned = file_offset % STORAGE_DIRECT_ALIGNMENT == 0;
+        while (sliced < segment_len && segment_count < IOV_MAX) {
+            size_t take = iov[iov_index].iov_len - iov_pos;
+            if (take > segment_len - sliced) take = segment_len - sliced;
+            if (take > 0) {
+                segment_iov[segment_count].iov_base = (uint8_t *)iov[iov_index].iov_base + iov_pos;
+                segment_iov[segment_count].iov_len = take;
+                aligned = aligned && is_direct_aligned(0, segment_iov[segment_count].iov_base, take);
+                segment_count++;
+                sliced += take;
+                iov_pos += take;
+            }
+            if (iov_pos == iov[iov_index].iov_len) {
+                iov_index++;
+                iov_pos = 0;
+            }
+        }
+
+        // Unaligned transfers (the short last piece, file boundaries, buffers not from storage_alloc_buffer) use the buffered descriptor
+        int fd = acquire_fd(file_index, is_write, active_backend == STORAGE_BACKEND_DIRECT && aligned);
+        if (fd < 0) return -1;
+        int result = transfer_file(is_write, fd, file_offset, segment_iov, segment_count);
+        release_fd(file_index, is_write);
+        if (result != 0) return -1;
+        offset += sliced;
+        remaining -= sliced;
+        if (offset == file->offset + file->length) file_index++;
+    }
+    return 0;
+}
+
+int storage_open(const StorageFileSpec *specs, int num_specs, StorageBackend backend, bool sparse, bool *existed_out) {
+    if (!specs || num_specs <= 0 || storage_is_open) return -1;
+
+    files = calloc((size_t)num_specs, sizeof(StorageFile));
+    dirty_files = malloc((size_t)num_specs * sizeof(int));
+    if (!files || !dirty_files) goto fail;
+    num_files = 0;
+    file_length = 0;
+    dirty_files_count = 0;
+    dirty_files_capacity = num_specs;
+    lru_head = lru_tail = -1;
+    memset(&fd_stats, 0, sizeof(fd_stats));
+    fd_stats.capacity = fd_cache_capacity_for_limit();
+
+    // Keep whatever an earlier run left, otherwise start from empty files. Files already at full size are left
+    // closed until a transfer needs them, so opening a torrent with many files costs one stat each.
+    bool existed = false;
+    for (int i = 0; i < num_specs; i++) {
+        if (!specs[i].path || make_parent_dirs(specs[i].path) != 0) goto fail;
+        struct stat file_stat;
+        bool exists = stat(specs[i].path, &file_stat) == 0;
+        existed = existed || exists;
+        if (!exists || (uint64_t)file_stat.st_size < specs[i].length) {
+            int fd = open(specs[i].path, O_RDWR | O_CREAT, 0644);
+            if (fd < 0) goto fail;
+            int result = preallocate(fd, specs[i].length, sparse);
+            close(fd);
+            if (result != 0) goto fail;
+        }
+        if (specs[i].length == 0) continue;     // Created, nothing to index
+
+        StorageFile *file = &files[num_files];
+        file->path = strdup(specs[i].path);
+        file->offset = file_length;
+        file->length = specs[i].length;
+        file->fd = file->direct_fd = -1;
+        file->lru_prev = file->lru_next = -1;
+        num_files++;
+        if (!file->path) goto fail;
+        file_length += specs[i].length;
+    }
+    if (existed_out) *existed_out = existed;
+    storage_is_open = true;
+    dirty = false;
+    last_sync_time = time(NULL);
+
+    // A single file stays open and pinned for the whole session, which storage_fd, stdio and mmap rely on
+    if (num_files == 1) {
+        files[0].fd = open_cached(files[0].path, O_RDWR);
+        if (files[0].fd < 0) goto fail;
+        files[0].writable = true;
+        files[0].users = 1;
+        lru_push_front(0);
+    }
+
+    // Fall back to plain pread/pwrite when the requested backend can't be set up. stdio and mmap address one
+    // file through one stream or mapping, so they are only used for single-file torrents.
+    active_backend = STORAGE_BACKEND_PREAD;
+    if (backend == STORAGE_BACKEND_STDIO && num_files == 1) {
+        file_ptr = fdopen(files[0].fd, "r+b");
+        if (file_ptr) active_backend = STORAGE_BACKEND_STDIO;
+    } else if (backend == STORAGE_BACKEND_MMAP && num_files == 1) {
+        void *map = mmap(NULL, file_length, PROT_READ | PROT_WRITE, MAP_SHARED, files[0].fd, 0);
+        if (map != MAP_FAILED) {
+            file_map = map;
+            active_backend = STORAGE_BACKEND_MMAP;
+        }
+    } else if (backend == STORAGE_BACKEND_DIRECT && num_files > 0) {
+        // Probe once; each file then gets its O_DIRECT descriptor through the cache like the buffered one
+        int probe_fd = open(files[0].path, O_RDWR | O_DIRECT);
+        if (probe_fd >= 0) {
+            close(probe_fd);
+            active_backend = STORAGE_BACKEND_DIRECT;
+        }
+    }
+    return 0;
+
+fail:
+    storage_is_open = true;
+    storage_close();
+    return -1;
+}
+
+void storage_close(void) {
+    if (!storage_is_open) return;
+    if (files) storage_sync();
+    if (file_map) {
+        munmap(file_map, file_length);
+        file_map = NULL;
+    }
+    if (file_ptr) {
+        fclose(file_ptr);   // Also closes files[0].fd
+        file_ptr = NULL;
+        files[0].fd = -1;
+        fd_stats.open_fds--;
+    }
+    for (int i = 0; i < num_files; i++) {
+        close_file_fds(&files[i]);
+        free(files[i].path);
+    }
+    free(files);
+    files = NULL;
+    free(dirty_files);
+    dirty_files = NULL;
+    dirty_files_count = dirty_files_capacity = 0;
+    num_files = 0;
+    file_length = 0;
+    lru_head = lru_tail = -1;
+    storage_is_open = false;
+    active_backend = STORAGE_BACKEND_STDIO;
+}
+
+int storage_write(uint64_t offset, const uint8_t *data, size_t length) {
+    if (!storage_is_open || offset + length > file_length) return -1;
+    if (length == 0) return 0;
+
+    if (file_map || file_ptr) {
+        int result = 0;
+        if (file_map) {
+            memcpy(file_map + offset, data, length);
+        } else {
+            // No fflush here: reads go through the same stream, and storage_sync_if_due pushes it out
+            result = fseeko(file_ptr, (off_t)offset, SEEK_SET) == 0 && fwrite(data, 1, length, file_ptr) == length ? 0 : -1;
+        }
+        pthread_mutex_lock(&fd_cache_lock);
+        mark_needs_sync(0);     // Both are single-file only
+        pthread_mutex_unlock(&fd_cache_lock);
+        return result;
+    }
+
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = length };
+    return transfer_range(true, offset, &iov, 1);
+}
+
+int storage_writev(uint64_t offset, struct iovec *iov, int iovcnt) {
+    if (!storage_is_open || iovcnt <= 0) return -1;
+    if (!file_map && !file_ptr) return transfer_range(true, offset, iov, iovcnt);
+
+    // mmap and stdio have no vectored write, copy each buffer in turn
+    for (int i = 0; i < iovcnt; i++) {
+        if (storage_write(offset, iov[i].iov_base, iov[i].iov_len) != 0) return -1;
+        offset += iov[i].iov_len;
+    }
+    return 0;
+}
+
+int storage_read(uint64_t offset, uint8_t *buffer, size_t length) {
+    if (!storage_is_open || offset + length > file_length) return -1;
+    if (length == 0) return 0;
+
+    if (file_map) {
+        memcpy(buffer, file_map + offset, length);
+        return 0;
+    }
+    if (file_ptr) {
+        if (fseeko(file_ptr, (off_t)offset, SEEK_SET) != 0) return -1;
+        return fread(buffer, 1, length, file_ptr) == length ? 0 : -1;
+    }
+
+    struct iovec iov = { .iov_base = buffer, .iov_len = length };
+    return transfer_range(false, offset, &iov, 1);
+}
+
+int storage_splice_from(int pipe_fd, uint64_t offset, size_t length) {
+    if (!storage_is_open || file_ptr || offset + length > file_length) return -1;   // stdio would reorder with its own buffer
+    if (length == 0) return 0;
+
+    for (int i = find_file(offset); length > 0; i++) {
+        if (i < 0 || i >= num_files) return -1;
+        uint64_t file_offset = offset - files[i].offset;
+        size_t segment_len = files[i].length - file_offset < length ? (size_t)(files[i].length - file_offset) : length;
+        int fd = acquire_fd(i, true, false);
+        if (fd < 0) return -1;
+        size_t done = 0;
+        while (done < segment_len) {
+            loff_t out_offset = (loff_t)(file_offset + done);
+            ssize_t n = splice(pipe_fd, NULL, fd, &out_offset, segment_len - done, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += (size_t)n;
+        }
+        release_fd(i, done > 0);
+        if (done < segment_len) return -1;
+        offset += segment_len;
+        length -= segment_len;
+    }
+    return 0;
+}
+
+const uint8_t *storage_map(uint64_t offset, size_t length) {
+    if (!file_map || offset + length > file_length) return NULL;
+    return file_map + offset;
+}
+
+// Flush every file written since the last sync; data_only picks fdatasync (the sizes never change after preallocation)
+static int sync_files(bool data_only) {
+    // Take the list, and clear dirty with it, so writes during the syncs queue their files for next time
+    pthread_mutex_lock(&fd_cache_lock);
+    int count = dirty_files_count;
+    int *pending = count > 0 ? malloc((size_t)count * sizeof(int)) : NULL;
+    if (count > 0 && !pending) {
+        pthread_mutex_unlock(&fd_cache_lock);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        pending[i] = dirty_files[i];
+        files[pending[i]].needs_sync = false;
+    }
+    dirty_files_count = 0;
+    dirty = false;
+    pthread_mutex_unlock(&fd_cache_lock);
+
+    // A file closed since its last write is reopened for the sync: fsync flushes the file, not just one descriptor
+    int result = 0;
+    if ((file_map && msync(file_map, file_length, MS_SYNC) != 0) || (file_ptr && fflush(file_ptr) != 0)) result = -1;
+    for (int i = 0; i < count; i++) {
+        int fd = result == 0 ? acquire_fd(pending[i], false, false) : -1;
+        bool ok = fd >= 0 && (data_only ? fdatasync(fd) : fsync(fd)) == 0;
+        if (fd >= 0) release_fd(pending[i], false);
+        if (!ok) {
+            result = -1;
+            pthread_mutex_lock(&fd_cache_lock);
+            mark_needs_sync(pending[i]);    // Sets dirty again
+            pthread_mutex_unlock(&fd_cache_lock);
+        }
+    }
+    free(pending);
+    if (result == 0) last_sync_time = time(NULL);
+    return result;
+}
+
+int storage_sync(void) {
+    if (!storage_is_open) return -1;
+    return sync_files(false);
+}
+
+int storage_sync_if_due(void) {
+    if (!storage_is_open || !dirty || time(NULL) - last_sync_time < STORAGE_SYNC_INTERVAL) return 0;
+    return sync_files(true);
+}
+
+void storage_advise(uint64_t offset, uint64_t length, StorageAccessHint hint) {
+    if (!storage_is_open || offset >= file_length) return;
+    if (offset + length > file_length) length = file_length - offset;
+
+    if (file_map) {
+        // madvise wants a page-aligned start
+        long page_size = sysconf(_SC_PAGESIZE);
+        uint64_t aligned = offset - offset % (uint64_t)page_size;
+        int advice = hint == STORAGE_ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL : hint == STORAGE_ACCESS_RANDOM ? MADV_RANDOM : MADV_WILLNEED;
+        madvise(file_map + aligned, length + (offset - aligned), advice);
+        return;
+    }
+    // Only the first few files of a long range are hinted, rather than cycling the whole descriptor cache
+    int advice = hint == STORAGE_ACCESS_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL : hint == STORAGE_ACCESS_RANDOM ? POSIX_FADV_RANDOM : POSIX_FADV_WILLNEED;
+    int first = find_file(offset);
+    for (int i = first; length > 0 && i >= 0 && i < num_files && i - first < STORAGE_ADVISE_MAX_FILES; i++) {
+        uint64_t file_offset = offset - files[i].offset;
+        uint64_t segment_len = files[i].length - file_offset < length ? files[i].length - file_offset : length;
+        int fd = acquire_fd(i, false, false);
+        if (fd >= 0) {
+            posix_fadvise(fd, (off_t)file_offset, (off_t)segment_len, advice);
+            release_fd(i, false);
+        }
+        offset += segment_len;
+        length -= segment_len;
+    }
+}
+
+void *storage_alloc_buffer(size_t length) {
+    if (active_backend != STORAGE_BACKEND_DIRECT) return malloc(length);
+
+    // Round up so whole-piece transfers stay a multiple of the alignment
+    size_t padded = (length + STORAGE_DIRECT_ALIGNMENT - 1) / STORAGE_DIRECT_ALIGNMENT * STORAGE_DIRECT_ALIGNMENT;
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, STORAGE_DIRECT_ALIGNMENT, padded > 0 ? padded : STORAGE_DIRECT_ALIGNMENT) != 0) return NULL;
+    return buffer;
+}
+
+int storage_fingerprint(uint64_t *total_size_out, int64_t *mtime_sec_out, int64_t *mtime_nsec_out) {
+    if (!storage_is_open) return -1;
+
+    uint64_t total_size = 0;
+    struct timespec latest = {0, 0};
+    for (int i = 0; i < num_files; i++) {
+        struct stat file_stat;
+        if (stat(files[i].path, &file_stat) != 0) return -1;
+        total_size += (uint64_t)file_stat.st_size;
+        if (file_stat.st_mtim.tv_sec > latest.tv_sec ||
+            (file_stat.st_mtim.tv_sec == latest.tv_sec && file_stat.st_mtim.tv_nsec > latest.tv_nsec)) {
+            latest = file_stat.st_mtim;
+        }
+    }
+    if (total_size_out) *total_size_out = total_size;
+    if (mtime_sec_out) *mtime_sec_out = latest.tv_sec;
+    if (mtime_nsec_out) *mtime_nsec_out = latest.tv_nsec;
+    return 0;
+}
+
+int storage_fd(void) {
+    return storage_is_open && num_files == 1 ? files[0].fd : -1;
+}
+
+int storage_num_files(void) {
+    return num_files;
+}
+
+void storage_get_fd_cache_stats(StorageFdCacheStats *stats) {
+    if (!stats) return;
+    pthread_mutex_lock(&fd_cache_lock);
+    *stats = fd_stats;
+    pthread_mutex_unlock(&fd_cache_lock);
+}
+
+StorageBackend storage_get_backend(void) {
+    return active_backend;
+}
+
+int storage_backend_from_name(const char *name) {
+    if (!name) return -1;
+    for (int b = STORAGE_BACKEND_STDIO; b <= STORAGE_BACKEND_DIRECT; b++) {
+        if (strcmp(name, storage_backend_name(b)) == 0) return b;
+    }
+    return -1;
+}
+
+const char *storage_backend_name(StorageBackend backend) {
+    switch (backend) {
+    case STORAGE_BACKEND_STDIO: return "stdio";
+    case STORAGE_BACKEND_MMAP: return "mmap";
+    case STORAGE_BACKEND_PREAD: return "pread";
+    case STORAGE_BACKEND_DIRECT: return "direct";
+    }
+    return "unknown";
+}
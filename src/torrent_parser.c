@@ -73,6 +73,7 @@ void torrent_free(Torrent *torrent) {
         }
         free(torrent->announce_list);
     }
+    free(torrent->announce_tiers);
 
     free(torrent->info.pieces);
     free(torrent->info.name);
@@ -157,39 +158,75 @@ static void handle_announce(bencode_t *ben_item, Torrent *torrent) {
 }
 
 static void handle_announce_list(bencode_t *ben_item, Torrent *torrent) {
-    if (!bencode_is_list(ben_item)) {
+    if (!bencode_is_list(ben_item) || torrent->announce_list) {
         return;
     }
     
-    // the first pass to count differet announce trackers
+    // the first pass to count differet announce trackers, over every tier (BEP 12)
     bencode_t ben_count;
     bencode_clone(ben_item, &ben_count);
-    torrent->announce_list_count = 0;
+    int count = 0;
     while (bencode_list_has_next(&ben_count)) {
-        bencode_t item;
-        bencode_list_get_next(&ben_count, &item);
-        torrent->announce_list_count++;
+        bencode_t url_list;
+        bencode_list_get_next(&ben_count, &url_list);
+        if (!bencode_is_list(&url_list)) {
+            continue;
+        }
+        while (bencode_list_has_next(&url_list)) {
+            bencode_t url_item;
+            bencode_list_get_next(&url_list, &url_item);
+            if (bencode_is_string(&url_item)) {
+                count++;
+            }
+        }
+    }
+    if (count == 0) {
+        return;
     }
 
-    torrent->announce_list = calloc(torrent->announce_list_count, sizeof(char*));
+    torrent->announce_list = calloc(count, sizeof(char*));
+    torrent->announce_tiers = calloc(count, sizeof(int));
+    if (!torrent->announce_list || !torrent->announce_tiers) {
+        free(torrent->announce_list);
+        free(torrent->announce_tiers);
+        torrent->announce_list = NULL;
+        torrent->announce_tiers = NULL;
+        return;
+    }
     
+    // second pass keeps each tier's trackers together, in the order given (tiers without a URL are skipped)
     bencode_clone(ben_item, &ben_count);
-    int idx = 0;
-    while (bencode_list_has_next(&ben_count)) {
+    int idx = 0, tier = 0;
+    while (bencode_list_has_next(&ben_count) && idx < count) {
         bencode_t url_list;
         bencode_list_get_next(&ben_count, &url_list);
+        if (!bencode_is_list(&url_list)) {
+            continue;
+        }
         
-        if (bencode_list_has_next(&url_list)) {
+        int tier_start = idx;
+        while (bencode_list_has_next(&url_list) && idx < count) {
             bencode_t url_item;
             bencode_list_get_next(&url_list, &url_item);
+            if (!bencode_is_string(&url_item)) {
+                continue;
+            }
             
             const char *url;
             int url_len;
             bencode_string_value(&url_item, &url, &url_len);
             
-            torrent->announce_list[idx++] = strndup(url, url_len);
+            char *copy = strndup(url, url_len);
+            if (copy) {
+                torrent->announce_tiers[idx] = tier;
+                torrent->announce_list[idx++] = copy;
+            }
+        }
+        if (idx > tier_start) {
+            tier++;
         }
     }
+    torrent->announce_list_count = idx;
 }
 
 static void handle_creation_date(bencode_t *ben_item, Torrent *torrent) {
@@ -438,20 +475,12 @@ static void calculate_info_hash(bencode_t *ben_item, Torrent *torrent) {
         return;
     }
 
-    struct sha1sum_ctx *ctx = sha1sum_create(NULL, 0);
-    if (!ctx) {
-		fprintf(stderr, "Error creating checksum\n");
-		return;
-	}
-
     uint8_t checksum[20];
-    if (sha1sum_finish(ctx, (const uint8_t*)info, (size_t)info_len, checksum) != 0) {
+    if (sha1sum_oneshot((const uint8_t*)info, (size_t)info_len, checksum) != 0) {
         fprintf(stderr, "Error creating checksum\n");
-        sha1sum_destroy(ctx);
         return;
     }
 
-    sha1sum_destroy(ctx);
     memcpy(torrent->info_hash, checksum, 20);
 }
 
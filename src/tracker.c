@@ -1,15 +1,27 @@
 #include <ctype.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/random.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <endian.h>
 
 #include "tracker.h"
-#include "bencode.h"
+#include "tracker_parser.h"
+#include "btclient.h"   // For get_args() for debug mode
 
 struct url_parts {
     char protocol[6];   // "http", "https", or "udp"
@@ -41,8 +53,9 @@ char *encode_bin_data(unsigned char *data, size_t len) {
 }
 
 // parse announce URL into relevant parts to build GET request
-void parse_announce(char *announce, struct url_parts *parts) {
-    char *pos;
+// returns -1 for an unsupported protocol or a host, port or path that doesn't fit
+int parse_announce(const char *announce, struct url_parts *parts) {
+    const char *pos;
 
     if (strncmp(announce, "http://", 7) == 0) {
         strcpy(parts->port, "80");
@@ -53,375 +66,810 @@ void parse_announce(char *announce, struct url_parts *parts) {
         strcpy(parts->port, "443");
         pos = announce + 8;
     } else if (strncmp(announce, "udp://", 6) == 0) {
-        // set a default UDP port??
+        // UDP trackers have no default port, the URL must give one
         strcpy(parts->protocol, "udp");
         pos = announce + 6;
+    } else {
+        return -1;
     }
 
     // extract host
-    char *slash_pos = strchr(pos, '/');
+    const char *slash_pos = strchr(pos, '/');
     size_t host_len;
     if (slash_pos) {
         host_len = slash_pos - pos;
     } else {
         host_len = strlen(pos);
     }
-    strncpy(parts->host, pos, host_len);
+    if (host_len == 0 || host_len >= sizeof(parts->host)) {
+        return -1;
+    }
+    memcpy(parts->host, pos, host_len);
     parts->host[host_len] = '\0';
 
     // check for port in host and extract if needed
     char *colon_pos = strchr(parts->host, ':');
     if (colon_pos) {
+        if (strlen(colon_pos + 1) >= sizeof(parts->port)) {
+            return -1;
+        }
         strcpy(parts->port, colon_pos + 1);
         *colon_pos = '\0';
     }
+    if (parts->port[0] == '\0') {
+        return -1;
+    }
 
     // extract path
     if (slash_pos) {
         size_t path_len = strlen(slash_pos);
-        strncpy(parts->path, slash_pos, path_len);
-        parts->path[path_len] = '\0';
+        if (path_len >= sizeof(parts->path)) {
+            return -1;
+        }
+        memcpy(parts->path, slash_pos, path_len + 1);
     } else {
         strcpy(parts->path, "/");
     }
+    return 0;
 }
 
-// handle extra data/spaces when response is chunked 
-size_t handle_chunked(const char *data, size_t data_len, char **dechunked) {
-    const char *p = data;
-    const char *end = data + data_len;
-    size_t total = 0;
-    *dechunked = malloc(data_len);
-    char *dst = *dechunked;
+// apply the per-step timeout to a socket's blocking sends and receives (SSL_connect/SSL_read included)
+static void set_socket_timeouts(int sock) {
+    struct timeval timeout = { .tv_sec = TRACKER_TIMEOUT_SECONDS, .tv_usec = 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
 
-    while (p < end) {
-        char *chunk;
-        unsigned long size = strtoul(p, &chunk, 16);
-        if (chunk == p || size == 0) {
-            break;
+// connect without waiting longer than the timeout, trying each address the host resolved to
+// returns a blocking socket with send/receive timeouts set, or -1
+static int connect_with_timeout(struct addrinfo *res) {
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock == -1) {
+            continue;
+        }
+        int flags = fcntl(sock, F_GETFL, 0);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+        int status = connect(sock, ai->ai_addr, ai->ai_addrlen);
+        if (status < 0 && errno == EINPROGRESS) {
+            struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+            int error = ETIMEDOUT;
+            socklen_t error_len = sizeof(error);
+            if (poll(&pfd, 1, TRACKER_TIMEOUT_SECONDS * 1000) == 1) {
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len);
+            }
+            status = error == 0 ? 0 : -1;
         }
+        if (status == 0) {
+            fcntl(sock, F_SETFL, flags);
+            set_socket_timeouts(sock);
+            return sock;
+        }
+        close(sock);
+    }
+    return -1;
+}
 
-        p = chunk;
-        if (p + 2 > end || p[0] != '\r' || p[1] != '\n') {
-            break;
+// Resolved tracker addresses by host, port and socket type, shared by the announce threads. getaddrinfo doesn't
+// report DNS TTLs, so answers are kept for TRACKER_DNS_TTL_SECONDS and failures for TRACKER_DNS_NEGATIVE_TTL_SECONDS.
+// Only one thread looks a name up at a time: others asking for it meanwhile wait for that answer.
+typedef struct {
+    char host[sizeof(((struct url_parts *)0)->host)];
+    char port[sizeof(((struct url_parts *)0)->port)];
+    int socktype;
+    bool resolving;
+    time_t expires;                 // 0 for an unused entry
+    int count;                      // Addresses found, 0 if the name didn't resolve
+    struct {
+        int family;
+        int protocol;
+        socklen_t addrlen;
+        struct sockaddr_storage addr;
+    } addresses[TRACKER_DNS_MAX_ADDRESSES];
+} DnsEntry;
+
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_resolved = PTHREAD_COND_INITIALIZER;
+static DnsEntry dns_cache[TRACKER_DNS_CACHE];
+
+// find the entry for a name (must hold dns_lock), or NULL
+static DnsEntry *dns_find(struct url_parts *parts, int socktype) {
+    for (int i = 0; i < TRACKER_DNS_CACHE; i++) {
+        DnsEntry *entry = &dns_cache[i];
+        if (entry->expires != 0 && entry->socktype == socktype && strcmp(entry->host, parts->host) == 0 &&
+            strcmp(entry->port, parts->port) == 0) {
+            return entry;
         }
-        p += 2;
+    }
+    return NULL;
+}
 
-        if (p + size > end) {
-            break;
+// copy an entry's addresses into a list the caller frees with free() (must hold dns_lock), or NULL if it has none
+static struct addrinfo *dns_copy(const DnsEntry *entry) {
+    if (entry->count == 0) {
+        return NULL;
+    }
+    // one block: the list nodes, then the addresses they point to
+    struct addrinfo *list = calloc(entry->count, sizeof(struct addrinfo) + sizeof(struct sockaddr_storage));
+    if (!list) {
+        return NULL;
+    }
+    struct sockaddr_storage *addrs = (struct sockaddr_storage *)(list + entry->count);
+    for (int i = 0; i < entry->count; i++) {
+        memcpy(&addrs[i], &entry->addresses[i].addr, entry->addresses[i].addrlen);
+        list[i].ai_family = entry->addresses[i].family;
+        list[i].ai_socktype = entry->socktype;
+        list[i].ai_protocol = entry->addresses[i].protocol;
+        list[i].ai_addrlen = entry->addresses[i].addrlen;
+        list[i].ai_addr = (struct sockaddr *)&addrs[i];
+        list[i].ai_next = i + 1 < entry->count ? &list[i + 1] : NULL;
+    }
+    return list;
+}
+
+// keep the first TRACKER_DNS_MAX_ADDRESSES addresses getaddrinfo found
+static void dns_fill(DnsEntry *entry, const struct addrinfo *found) {
+    entry->count = 0;
+    for (const struct addrinfo *ai = found; ai && entry->count < TRACKER_DNS_MAX_ADDRESSES; ai = ai->ai_next) {
+        if (ai->ai_addrlen <= sizeof(entry->addresses[0].addr)) {
+            entry->addresses[entry->count].family = ai->ai_family;
+            entry->addresses[entry->count].protocol = ai->ai_protocol;
+            entry->addresses[entry->count].addrlen = ai->ai_addrlen;
+            memcpy(&entry->addresses[entry->count].addr, ai->ai_addr, ai->ai_addrlen);
+            entry->count++;
         }
-        memcpy(dst, p, size);
-        dst   += size;
-        total += size;
+    }
+}
 
-        p += size;
-        if (p + 2 > end || p[0] != '\r' || p[1] != '\n') {
-            break;
+// resolve the tracker host (blocking, so only ever called off the event loop), answering from the cache when it can
+// returns a list to free with free(), or NULL
+static struct addrinfo *resolve(struct url_parts *parts, int socktype) {
+    pthread_mutex_lock(&dns_lock);
+    DnsEntry *entry;
+    while ((entry = dns_find(parts, socktype)) && entry->resolving) {
+        pthread_cond_wait(&dns_resolved, &dns_lock);
+    }
+    if (entry && time(NULL) < entry->expires) {
+        struct addrinfo *res = dns_copy(entry);
+        pthread_mutex_unlock(&dns_lock);
+        if (!res && get_args().debug_mode) {
+            fprintf(stderr, "[TRACKER] Could not resolve %s (cached)\n", parts->host);
+        }
+        return res;
+    }
+    if (!entry) {
+        // take an unused entry, or the one that expires first (never one another thread is filling in)
+        for (int i = 0; i < TRACKER_DNS_CACHE; i++) {
+            DnsEntry *candidate = &dns_cache[i];
+            if (!candidate->resolving && (!entry || candidate->expires < entry->expires)) {
+                entry = candidate;
+            }
+        }
+    }
+    if (entry) {
+        snprintf(entry->host, sizeof(entry->host), "%s", parts->host);
+        snprintf(entry->port, sizeof(entry->port), "%s", parts->port);
+        entry->socktype = socktype;
+        entry->resolving = true;
+        entry->expires = 1;         // Findable (and waited on) while resolving, expired once done unless filled in
+    }
+    pthread_mutex_unlock(&dns_lock);
+
+    struct addrinfo hints = {0}, *found = NULL;
+    hints.ai_socktype = socktype;
+    int status = getaddrinfo(parts->host, parts->port, &hints, &found);
+    if (status != 0) {
+        found = NULL;
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[TRACKER] Could not resolve %s: %s\n", parts->host, gai_strerror(status));
+        }
+    }
+
+    pthread_mutex_lock(&dns_lock);
+    DnsEntry uncached = { .socktype = socktype };
+    DnsEntry *answer = entry ? entry : &uncached;   // Every entry is being filled in by other threads: answer uncached
+    dns_fill(answer, found);
+    if (entry) {
+        entry->expires = time(NULL) + (entry->count > 0 ? TRACKER_DNS_TTL_SECONDS : TRACKER_DNS_NEGATIVE_TTL_SECONDS);
+        entry->resolving = false;
+        pthread_cond_broadcast(&dns_resolved);
+    }
+    struct addrinfo *res = dns_copy(answer);
+    pthread_mutex_unlock(&dns_lock);
+    if (found) {
+        freeaddrinfo(found);
+    }
+    return res;
+}
+
+// drop a cached answer whose addresses didn't work, so the next announce looks the name up again
+static void resolve_forget(struct url_parts *parts, int socktype) {
+    pthread_mutex_lock(&dns_lock);
+    DnsEntry *entry = dns_find(parts, socktype);
+    if (entry && !entry->resolving) {
+        entry->expires = 0;
+    }
+    pthread_mutex_unlock(&dns_lock);
+}
+
+// One TLS context for the whole process, created on first use
+static SSL_CTX *ssl_ctx = NULL;
+static pthread_once_t ssl_ctx_once = PTHREAD_ONCE_INIT;
+
+static void ssl_ctx_init(void) {
+    SSL_library_init();
+    OpenSSL_add_all_algorithms();
+    SSL_load_error_strings();
+    ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (ssl_ctx) {
+        // sessions are kept per tracker below, not in OpenSSL's cache
+        SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    }
+}
+
+// Connections to HTTP(S) trackers, shared by the announce threads. A request takes the tracker's idle keep-alive
+// connection out of the pool and puts it back if the tracker left it open. The last TLS session with each tracker
+// is kept even after its connection closes, so reconnecting resumes it instead of doing a full handshake.
+typedef struct {
+    char tracker[sizeof(((struct url_parts *)0)->protocol) + sizeof(((struct url_parts *)0)->host) +
+        sizeof(((struct url_parts *)0)->port) + 4];    // "protocol://host:port", empty for an unused entry
+    int sock;                       // Idle connection, -1 if there is none
+    SSL *ssl;
+    SSL_SESSION *session;
+    time_t last_used;
+} HttpConnection;
+
+static pthread_mutex_t http_connections_lock = PTHREAD_MUTEX_INITIALIZER;
+static HttpConnection http_connections[TRACKER_HTTP_CONNECTION_CACHE];
+
+static void http_close(int sock, SSL *ssl) {
+    if (ssl) {
+        // mark the connection shut down without sending close_notify: freeing it otherwise makes its session
+        // unusable for resumption
+        SSL_set_quiet_shutdown(ssl, 1);
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+    }
+    if (sock != -1) {
+        close(sock);
+    }
+}
+
+// find the tracker's entry (must hold http_connections_lock), or NULL
+static HttpConnection *http_find_connection(const char *tracker) {
+    for (int i = 0; i < TRACKER_HTTP_CONNECTION_CACHE; i++) {
+        if (strcmp(http_connections[i].tracker, tracker) == 0) {
+            return &http_connections[i];
         }
-        p += 2;
     }
-    
-    return total;
+    return NULL;
 }
 
-// parse bencoded tracker response
-TrackerResponse parse_response(char *buf, size_t buf_len) {
-    TrackerResponse response = {0};
-    // set values to -1 if following data isn't given in response
-    // (complete and incomplete values can be received from scrape request later)
-    response.complete = -1;      
-    response.incomplete = -1;
+// take the tracker's idle connection if it is still open, plus a reference to its last TLS session
+// returns true if conn holds a connection to reuse
+static bool http_take_connection(const char *tracker, HttpConnection *conn) {
+    conn->sock = -1;
+    conn->ssl = NULL;
+    conn->session = NULL;
+    pthread_mutex_lock(&http_connections_lock);
+    HttpConnection *entry = http_find_connection(tracker);
+    if (entry) {
+        conn->sock = entry->sock;
+        conn->ssl = entry->ssl;
+        if (entry->session && SSL_SESSION_up_ref(entry->session)) {
+            conn->session = entry->session;
+        }
+        bool expired = time(NULL) - entry->last_used >= TRACKER_HTTP_KEEPALIVE_SECONDS;
+        entry->sock = -1;
+        entry->ssl = NULL;
+        pthread_mutex_unlock(&http_connections_lock);
+
+        // an idle connection the tracker has closed (or sent something on) polls readable
+        struct pollfd pfd = { .fd = conn->sock, .events = POLLIN };
+        if (conn->sock != -1 && (expired || poll(&pfd, 1, 0) != 0)) {
+            http_close(conn->sock, conn->ssl);
+            conn->sock = -1;
+            conn->ssl = NULL;
+        }
+        return conn->sock != -1;
+    }
+    pthread_mutex_unlock(&http_connections_lock);
+    return false;
+}
 
-    const char *data;
-    for (size_t i = 0; i + 4 <= buf_len; i++) {
-        if (memcmp(buf + i, "\r\n\r\n", 4) == 0) {
-            data = buf + i + 4;
-            break;
+// return a connection after a request: keep it for the next one if the tracker left it open, else close it.
+// Either way remember its TLS session. Frees conn's session reference.
+static void http_release_connection(const char *tracker, HttpConnection *conn, bool keep) {
+    SSL_SESSION *session = conn->ssl ? SSL_get1_session(conn->ssl) : NULL;
+    if (session && !SSL_SESSION_is_resumable(session)) {
+        SSL_SESSION_free(session);
+        session = NULL;
+    }
+    int close_sock = -1;
+    SSL *close_ssl = NULL;
+    pthread_mutex_lock(&http_connections_lock);
+    HttpConnection *entry = http_find_connection(tracker);
+    if (!entry) {
+        // take an unused entry, or the least recently used one
+        entry = &http_connections[0];
+        for (int i = 0; i < TRACKER_HTTP_CONNECTION_CACHE && entry->tracker[0] != '\0'; i++) {
+            if (http_connections[i].tracker[0] == '\0' || http_connections[i].last_used < entry->last_used) {
+                entry = &http_connections[i];
+            }
+        }
+        if (entry->sock != -1 && entry->tracker[0] != '\0') {
+            close_sock = entry->sock;
+            close_ssl = entry->ssl;
+        }
+        if (entry->session) {
+            SSL_SESSION_free(entry->session);
+        }
+        snprintf(entry->tracker, sizeof(entry->tracker), "%s", tracker);
+        entry->sock = -1;
+        entry->ssl = NULL;
+        entry->session = NULL;
+    }
+    if (session) {
+        if (entry->session) {
+            SSL_SESSION_free(entry->session);
+        }
+        entry->session = session;
+    }
+    // another thread may have put back a connection to the same tracker meanwhile: keep just one
+    if (keep && entry->sock == -1) {
+        entry->sock = conn->sock;
+        entry->ssl = conn->ssl;
+    } else {
+        http_close(conn->sock, conn->ssl);
+    }
+    entry->last_used = time(NULL);
+    pthread_mutex_unlock(&http_connections_lock);
+
+    http_close(close_sock, close_ssl);
+    if (conn->session) {
+        SSL_SESSION_free(conn->session);
+    }
+    conn->sock = -1;
+    conn->ssl = NULL;
+    conn->session = NULL;
+}
+
+// close the idle connections and forget the TLS sessions
+static void http_close_connections(void) {
+    pthread_mutex_lock(&http_connections_lock);
+    for (int i = 0; i < TRACKER_HTTP_CONNECTION_CACHE; i++) {
+        HttpConnection *entry = &http_connections[i];
+        if (entry->tracker[0] != '\0') {
+            http_close(entry->sock, entry->ssl);
+            if (entry->session) {
+                SSL_SESSION_free(entry->session);
+            }
+        }
+        memset(entry, 0, sizeof(*entry));
+        entry->sock = -1;
+    }
+    pthread_mutex_unlock(&http_connections_lock);
+}
+
+// open a new connection to the tracker, resuming conn's TLS session if it has one
+static int http_connect(struct url_parts *parts, HttpConnection *conn) {
+    struct addrinfo *res = resolve(parts, SOCK_STREAM);
+    if (!res) {
+        return -1;
+    }
+    conn->sock = connect_with_timeout(res);
+    free(res);
+    if (conn->sock == -1) {
+        resolve_forget(parts, SOCK_STREAM);
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[TRACKER] Could not connect to %s:%s\n", parts->host, parts->port);
         }
+        return -1;
     }
-    size_t data_len = buf_len - (data - buf);
 
-    // handle case where response is chunked
-    char *dechunked = NULL;
-    size_t dechunked_len = 0;
-    if (strstr(buf, "Transfer-Encoding: chunked")) {
-        dechunked_len = handle_chunked(data, data_len, &dechunked);
-        if (dechunked_len > 0) {
-            data = dechunked;
-            data_len = dechunked_len;
+    // support for HTTPS tracker
+    if (strcmp(parts->protocol, "https") == 0) {
+        pthread_once(&ssl_ctx_once, ssl_ctx_init);
+        conn->ssl = ssl_ctx ? SSL_new(ssl_ctx) : NULL;
+        if (conn->ssl && conn->session) {
+            SSL_set_session(conn->ssl, conn->session);
+        }
+        if (!conn->ssl || !SSL_set_fd(conn->ssl, conn->sock) || !SSL_set_tlsext_host_name(conn->ssl, parts->host) ||
+            SSL_connect(conn->ssl) <= 0) {
+            if (get_args().debug_mode) {
+                fprintf(stderr, "[TRACKER] TLS handshake with %s failed: %s\n", parts->host, ERR_error_string(ERR_get_error(), NULL));
+            }
+            http_close(conn->sock, conn->ssl);
+            conn->sock = -1;
+            conn->ssl = NULL;
+            return -1;
+        }
+        if (get_args().debug_mode && SSL_session_reused(conn->ssl)) {
+            fprintf(stderr, "[TRACKER] Resumed TLS session with %s\n", parts->host);
         }
     }
+    return 0;
+}
 
-    bencode_t ben, ben_item;
-    bencode_init(&ben, data, (int) data_len);
-    const char *key;
-    int key_len;
+// SSL_write without SIGPIPE (which would end the process) if the tracker has closed the connection
+static bool ssl_write_all(SSL *ssl, const char *data, int len) {
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    bool sent = SSL_write(ssl, data, len) == len;
+    struct timespec no_wait = {0};
+    while (sigtimedwait(&pipe_set, NULL, &no_wait) > 0) {
+        // discard the SIGPIPE raised while it was blocked
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return sent;
+}
 
-    while (bencode_dict_has_next(&ben)) {
-        if (!bencode_dict_get_next(&ben, &ben_item, &key, &key_len)) {
+// send a request on conn and read the response until its framing says it is complete
+// returns 0 with the receive buffer (free it) and where the NUL terminated body sits in it, -1 on failure,
+// or -2 if the connection was closed before any response
+static int http_exchange(HttpConnection *conn, const char *req, int req_len, char **buf_out, size_t *body_start,
+        size_t *body_len, bool *keep_alive) {
+    bool sent;
+    if (conn->ssl) {
+        sent = ssl_write_all(conn->ssl, req, req_len);
+    } else {
+        sent = send(conn->sock, req, req_len, MSG_NOSIGNAL) == req_len;
+    }
+    if (!sent) {
+        return -2;
+    }
+
+    // receive until the response is complete, giving up once the deadline passes
+    // the parser works on the receive buffer itself, so the body is never copied out of it
+    HttpResponseParser parser;
+    http_parser_init(&parser);
+    size_t len = 0, max_len = 4096;
+    char *buf = malloc(max_len);
+    time_t deadline = time(NULL) + TRACKER_TIMEOUT_SECONDS;
+    int status = -1;
+    while (buf) {
+        int parsed = http_parser_feed(&parser, buf, &len);
+        if (parsed != 0) {
+            status = parsed > 0 ? 0 : -1;
             break;
         }
-        if (key_len == 8 && strncmp(key, "interval", 8) == 0 && bencode_is_int(&ben_item)) {
-            long interval;
-            bencode_int_value(&ben_item, &interval);
-            response.interval = interval;
-        } else if (key_len == 8 && strncmp(key, "complete", 8) == 0 && bencode_is_int(&ben_item)) {
-            long complete;
-            bencode_int_value(&ben_item, &complete);
-            response.complete = complete;
-        } else if (key_len == 10 && strncmp(key, "incomplete", 10) == 0 && bencode_is_int(&ben_item)) {
-            long incomplete;
-            bencode_int_value(&ben_item, &incomplete);
-            response.incomplete = incomplete;
-        // binary model peers
-        } else if (key_len == 5 && strncmp(key, "peers", 5) == 0 && bencode_is_string(&ben_item)) {
-            const char *peers;
-            int len;
-            bencode_string_value(&ben_item, &peers, &len);
-            int num_peers = len / 6;
-            response.num_peers = num_peers;
-            response.peers = calloc(num_peers, sizeof(Peer));
-            for (int i = 0; i < num_peers; i++) {
-                unsigned char *pos = (unsigned char *)(peers + (i * 6));
-                uint32_t addr;
-                memcpy(&addr, pos, sizeof(addr));
-                response.peers[i].address = ntohl(addr);
-                uint16_t port;
-                memcpy(&port, pos + 4, sizeof(port));
-                response.peers[i].port = ntohs(port);
+        // once the headers give the length, size the buffer for the whole response in one go
+        size_t wanted = http_parser_expected_size(&parser) + 1;
+        if (wanted > max_len || len + 1 >= max_len) {
+            size_t new_len = wanted > max_len ? wanted : max_len * 2;
+            if (max_len >= TRACKER_MAX_RESPONSE_BYTES || wanted > TRACKER_MAX_RESPONSE_BYTES) {
+                break;
             }
-        // dictionary model peers
-        } else if (key_len == 5 && strncmp(key, "peers", 5) == 0 && bencode_is_list(&ben_item)) {
-            bencode_t peers = ben_item;
-            int num_peers = 0;
-            while (bencode_list_has_next(&peers)) {
-                bencode_t peer;
-                bencode_list_get_next(&peers, &peer);
-                num_peers++;
+            if (new_len > TRACKER_MAX_RESPONSE_BYTES) {
+                new_len = TRACKER_MAX_RESPONSE_BYTES;
             }
-            response.num_peers = num_peers;
-            response.peers = calloc(num_peers, sizeof(Peer));
-
-            peers = ben_item;
-            int i = 0;
-            while (bencode_list_has_next(&peers)) {
-                bencode_t peer;
-                bencode_list_get_next(&peers, &peer);
-                while (bencode_dict_has_next(&peer)) {
-                    bencode_t field;
-                    const char *field_key;
-                    int field_key_len;
-                    bencode_dict_get_next(&peer, &field, &field_key, &field_key_len);
-                    // ip address
-                    if (field_key_len == 2 && strncmp(field_key, "ip", 2) == 0 && bencode_is_string(&field)) {
-                        const char *ip_string;
-                        int ip_len;
-                        bencode_string_value(&field, &ip_string, &ip_len);
-                        char addr_buf[16] = {0};
-                        memcpy(addr_buf, ip_string, ip_len);
-                        struct in_addr addr;
-                        inet_aton(addr_buf, &addr);
-                        response.peers[i].address = ntohl(addr.s_addr);
-                    }
-                    // port
-                    if (field_key_len == 4 && strncmp(field_key, "port", 4) == 0 && bencode_is_int(&field)) {
-                        long port;
-                        bencode_int_value(&field, &port);
-                        response.peers[i].port = (uint16_t) port;
-                    }
-                }
-                i++;
+            char *grown = realloc(buf, new_len);
+            if (!grown) {
+                break;
             }
+            buf = grown;
+            max_len = new_len;
+        }
+        int bytes_read;
+        if (conn->ssl) {
+            bytes_read = SSL_read(conn->ssl, buf + len, max_len - len - 1);
+        } else {
+            bytes_read = recv(conn->sock, buf + len, max_len - len - 1, 0);
+        }
+        if (bytes_read <= 0) {
+            // a receive timeout means the tracker went quiet, anything else is the end of the connection
+            bool timed_out = bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            if (!timed_out && len == 0) {
+                status = -2;
+            } else if (!timed_out && http_parser_finish(&parser) > 0) {
+                status = 0;
+            }
+            break;
+        }
+        len += bytes_read;
+        if (time(NULL) >= deadline) {
+            break;
+        }
+    }
+    if (status != 0) {
+        free(buf);
+        return status;
+    }
+    buf[parser.body_start + parser.body_len] = '\0';
+    *buf_out = buf;
+    *body_start = parser.body_start;
+    *body_len = parser.body_len;
+    *keep_alive = parser.keep_alive;
+    return 0;
+}
+
+// send a GET for target (path and query) over HTTP or HTTPS and read the response body
+// reuses the tracker's keep-alive connection when there is one, and retries on a new connection if it turns out
+// the tracker had closed it
+// returns the receive buffer (free it) with body pointing at the NUL terminated body inside it, or NULL if the
+// tracker couldn't be reached or stopped answering
+static char *http_request(struct url_parts *parts, const char *target, const char **body, size_t *body_len) {
+    char tracker[sizeof(((HttpConnection *)0)->tracker)];
+    snprintf(tracker, sizeof(tracker), "%s://%s:%s", parts->protocol, parts->host, parts->port);
+
+    // build entire GET request (sized for the target, which a batched scrape makes long)
+    size_t req_cap = strlen(target) + strlen(parts->host) + 64;
+    char *req = malloc(req_cap);
+    int num = req ? snprintf(req, req_cap,
+        "GET %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Connection: keep-alive\r\n\r\n",
+        target, parts->host) : -1;
+    if (num < 0 || num >= (int)req_cap) {
+        free(req);
+        return NULL;
+    }
+
+    char *buf = NULL;
+    size_t body_start = 0;
+    int status = -1;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        HttpConnection conn;
+        bool reused = http_take_connection(tracker, &conn);
+        if (!reused && http_connect(parts, &conn) != 0) {
+            http_release_connection(tracker, &conn, false);
+            free(req);
+            return NULL;
         }
+        bool keep_alive = false;
+        status = http_exchange(&conn, req, num, &buf, &body_start, body_len, &keep_alive);
+        http_release_connection(tracker, &conn, status == 0 && keep_alive);
+        if (status != -2 || !reused) {
+            break;
+        }
+    }
+    free(req);
+
+    if (status != 0 && get_args().debug_mode) {
+        fprintf(stderr, "[TRACKER] No response from %s within %d s\n", parts->host, TRACKER_TIMEOUT_SECONDS);
+    }
+    if (status != 0) {
+        return NULL;
     }
-    
-    free(dechunked);
-    return response;
+    *body = buf + body_start;
+    return buf;
 }
 
 // send HTTP or HTTPS GET request
-TrackerResponse http_get(struct url_parts *parts, unsigned char *info_hash, unsigned char *peer_id, 
-        int port, long uploaded, long downloaded, long left) {
+int http_get(TrackerResponse *response, struct url_parts *parts, unsigned char *info_hash, unsigned char *peer_id, 
+        int port, long uploaded, long downloaded, long left, int numwant) {
     char *encoded_hash = encode_bin_data(info_hash, 20);
     char *encoded_id = encode_bin_data(peer_id, 20);
 
     // set parameters for request
     char params[1024];
-    snprintf(params, sizeof(params), 
+    int params_len = snprintf(params, sizeof(params), 
         "%s?info_hash=%s&peer_id=%s&port=%d&uploaded=%ld&downloaded=%ld&left=%ld&compact=1",
         parts->path, encoded_hash, encoded_id, port, uploaded, downloaded, left);
+    if (numwant >= 0 && params_len > 0 && (size_t)params_len < sizeof(params)) {
+        snprintf(params + params_len, sizeof(params) - params_len, "&numwant=%d", numwant);
+    }
 
     free(encoded_hash);
     free(encoded_id);
 
-    struct addrinfo hints = {0}, *res;
-    hints.ai_socktype = SOCK_STREAM;
-    getaddrinfo(parts->host, parts->port, &hints, &res);
-
-    // create a socket and connect to tracker 
-    int sock = socket(res->ai_family, SOCK_STREAM, res->ai_protocol);
-    if (sock == -1) {
-        perror("Socket creation failed");
-        freeaddrinfo(res);
-        exit(1);
+    const char *body;
+    size_t len;
+    char *buf = http_request(parts, params, &body, &len);
+    if (!buf) {
+        return -1;
     }
-    if (connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
-        close(sock);
-        perror("Connection failed");
-        freeaddrinfo(res);
-        exit(1);
+    int status = parse_response(response, body, len);
+    free(buf);
+    return status;
+}
+
+// UDP tracker protocol (BEP 15)
+#define UDP_PROTOCOL_ID 0x41727101980ULL
+#define UDP_ACTION_CONNECT 0
+#define UDP_ACTION_ANNOUNCE 1
+#define UDP_ACTION_SCRAPE 2
+#define UDP_ACTION_ERROR 3
+
+// Connection IDs by tracker, shared by the announce threads. A tracker accepts one for a minute after handing
+// it out, so announcing again within that time skips the connect round trip.
+typedef struct {
+    char tracker[sizeof(((struct url_parts *)0)->host) + sizeof(((struct url_parts *)0)->port) + 1];
+    uint64_t connection_id_be;
+    time_t obtained;
+} UdpConnection;
+
+static pthread_mutex_t udp_connections_lock = PTHREAD_MUTEX_INITIALIZER;
+static UdpConnection udp_connections[TRACKER_UDP_CONNECTION_CACHE];
+
+static bool udp_cached_connection(const char *tracker, uint64_t *connection_id_be) {
+    bool found = false;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&udp_connections_lock);
+    for (int i = 0; i < TRACKER_UDP_CONNECTION_CACHE && !found; i++) {
+        UdpConnection *connection = &udp_connections[i];
+        if (connection->obtained != 0 && strcmp(connection->tracker, tracker) == 0 &&
+            now - connection->obtained < TRACKER_UDP_CONNECTION_TTL) {
+            *connection_id_be = connection->connection_id_be;
+            found = true;
+        }
     }
-    freeaddrinfo(res);
+    pthread_mutex_unlock(&udp_connections_lock);
+    return found;
+}
 
-    // support for HTTPS tracker
-    SSL_CTX *ctx = NULL;
-    SSL *ssl = NULL;
-    if (strcmp(parts->protocol, "https") == 0) {
-        SSL_library_init();
-        OpenSSL_add_all_algorithms();
-        SSL_load_error_strings();
-
-        ctx = SSL_CTX_new(TLS_client_method());
-        ssl = SSL_new(ctx);
-        SSL_set_fd(ssl, sock);
-        if (!SSL_set_tlsext_host_name(ssl, parts->host)) {
-            fprintf(stderr, "Failed to set SNI to %s\n", parts->host);
-            SSL_free(ssl);
-            SSL_CTX_free(ctx);
-            close(sock);
-            exit(1);
+// remember a connection ID (obtained = 0 forgets the tracker's), replacing its old one or the oldest entry
+static void udp_cache_connection(const char *tracker, uint64_t connection_id_be, time_t obtained) {
+    pthread_mutex_lock(&udp_connections_lock);
+    UdpConnection *slot = &udp_connections[0];
+    for (int i = 0; i < TRACKER_UDP_CONNECTION_CACHE; i++) {
+        if (strcmp(udp_connections[i].tracker, tracker) == 0) {
+            slot = &udp_connections[i];
+            break;
         }
-        if (SSL_connect(ssl) <= 0) {
-            unsigned long err = ERR_get_error();                           
-            fprintf(stderr, "SSL_connect error: %s\n", ERR_error_string(err, NULL)); 
-            SSL_free(ssl);
-            SSL_CTX_free(ctx);
-            close(sock);
-            exit(1);
+        if (udp_connections[i].obtained < slot->obtained) {
+            slot = &udp_connections[i];
         }
     }
+    snprintf(slot->tracker, sizeof(slot->tracker), "%s", tracker);
+    slot->connection_id_be = connection_id_be;
+    slot->obtained = obtained;
+    pthread_mutex_unlock(&udp_connections_lock);
+}
 
-    // build entire GET request
-    char req[2048];
-    int num = snprintf(req, sizeof(req),
-        "GET %s HTTP/1.1\r\n"
-        "Host: %s\r\n"
-        "Connection: close\r\n\r\n",
-        params, parts->host);
+// unpredictable 32 bits from the kernel, for values that mustn't be guessable or repeat across runs (rand() is
+// never seeded, so it gives every client the same sequence)
+static uint32_t random_u32(void) {
+    uint32_t value;
+    if (getrandom(&value, sizeof(value), 0) == sizeof(value)) return value;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint32_t)now.tv_nsec ^ ((uint32_t)now.tv_sec << 12) ^ ((uint32_t)getpid() << 20);
+}
 
-    if (ssl) {
-        SSL_write(ssl, req, num);
-    } else {
-        send(sock, req, strlen(req), 0);
+// key sent with announces: random, but the same for the whole run so the tracker can recognize us across address changes
+static uint32_t announce_key(void) {
+    static uint32_t key = 0;
+    pthread_mutex_lock(&udp_connections_lock);
+    while (key == 0) {
+        key = random_u32();
     }
+    uint32_t value = key;
+    pthread_mutex_unlock(&udp_connections_lock);
+    return value;
+}
 
-    // receive request  
-    size_t len = 0, max_len = 4096;
-    char *res_buf = malloc(max_len);
-    while (1) {
-        int bytes_read;
-        if (len >= max_len) {
-            max_len *= 2;
-            res_buf = realloc(res_buf, max_len);
+// open a UDP socket connected to the tracker, so only its datagrams are received
+static int udp_open(struct url_parts *parts) {
+    struct addrinfo *res = resolve(parts, SOCK_DGRAM);
+    if (!res) {
+        return -1;
+    }
+    int sock = -1;
+    for (struct addrinfo *ai = res; ai && sock == -1; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, SOCK_DGRAM, ai->ai_protocol);
+        if (sock != -1 && connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(sock);
+            sock = -1;
         }
-        if (ssl) {
-            bytes_read = SSL_read(ssl, res_buf + len, max_len - len);
-        } else {
-            bytes_read = recv(sock, res_buf + len, max_len - len, 0);
+    }
+    free(res);
+    return sock;
+}
+
+// wait up to timeout_ms for the reply carrying action and transaction_id, skipping stray datagrams
+// returns the reply length, -1 on timeout, or -2 if the tracker sent an error or isn't listening
+static ssize_t udp_receive(int sock, uint8_t *reply, size_t reply_cap, uint32_t action, uint32_t transaction_id, int timeout_ms) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int remaining_ms = timeout_ms;
+    while (remaining_ms > 0) {
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        int ready = poll(&pfd, 1, remaining_ms);
+        if (ready < 0 && errno != EINTR) {
+            return -2;
         }
-        if (bytes_read <= 0) {
-            break;
+        if (ready > 0) {
+            ssize_t bytes_read = recv(sock, reply, reply_cap, MSG_DONTWAIT);
+            if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return -2;      // e.g. ECONNREFUSED: nothing listens on the tracker's port
+            }
+            if (bytes_read >= 8) {
+                uint32_t reply_action, reply_transaction;
+                memcpy(&reply_action, reply, 4);
+                memcpy(&reply_transaction, reply + 4, 4);
+                if (ntohl(reply_transaction) == transaction_id) {
+                    if (ntohl(reply_action) == action) {
+                        return bytes_read;
+                    }
+                    if (ntohl(reply_action) == UDP_ACTION_ERROR && get_args().debug_mode) {
+                        fprintf(stderr, "[TRACKER] UDP tracker error: %.*s\n", (int)(bytes_read - 8), (const char *)reply + 8);
+                    }
+                    return -2;
+                }
+            }
         }
-        len += bytes_read;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining_ms = timeout_ms - (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
     }
-    res_buf[len] = '\0';
+    return -1;
+}
 
-    // free sockets and SSL
-    if (ssl) {
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
+// send an announce or scrape and wait for its reply, connecting first unless a live connection ID is cached.
+// Bytes 0-7 (connection ID) and 12-15 (transaction ID) of request are filled in here. A step that goes
+// unanswered is retried after 15 * 2^n seconds (BEP 15), reconnecting if the connection ID has expired meanwhile.
+// returns the reply length, or -1
+static ssize_t udp_request(int sock, const char *tracker, uint8_t *request, size_t request_len, uint32_t action,
+        uint8_t *reply, size_t reply_cap) {
+    for (int n = 0; n <= TRACKER_UDP_MAX_RETRANSMITS; n++) {
+        int timeout_ms = (TRACKER_UDP_BASE_TIMEOUT * 1000) << n;
+        uint64_t connection_id_be;
+        if (!udp_cached_connection(tracker, &connection_id_be)) {
+            uint8_t connect[16], connect_res[16];
+            uint64_t protocol_id = htobe64(UDP_PROTOCOL_ID);
+            uint32_t connect_action = htonl(UDP_ACTION_CONNECT);
+            uint32_t transaction_id = random_u32();
+            uint32_t transaction_id_be = htonl(transaction_id);
+            memcpy(connect, &protocol_id, 8);
+            memcpy(connect + 8, &connect_action, 4);
+            memcpy(connect + 12, &transaction_id_be, 4);
+            if (send(sock, connect, sizeof(connect), 0) != sizeof(connect)) {
+                return -1;
+            }
+            ssize_t bytes_read = udp_receive(sock, connect_res, sizeof(connect_res), UDP_ACTION_CONNECT, transaction_id, timeout_ms);
+            if (bytes_read == -2) {
+                return -1;
+            }
+            if (bytes_read < 16) {
+                continue;
+            }
+            memcpy(&connection_id_be, connect_res + 8, 8);
+            udp_cache_connection(tracker, connection_id_be, time(NULL));
+        }
+
+        uint32_t transaction_id = random_u32();
+        uint32_t transaction_id_be = htonl(transaction_id);
+        memcpy(request, &connection_id_be, 8);
+        memcpy(request + 12, &transaction_id_be, 4);
+        if (send(sock, request, request_len, 0) != (ssize_t)request_len) {
+            return -1;
+        }
+        ssize_t bytes_read = udp_receive(sock, reply, reply_cap, action, transaction_id, timeout_ms);
+        if (bytes_read >= 0) {
+            return bytes_read;
+        }
+        if (bytes_read == -2) {
+            udp_cache_connection(tracker, 0, 0);    // The tracker may have refused the connection ID: start over next time
+            return -1;
+        }
     }
-    close(sock);
-    
-    TrackerResponse resp = parse_response(res_buf, len);
-    free(res_buf);
-    return resp;
+    return -1;
 }
 
-// TODO: set timeouts according to official protocol
 // send GET request for UDP
-TrackerResponse udp_get(struct url_parts *parts, unsigned char *info_hash, unsigned char *peer_id, 
-        int port, long uploaded, long downloaded, long left) {
-    
-    struct addrinfo hints = {0}, *res;
-    hints.ai_socktype = SOCK_DGRAM;
-    getaddrinfo(parts->host, parts->port, &hints, &res);
-
-    // create a socket and connect to tracker 
-    int sock = socket(res->ai_family, SOCK_DGRAM, res->ai_protocol);
+int udp_get(TrackerResponse *response, struct url_parts *parts, unsigned char *info_hash, unsigned char *peer_id, 
+        int port, long uploaded, long downloaded, long left, int numwant) {
+    int sock = udp_open(parts);
     if (sock == -1) {
-        perror("Socket creation failed");
-        freeaddrinfo(res);
-        exit(1);
-    }
-
-    // send connect request
-    uint8_t connect[16];
-    uint64_t protocol_id = htobe64(0x41727101980);
-    uint32_t action = htonl(0);
-    uint32_t transaction_id = (uint32_t)rand();
-    uint32_t transaction_id_be = htonl(transaction_id);
-    memcpy(connect, &protocol_id, 8);
-    memcpy(connect + 8, &action, 4);
-    memcpy(connect + 12, &transaction_id_be, 4);
-
-    if (sendto(sock, connect, 16, 0, res->ai_addr, res->ai_addrlen) != 16) {
-        perror("Sending connect request failed");
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
-    }
-
-    // receive connect response
-    uint8_t connect_res[16];
-    socklen_t addrlen = res->ai_addrlen;
-    if (recvfrom(sock, connect_res, sizeof(connect_res), 0, res->ai_addr, &addrlen) < 16) {
-        perror("Receiving connect request failed");
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
+        return -1;
     }
+    char tracker[sizeof(((UdpConnection *)0)->tracker)];
+    snprintf(tracker, sizeof(tracker), "%s:%s", parts->host, parts->port);
 
-    uint32_t action_res = ntohl(*(uint32_t*)(connect_res));
-    uint32_t transaction_id_res = ntohl(*(uint32_t*)(connect_res + 4));
-    if (action_res != 0 || transaction_id_res != transaction_id) {
-        fprintf(stderr, "Connect request failed (action=%d, transaction ID=%d)\n", 
-            action_res, transaction_id_res);
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
-    }
-    uint64_t connection_id_be;
-    memcpy(&connection_id_be, connect_res + 8, 8);    
-    // uint64_t connection_id_host = be64toh(connection_id_be);
-
-    // send announce request
-    uint8_t announce[98];
-    action = htonl(1);
-    uint32_t trans_ann = rand();
-    uint32_t trans_ann_be = htonl(trans_ann);
+    // announce request (connection and transaction IDs are filled in by udp_request)
+    uint8_t announce[98] = {0};
+    uint32_t action = htonl(UDP_ACTION_ANNOUNCE);
     uint64_t downloaded_be = htobe64((uint64_t) downloaded);
     uint64_t left_be = htobe64((uint64_t) left);
     uint64_t uploaded_be = htobe64((uint64_t) uploaded);
     uint32_t event = htonl(0);
     uint32_t ip_addr = htonl(0);
-    uint32_t key = htonl((uint32_t) rand());
-    uint32_t num_want = htonl(-1);
+    uint32_t key_be = htonl(announce_key());
+    uint32_t num_want = htonl(numwant >= 0 ? (uint32_t) numwant : (uint32_t) -1);    // -1 asks for the tracker's default
     uint16_t port_be = htons((uint16_t) port);
-    memcpy(announce, &connection_id_be, 8);
     memcpy(announce + 8, &action, 4);
-    memcpy(announce + 12, &trans_ann_be, 4);
     memcpy(announce + 16, info_hash, 20);
     memcpy(announce + 36, peer_id, 20);
     memcpy(announce + 56, &downloaded_be, 8);
@@ -429,38 +877,26 @@ TrackerResponse udp_get(struct url_parts *parts, unsigned char *info_hash, unsig
     memcpy(announce + 72, &uploaded_be, 8);
     memcpy(announce + 80, &event, 4);
     memcpy(announce + 84, &ip_addr, 4);
-    memcpy(announce + 88, &key, 4);
+    memcpy(announce + 88, &key_be, 4);
     memcpy(announce + 92, &num_want, 4);
     memcpy(announce + 96, &port_be, 2);
 
-    if (sendto(sock, announce, 98, 0, res->ai_addr, res->ai_addrlen) < 0) {
-        perror("Sending announce request failed");
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
-    }
-
-    // receive announce response
-    uint8_t announce_res[1600];     // is buffer size okay??
-    int bytes_read = recvfrom(sock, announce_res, sizeof(announce_res), 0, NULL, NULL);
+    // receive announce response: a full datagram, since the peer list is only limited by the datagram size
+    uint8_t *announce_res = malloc(TRACKER_UDP_MAX_DATAGRAM);
+    ssize_t bytes_read = announce_res ? udp_request(sock, tracker, announce, sizeof(announce), UDP_ACTION_ANNOUNCE,
+        announce_res, TRACKER_UDP_MAX_DATAGRAM) : -1;
+    close(sock);
     if (bytes_read < 20) {
-        perror("Receiving announce request failed");
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[TRACKER] UDP announce to %s failed\n", tracker);
+        }
+        resolve_forget(parts, SOCK_DGRAM);
+        free(announce_res);
+        return -1;
     }
 
     // populate tracker response struct
     TrackerResponse resp = {0};
-    uint32_t action_ann = ntohl(*(uint32_t*)(announce_res));
-    uint32_t trans_id_ann = ntohl(*(uint32_t*)(announce_res + 4));
-    if (action_ann != 1 || trans_id_ann != trans_ann) {
-        fprintf(stderr, "Announce request failed (action=%d, transaction ID=%d)\n", 
-            action_res, trans_id_ann);
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
-    }
     uint32_t interval = ntohl(*(uint32_t*)(announce_res + 8));
     uint32_t incomplete = ntohl(*(uint32_t*)(announce_res + 12));
     uint32_t complete = ntohl(*(uint32_t*)(announce_res + 16));
@@ -472,8 +908,8 @@ TrackerResponse udp_get(struct url_parts *parts, unsigned char *info_hash, unsig
     int peers_len = bytes_read - 20;
     int num_peers = peers_len / 6;
     resp.num_peers = num_peers;
-    resp.peers = calloc(num_peers, sizeof(Peer));
-    for (int i = 0; i < num_peers; i++) {
+    resp.peers = calloc(num_peers + 1, sizeof(PeerEndpoint));
+    for (int i = 0; resp.peers && i < num_peers; i++) {
         int offset = 20 + i * 6;
         uint32_t peer_addr;
         uint16_t peer_port;
@@ -483,86 +919,34 @@ TrackerResponse udp_get(struct url_parts *parts, unsigned char *info_hash, unsig
         resp.peers[i].address = ntohl(peer_addr);
         resp.peers[i].port = ntohs(peer_port);
     }
+    free(announce_res);
 
-    close(sock);
-    freeaddrinfo(res);
-    return resp;
+    *response = resp;
+    return 0;
 }
 
-TrackerResponse tracker_get(char *announce, unsigned char *info_hash, unsigned char *peer_id, 
-        int port, long uploaded, long downloaded, long left) {
+int tracker_get(TrackerResponse *response, const char *announce, unsigned char *info_hash, unsigned char *peer_id, 
+        int port, long uploaded, long downloaded, long left, int numwant) {
     struct url_parts parts = {0};
-    parse_announce(announce, &parts);
+    if (!announce || parse_announce(announce, &parts) != 0) {
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[TRACKER] Unsupported announce URL: %s\n", announce);
+        }
+        return -1;
+    }
 
     if (strcmp(parts.protocol, "udp") == 0) {
-        return udp_get(&parts, info_hash, peer_id, port, uploaded, downloaded, left);
+        return udp_get(response, &parts, info_hash, peer_id, port, uploaded, downloaded, left, numwant);
     } else {
-        return http_get(&parts, info_hash, peer_id, port, uploaded, downloaded, left);
+        return http_get(response, &parts, info_hash, peer_id, port, uploaded, downloaded, left, numwant);
     }
 }
 
-void parse_scrape_response(TrackerResponse *response, char *buf, size_t buf_len) {
-    const char *data;
-    for (size_t i = 0; i + 4 <= buf_len; i++) {
-        if (memcmp(buf + i, "\r\n\r\n", 4) == 0) {
-            data = buf + i + 4;
-            break;
-        }
-    }
-    size_t data_len = buf_len - (data - buf);
-
-    // handle case where response is chunked
-    char *dechunked = NULL;
-    size_t dechunked_len = 0;
-    if (strstr(buf, "Transfer-Encoding: chunked")) {
-        dechunked_len = handle_chunked(data, data_len, &dechunked);
-        if (dechunked_len > 0) {
-            data = dechunked;
-            data_len = dechunked_len;
-        }
-    }
-
-    bencode_t ben, ben_item;
-    bencode_init(&ben, data, (int) data_len);
-    const char *key;
-    int key_len;
-    while (bencode_dict_has_next(&ben)) {
-        bencode_dict_get_next(&ben, &ben_item, &key, &key_len);
-        if (key_len == 5 && strncmp(key, "files", 5) == 0 && bencode_is_dict(&ben_item)) {
-            bencode_t files = ben_item;
-            while (bencode_dict_has_next(&files)) {
-                bencode_t info_entry;
-                const char *info_key;
-                int info_len;
-                bencode_dict_get_next(&files, &info_entry, &info_key, &info_len);
-                bencode_t stats = info_entry;
-                while (bencode_dict_has_next(&stats)) {
-                    bencode_t field;
-                    const char *field_key;
-                    int field_key_len;
-
-                    bencode_dict_get_next(&stats, &field, &field_key, &field_key_len);
-                    if (field_key_len == 8 && strncmp(field_key, "complete", 8) == 0 && bencode_is_int(&field)) {
-                        long complete;
-                        bencode_int_value(&field, &complete);
-                        response->complete = complete;
-                    } else if (field_key_len == 10 && strncmp(field_key, "incomplete", 10) == 0 && bencode_is_int(&field)) {
-                        long incomplete;
-                        bencode_int_value(&field, &incomplete);
-                        response->incomplete = incomplete;
-                    }
-                }
-            }
-        }
-        break;
-    }
-    free(dechunked);
-}
-
-// tracker scrape convention for HTTP(S)
-int http_scrape(TrackerResponse *response, struct url_parts *parts, unsigned char *info_hash) {
+// tracker scrape convention for HTTP(S): one request with an info_hash parameter per torrent
+int http_scrape(struct url_parts *parts, const unsigned char (*info_hashes)[20], int count, ScrapeResult *results) {
     char scrape_path[128];
-    strncpy(scrape_path, parts->path, sizeof(scrape_path));
+    strncpy(scrape_path, parts->path, sizeof(scrape_path) - 1);
+    scrape_path[sizeof(scrape_path) - 1] = '\0';
     char *to_replace = strstr(scrape_path, "announce");
     // scrape convention is not supported 
     if (!to_replace) {
@@ -573,220 +957,342 @@ int http_scrape(TrackerResponse *response, struct url_parts *parts, unsigned cha
     memcpy(to_replace, "scrape", strlen("scrape"));
 
     // set parameters for request
-    char *encoded_hash = encode_bin_data(info_hash, 20);
-    char params[1024];
-    snprintf(params, sizeof(params), "%s?info_hash=%s", scrape_path, encoded_hash);
-    free(encoded_hash);
-
-    struct addrinfo hints = {0}, *res;
-    hints.ai_socktype = SOCK_STREAM;
-    getaddrinfo(parts->host, parts->port, &hints, &res);
-
-    // create a socket and connect to tracker 
-    int sock = socket(res->ai_family, SOCK_STREAM, res->ai_protocol);
-    if (sock == -1) {
-        perror("Socket creation failed");
-        freeaddrinfo(res);
+    size_t params_cap = strlen(scrape_path) + count * (strlen("&info_hash=") + 20 * 3) + 1;
+    char *params = malloc(params_cap);
+    if (!params) {
         return -1;
     }
-    if (connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
-        close(sock);
-        perror("Connection failed");
-        freeaddrinfo(res);
+    size_t params_len = snprintf(params, params_cap, "%s", scrape_path);
+    for (int i = 0; i < count; i++) {
+        char *encoded_hash = encode_bin_data((unsigned char *)info_hashes[i], 20);
+        params_len += snprintf(params + params_len, params_cap - params_len, "%cinfo_hash=%s", i == 0 ? '?' : '&', encoded_hash);
+        free(encoded_hash);
+    }
+
+    const char *body;
+    size_t len;
+    char *buf = http_request(parts, params, &body, &len);
+    free(params);
+    if (!buf) {
         return -1;
     }
-    freeaddrinfo(res);
 
-    // support for HTTPS tracker
-    SSL_CTX *ctx = NULL;
-    SSL *ssl = NULL;
-    if (strcmp(parts->protocol, "https") == 0) {
-        SSL_library_init();
-        OpenSSL_add_all_algorithms();
-        SSL_load_error_strings();
-
-        ctx = SSL_CTX_new(TLS_client_method());
-        ssl = SSL_new(ctx);
-        SSL_set_fd(ssl, sock);
-        if (!SSL_set_tlsext_host_name(ssl, parts->host)) {
-            fprintf(stderr, "Failed to set SNI to %s\n", parts->host);
-            SSL_free(ssl);
-            SSL_CTX_free(ctx);
+    // parse response here 
+    parse_scrape_response(body, len, info_hashes, count, results);
+    free(buf);
+    return 0;
+}
+
+// tracker scrape convention for UDP: up to TRACKER_UDP_SCRAPE_MAX torrents per request
+int udp_scrape(struct url_parts *parts, const unsigned char (*info_hashes)[20], int count, ScrapeResult *results) {
+    int sock = udp_open(parts);
+    if (sock == -1) {
+        return -1;
+    }
+    char tracker[sizeof(((UdpConnection *)0)->tracker)];
+    snprintf(tracker, sizeof(tracker), "%s:%s", parts->host, parts->port);
+
+    for (int first = 0; first < count; first += TRACKER_UDP_SCRAPE_MAX) {
+        int batch = count - first < TRACKER_UDP_SCRAPE_MAX ? count - first : TRACKER_UDP_SCRAPE_MAX;
+
+        // scrape request (connection and transaction IDs are filled in by udp_request)
+        uint8_t scrape[16 + 20 * TRACKER_UDP_SCRAPE_MAX] = {0};
+        uint32_t action = htonl(UDP_ACTION_SCRAPE);
+        memcpy(scrape + 8, &action, 4);
+        memcpy(scrape + 16, info_hashes[first], 20 * batch);
+
+        // receive scrape response: seeders, completed, leechers for each torrent in request order
+        uint8_t resp[8 + 12 * TRACKER_UDP_SCRAPE_MAX];
+        ssize_t bytes_read = udp_request(sock, tracker, scrape, 16 + 20 * batch, UDP_ACTION_SCRAPE, resp, sizeof(resp));
+        if (bytes_read < 8 + 12) {
+            if (get_args().debug_mode) {
+                fprintf(stderr, "[TRACKER] UDP scrape of %s failed\n", tracker);
+            }
+            resolve_forget(parts, SOCK_DGRAM);
             close(sock);
             return -1;
         }
-        if (SSL_connect(ssl) <= 0) {
-            unsigned long err = ERR_get_error();                           
-            fprintf(stderr, "SSL_connect error: %s\n", ERR_error_string(err, NULL)); 
-            SSL_free(ssl);
-            SSL_CTX_free(ctx);
-            close(sock);
-            return -1;
+        for (int i = 0; i < batch && 8 + 12 * (i + 1) <= bytes_read; i++) {
+            uint32_t stats[3];
+            memcpy(stats, resp + 8 + 12 * i, sizeof(stats));
+            results[first + i].complete = ntohl(stats[0]);
+            results[first + i].downloaded = ntohl(stats[1]);
+            results[first + i].incomplete = ntohl(stats[2]);
         }
     }
+    close(sock);
+    return 0;
+}
 
-    // build entire GET request
-    char req[2048];
-    int num = snprintf(req, sizeof(req),
-        "GET %s HTTP/1.1\r\n"
-        "Host: %s\r\n"
-        "Connection: close\r\n\r\n",
-        params, parts->host);
+int tracker_scrape(const char *announce, const unsigned char (*info_hashes)[20], int count, ScrapeResult *results) {
+    for (int i = 0; i < count; i++) {
+        results[i] = (ScrapeResult){ .complete = -1, .downloaded = -1, .incomplete = -1 };
+    }
+    struct url_parts parts = {0};
+    if (!announce || count <= 0 || parse_announce(announce, &parts) != 0) {
+        return -1;
+    }
 
-    if (ssl) {
-        SSL_write(ssl, req, num);
+    if (strcmp(parts.protocol, "udp") == 0) {
+        return udp_scrape(&parts, info_hashes, count, results);
     } else {
-        send(sock, req, strlen(req), 0);
+        return http_scrape(&parts, info_hashes, count, results);
     }
+}
 
-    // receive request  
-    size_t len = 0, max_len = 4096;
-    char *res_buf = malloc(max_len);
+int scrape(TrackerResponse *response, const char *announce, unsigned char *info_hash) {
+    ScrapeResult result;
+    if (tracker_scrape(announce, (const unsigned char (*)[20])info_hash, 1, &result) != 0) {
+        return -1;
+    }
+    if (result.complete >= 0) {
+        response->complete = result.complete;
+    }
+    if (result.incomplete >= 0) {
+        response->incomplete = result.incomplete;
+    }
+    return 0;
+}
+
+// Announces run on helper threads so a slow or dead tracker never stalls peer I/O. The event loop queues jobs
+// tagged with the caller's tracker ID, the threads run tracker_get (or tracker_scrape), and the event loop polls
+// the results.
+typedef struct {
+    int tag;
+    bool scrape;                    // Scrape the tracker instead of announcing
+    char *announce;
+    unsigned char info_hash[20];
+    unsigned char peer_id[20];
+    int port;
+    long uploaded, downloaded, left;
+    int numwant;
+} AnnounceJob;
+
+typedef struct {
+    int tag;
+    int status;
+    TrackerResponse response;
+} AnnounceResult;
+
+// Queued jobs and finished results, both guarded by announce_lock. Arrays grow on demand.
+static pthread_mutex_t announce_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t announce_available = PTHREAD_COND_INITIALIZER;
+static AnnounceJob *pending = NULL;
+static size_t pending_count = 0, pending_capacity = 0;
+static AnnounceResult *completed = NULL;
+static size_t completed_count = 0, completed_capacity = 0;
+static bool thread_busy[TRACKER_MAX_THREADS];  // Thread is waiting on a tracker outside the lock
+static bool stopping = false;
+
+static pthread_t announce_threads[TRACKER_MAX_THREADS];
+static int num_threads = 0;                 // Only the event loop starts threads
+static int in_flight = 0;                   // Submitted, result not yet polled (event loop only)
+
+static bool grow(void **array, size_t *capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) return true;
+    size_t new_capacity = *capacity ? *capacity * 2 : 8;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *grown = realloc(*array, new_capacity * element_size);
+    if (!grown) return false;
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static int run_job(const AnnounceJob *job, TrackerResponse *response) {
+    if (!job->scrape) {
+        return tracker_get(response, job->announce, (unsigned char *)job->info_hash, (unsigned char *)job->peer_id,
+            job->port, job->uploaded, job->downloaded, job->left, job->numwant);
+    }
+    ScrapeResult result;
+    if (tracker_scrape(job->announce, &job->info_hash, 1, &result) != 0 || result.complete < 0) {
+        return -1;
+    }
+    response->complete = result.complete;
+    response->incomplete = result.incomplete;
+    return 0;
+}
+
+static void *announce_main(void *arg) {
+    int thread_index = (int)(intptr_t)arg;
+    pthread_mutex_lock(&announce_lock);
     while (1) {
-        int bytes_read;
-        if (len >= max_len) {
-            max_len *= 2;
-            res_buf = realloc(res_buf, max_len);
+        while (pending_count == 0 && !stopping) {
+            pthread_cond_wait(&announce_available, &announce_lock);
         }
-        if (ssl) {
-            bytes_read = SSL_read(ssl, res_buf + len, max_len - len);
-        } else {
-            bytes_read = recv(sock, res_buf + len, max_len - len, 0);
-        }
-        if (bytes_read <= 0) {
+        if (stopping) break;
+
+        AnnounceJob job = pending[0];       // The thread owns job.announce from here on
+        memmove(pending, pending + 1, (--pending_count) * sizeof(AnnounceJob));
+        thread_busy[thread_index] = true;
+        pthread_mutex_unlock(&announce_lock);
+
+        AnnounceResult result = { .tag = job.tag };
+        result.status = run_job(&job, &result.response);
+        free(job.announce);
+
+        pthread_mutex_lock(&announce_lock);
+        thread_busy[thread_index] = false;
+        if (stopping) {
+            free_tracker_response(&result.response);
             break;
         }
-        len += bytes_read;
+        completed[completed_count++] = result;      // Room was reserved when the job was submitted
     }
-    res_buf[len] = '\0';
+    pthread_mutex_unlock(&announce_lock);
+    return NULL;
+}
 
-    // free sockets and SSL
-    if (ssl) {
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
+// Start one more announce thread. Called with announce_lock held.
+static int start_thread(void) {
+    int index = num_threads;
+    thread_busy[index] = false;
+    if (pthread_create(&announce_threads[index], NULL, announce_main, (void *)(intptr_t)index) != 0) {
+        if (get_args().debug_mode) perror("[TRACKER] Error pthread_create");
+        return -1;
     }
-    close(sock);
-    
-    // parse response here 
-    parse_scrape_response(response, res_buf, len);
-    free(res_buf);
+    num_threads++;
     return 0;
 }
 
-// tracker scrape convention for UDP
-// TODO: make connection request/response cleaner
-int udp_scrape(TrackerResponse *response, struct url_parts *parts, unsigned char *info_hash) {
-    struct addrinfo hints = {0}, *res;
-    hints.ai_socktype = SOCK_DGRAM;
-    getaddrinfo(parts->host, parts->port, &hints, &res);
+int tracker_client_init(void) {
+    if (num_threads > 0) return 0;
 
-    // create a socket and connect to tracker 
-    int sock = socket(res->ai_family, SOCK_DGRAM, res->ai_protocol);
-    if (sock == -1) {
-        perror("Socket creation failed");
-        freeaddrinfo(res);
-        exit(1);
-    }
-
-    // send connect request
-    uint8_t connect[16];
-    uint64_t protocol_id = htobe64(0x41727101980);
-    uint32_t action = htonl(0);
-    uint32_t transaction_id = (uint32_t)rand();
-    uint32_t transaction_id_be = htonl(transaction_id);
-    memcpy(connect, &protocol_id, 8);
-    memcpy(connect + 8, &action, 4);
-    memcpy(connect + 12, &transaction_id_be, 4);
-
-    if (sendto(sock, connect, 16, 0, res->ai_addr, res->ai_addrlen) != 16) {
-        perror("Sending connect request failed");
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
+    stopping = false;
+    pending_count = 0;
+    completed_count = 0;
+    in_flight = 0;
+    pthread_mutex_lock(&announce_lock);
+    for (int i = 0; i < TRACKER_THREADS; i++) {
+        if (start_thread() != 0) break;
     }
+    pthread_mutex_unlock(&announce_lock);
+    if (num_threads == 0) return -1;
+    if (get_args().debug_mode) fprintf(stderr, "[TRACKER] Started %d announce threads.\n", num_threads);
+    return 0;
+}
 
-    // receive connect response
-    uint8_t connect_res[16];
-    socklen_t addrlen = res->ai_addrlen;
-    if (recvfrom(sock, connect_res, sizeof(connect_res), 0, res->ai_addr, &addrlen) < 16) {
-        perror("Receiving connect request failed");
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
-    }
-    uint32_t action_res = ntohl(*(uint32_t*)(connect_res));
-    uint32_t transaction_id_res = ntohl(*(uint32_t*)(connect_res + 4));
-    if (action_res != 0 || transaction_id_res != transaction_id) {
-        fprintf(stderr, "Connect request failed (action=%d, transaction ID=%d)\n", 
-            action_res, transaction_id_res);
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
+void tracker_client_destroy(void) {
+    pthread_mutex_lock(&announce_lock);
+    stopping = true;
+    for (size_t i = 0; i < pending_count; i++) {
+        free(pending[i].announce);
     }
-    uint64_t connection_id_be;
-    memcpy(&connection_id_be, connect_res + 8, 8);
-    // uint64_t connection_id_host = be64toh(connection_id_be);
-
-    // send scrape request
-    uint8_t scrape[16 + 20];
-    action = htonl(2);
-    uint32_t scrape_trans_id = rand();
-    uint32_t scrape_trans_id_be = htonl(scrape_trans_id);
-    memcpy(scrape, &connection_id_be, 8);
-    memcpy(scrape + 8, &action, 4);
-    memcpy(scrape + 12, &scrape_trans_id_be, 4);
-    memcpy(scrape + 16, info_hash, 20);
-
-    if (sendto(sock, scrape, 16 + 20, 0, res->ai_addr, res->ai_addrlen) < 0) {
-        perror("Sending scrape request failed");
-        close(sock);
-        freeaddrinfo(res);
-        return -1;
+    for (size_t i = 0; i < completed_count; i++) {
+        free_tracker_response(&completed[i].response);
+    }
+    pending_count = 0;
+    completed_count = 0;
+    bool busy[TRACKER_MAX_THREADS];
+    memcpy(busy, thread_busy, sizeof(busy));
+    int started = num_threads;
+    pthread_cond_broadcast(&announce_available);
+    pthread_mutex_unlock(&announce_lock);
+    http_close_connections();
+
+    // Don't hold up shutdown for trackers that aren't answering: those threads drop their result when they finish
+    for (int i = 0; i < started; i++) {
+        if (busy[i]) {
+            pthread_detach(announce_threads[i]);
+        } else {
+            pthread_join(announce_threads[i], NULL);
+        }
     }
+    num_threads = 0;
+    in_flight = 0;
+    // The arrays stay allocated: a detached thread may still be finishing up under the lock
+}
 
-    // receive scrape response
-    uint8_t resp[16 + 12];
-    if (recvfrom(sock, resp, 16 + 12, 0, NULL, NULL) < 8) {
-        perror("Receiving scrape response failed");
-        close(sock);
-        freeaddrinfo(res);
-        return -1;
+// Queue a job, or run it inline when there are no announce threads. job->announce is copied.
+static int submit_job(const AnnounceJob *job) {
+    if (!job->announce) return -1;
+
+    pthread_mutex_lock(&announce_lock);
+    // Reserve the result's slot now, so a thread never has to allocate to hand a result back
+    bool ok = grow((void **)&completed, &completed_capacity, in_flight + 1, sizeof(AnnounceResult));
+    if (ok && num_threads == 0) {
+        // No announce threads: run the job inline (blocking) and queue the result as if a thread had
+        pthread_mutex_unlock(&announce_lock);
+        AnnounceResult result = { .tag = job->tag };
+        result.status = run_job(job, &result.response);
+        pthread_mutex_lock(&announce_lock);
+        completed[completed_count++] = result;
+        in_flight++;
+        pthread_mutex_unlock(&announce_lock);
+        return 0;
     }
-    
-    action_res = ntohl(*(uint32_t*)(resp));
-    transaction_id_res = ntohl(*(uint32_t*)(resp + 4));
-    if (action_res != 2 || transaction_id_res != scrape_trans_id) {
-        fprintf(stderr, "Scrape response failed (action=%u tx=%u)\n", action_res, transaction_id_res);
-        close(sock);
-        freeaddrinfo(res);
+    char *announce_copy = ok ? strdup(job->announce) : NULL;
+    if (!announce_copy || !grow((void **)&pending, &pending_capacity, pending_count + 1, sizeof(AnnounceJob))) {
+        pthread_mutex_unlock(&announce_lock);
+        free(announce_copy);
         return -1;
     }
-
-    uint32_t complete = ntohl(*(uint32_t*)(resp + 8));
-    uint32_t incomplete  = ntohl(*(uint32_t*)(resp + 16));
-
-    response->complete = complete;
-    response->incomplete = incomplete;
-    close(sock);
-    freeaddrinfo(res);
+    pending[pending_count] = *job;
+    pending[pending_count++].announce = announce_copy;
+    in_flight++;
+    // A tracker that doesn't answer holds its thread for minutes (UDP retransmits back off to 15 * 2^n seconds), so
+    // rather than have other trackers' jobs queue behind it, start another thread when none is free
+    int idle = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (!thread_busy[i]) idle++;
+    }
+    if ((int)pending_count > idle && num_threads < TRACKER_MAX_THREADS && start_thread() == 0 && get_args().debug_mode) {
+        fprintf(stderr, "[TRACKER] All announce threads busy, started another (%d).\n", num_threads);
+    }
+    pthread_cond_signal(&announce_available);
+    pthread_mutex_unlock(&announce_lock);
     return 0;
 }
 
-int scrape(TrackerResponse *response, char *announce, unsigned char *info_hash) {
-    struct url_parts parts = {0};
-    parse_announce(announce, &parts);
+int tracker_announce_async(int tag, const char *announce, const unsigned char *info_hash, const unsigned char *peer_id,
+        int port, long uploaded, long downloaded, long left, int numwant) {
+    AnnounceJob job = {
+        .tag = tag,
+        .scrape = false,
+        .announce = (char *)announce,
+        .port = port,
+        .uploaded = uploaded,
+        .downloaded = downloaded,
+        .left = left,
+        .numwant = numwant,
+    };
+    memcpy(job.info_hash, info_hash, sizeof(job.info_hash));
+    memcpy(job.peer_id, peer_id, sizeof(job.peer_id));
+    return submit_job(&job);
+}
 
-    if (strcmp(parts.protocol, "udp") == 0) {
-        return udp_scrape(response, &parts, info_hash);
-    } else {
-        return http_scrape(response, &parts, info_hash);
-    }
+int tracker_scrape_async(int tag, const char *announce, const unsigned char *info_hash) {
+    AnnounceJob job = {
+        .tag = tag,
+        .scrape = true,
+        .announce = (char *)announce,
+    };
+    memcpy(job.info_hash, info_hash, sizeof(job.info_hash));
+    return submit_job(&job);
 }
 
-void free_tracker_response(TrackerResponse *response) {
-    if (response->peers) {
-        free(response->peers);
+int tracker_poll_announce(int *tag, TrackerResponse *response) {
+    if (in_flight == 0) return 0;
+
+    pthread_mutex_lock(&announce_lock);
+    int status = 0;
+    if (completed_count > 0) {
+        AnnounceResult result = completed[0];
+        memmove(completed, completed + 1, (--completed_count) * sizeof(AnnounceResult));
+        in_flight--;
+        *tag = result.tag;
+        if (result.status == 0) {
+            *response = result.response;
+            status = 1;
+        } else {
+            free_tracker_response(&result.response);
+            status = -1;
+        }
     }
-    memset(response, 0, sizeof(*response));
-}
\ No newline at end of file
+    pthread_mutex_unlock(&announce_lock);
+    return status;
+}
+
+int tracker_announces_in_flight(void) {
+    return in_flight;
+}
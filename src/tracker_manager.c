@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tracker_manager.h"
+#include "btclient.h"   // For get_args() for debug mode
+
+typedef struct {
+    char *url;
+    int tier;
+    bool in_flight;                 // Announce queued and its result not yet collected
+    bool scrape_in_flight;
+    bool scrape_failed;             // Not scraped again
+} TrackerEntry;
+
+// A BEP 12 tier. Each round walks the tier's trackers in order until one answers, starting the next one early
+// when the current one is slow; the one that answers moves to the front for the next round.
+typedef struct {
+    int *order;                     // Tracker indices, most preferred first
+    int count;
+    bool announcing;                // A round is running and no tracker has answered yet
+    int next_try;                   // Position in order of the next tracker to try this round
+    time_t last_launch;
+    int failures;                   // Consecutive rounds in which every tracker failed
+    time_t next_announce;
+    int numwant;                    // Peers asked for this round
+    time_t last_answer;             // When a tracker in the tier last answered an announce, 0 if never
+    int min_interval;               // From the last answer, 0 if it gave none
+    bool exhausted;                 // The last answer had fewer peers than we asked for
+    int early_rounds;               // Announces made before the interval was up since the last regular one
+    int swarm_size;                 // Seeders plus leechers from the last announce or scrape, -1 if unknown
+    time_t swarm_updated;
+} TrackerTier;
+
+static TrackerEntry *trackers = NULL;
+static int num_trackers = 0;
+static TrackerTier *tiers = NULL;
+static int num_tiers = 0;
+static int *tier_order = NULL;      // Backing store for every tier's order
+
+static unsigned char announce_info_hash[20];
+static unsigned char announce_peer_id[20];
+static int announce_port;
+
+// Scrapes are tagged after the announces: tracker i scrapes with tag num_trackers + i
+#define SCRAPE_TAG(index) (num_trackers + (index))
+
+static int tier_in_flight(const TrackerTier *tier) {
+    int running = 0;
+    for (int i = 0; i < tier->count; i++) {
+        if (trackers[tier->order[i]].in_flight) running++;
+    }
+    return running;
+}
+
+// Move a tracker that answered to the front of its tier, keeping the others in order
+static void promote(TrackerTier *tier, int tracker_index) {
+    for (int i = 0; i < tier->count; i++) {
+        if (tier->order[i] == tracker_index) {
+            memmove(tier->order + 1, tier->order, i * sizeof(int));
+            tier->order[0] = tracker_index;
+            return;
+        }
+    }
+}
+
+// A round in which no tracker answered: retry the tier with exponential backoff
+static void tier_failed(TrackerTier *tier, time_t now) {
+    int shift = tier->failures < 8 ? tier->failures : 8;
+    int retry = TRACKER_RETRY_SECONDS << shift;
+    if (retry > TRACKER_DEFAULT_INTERVAL) retry = TRACKER_DEFAULT_INTERVAL;
+    tier->failures++;
+    tier->announcing = false;
+    tier->next_announce = now + retry;
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[TrackerManager] No tracker in tier %d answered (%d rounds in a row), retrying in %d s.\n",
+            (int)(tier - tiers), tier->failures, retry);
+    }
+}
+
+int tracker_manager_init(const Torrent *torrent, const unsigned char *peer_id, int port) {
+    tracker_manager_destroy();
+    if (!torrent) return -1;
+
+    bool use_list = torrent->announce_list_count > 0 && torrent->announce_list && torrent->announce_tiers;
+    int count = use_list ? torrent->announce_list_count : (torrent->announce ? 1 : 0);
+    if (count == 0) return 0;
+
+    trackers = calloc(count, sizeof(TrackerEntry));
+    tiers = calloc(count, sizeof(TrackerTier));
+    tier_order = calloc(count, sizeof(int));
+    if (!trackers || !tiers || !tier_order) {
+        tracker_manager_destroy();
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        trackers[i].url = strdup(use_list ? torrent->announce_list[i] : torrent->announce);
+        if (!trackers[i].url) {
+            num_trackers = i;
+            tracker_manager_destroy();
+            return -1;
+        }
+        // The parser keeps each tier's trackers together, so a new tier starts wherever the tier number changes
+        if (i == 0 || (use_list && torrent->announce_tiers[i] != torrent->announce_tiers[i - 1])) {
+            tiers[num_tiers++].order = &tier_order[i];
+        }
+        TrackerTier *tier = &tiers[num_tiers - 1];
+        tier->swarm_size = -1;
+        trackers[i].tier = num_tiers - 1;
+        tier->order[tier->count++] = i;
+    }
+    num_trackers = count;
+
+    // BEP 12: shuffle each tier once, then keep the order responses establish. Seeded per run (rand() never is),
+    // so clients don't all try the same tracker first.
+    unsigned int seed = (unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16);
+    for (int t = 0; t < num_tiers; t++) {
+        for (int i = tiers[t].count - 1; i > 0; i--) {
+            int j = rand_r(&seed) % (i + 1);
+            int swap = tiers[t].order[i];
+            tiers[t].order[i] = tiers[t].order[j];
+            tiers[t].order[j] = swap;
+        }
+    }
+
+    memcpy(announce_info_hash, torrent->info_hash, sizeof(announce_info_hash));
+    memcpy(announce_peer_id, peer_id, sizeof(announce_peer_id));
+    announce_port = port;
+
+    if (tracker_client_init() != 0 && get_args().debug_mode) {
+        fprintf(stderr, "[TrackerManager] Warning: No announce threads, announcing synchronously.\n");
+    }
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[TrackerManager] %d trackers in %d tiers.\n", num_trackers, num_tiers);
+        for (int i = 0; i < num_trackers; i++) {
+            fprintf(stderr, "[TrackerManager]   tier %d: %s\n", trackers[i].tier, trackers[i].url);
+        }
+    }
+    return num_trackers;
+}
+
+void tracker_manager_destroy(void) {
+    tracker_client_destroy();
+    for (int i = 0; i < num_trackers; i++) {
+        free(trackers[i].url);
+    }
+    free(trackers);
+    free(tiers);
+    free(tier_order);
+    trackers = NULL;
+    tiers = NULL;
+    tier_order = NULL;
+    num_trackers = 0;
+    num_tiers = 0;
+}
+
+// Whether a tier that is between announces should announce now: its interval is up, or we want peers, its min
+// interval is up (doubling with each early announce in a row, in case it keeps handing out the same peers), and
+// its last answer didn't show it has run out of peers to give
+static bool announce_due(const TrackerTier *tier, time_t now, int peers_wanted) {
+    if (now >= tier->next_announce) return true;
+    if (peers_wanted <= 0 || tier->exhausted || tier->last_answer == 0) return false;
+    long min_interval = tier->min_interval > 0 ? tier->min_interval : TRACKER_DEFAULT_MIN_INTERVAL;
+    min_interval <<= tier->early_rounds < 8 ? tier->early_rounds : 8;
+    return now - tier->last_answer >= min_interval;
+}
+
+// Refresh a tier's swarm size from its lead tracker when it is stale and the next announce is still far off
+static void scrape_if_due(TrackerTier *tier, time_t now) {
+    int index = tier->order[0];
+    TrackerEntry *tracker = &trackers[index];
+    if (tier->announcing || tracker->scrape_in_flight || tracker->scrape_failed || tier->last_answer == 0 ||
+            now - tier->swarm_updated < TRACKER_SCRAPE_INTERVAL || tier->next_announce - now < TRACKER_SCRAPE_INTERVAL) {
+        return;
+    }
+    if (tracker_scrape_async(SCRAPE_TAG(index), tracker->url, announce_info_hash) == 0) {
+        tracker->scrape_in_flight = true;
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[TrackerManager] Scraping %s (tier %d).\n", tracker->url, tracker->tier);
+        }
+    }
+}
+
+void tracker_manager_update(long uploaded, long downloaded, long left, int peers_wanted) {
+    time_t now = time(NULL);
+    int numwant = peers_wanted < 0 ? 0 : (peers_wanted > TRACKER_NUMWANT_MAX ? TRACKER_NUMWANT_MAX : peers_wanted);
+    for (int t = 0; t < num_tiers; t++) {
+        TrackerTier *tier = &tiers[t];
+        if (!tier->announcing) {
+            if (!announce_due(tier, now, peers_wanted)) {
+                scrape_if_due(tier, now);
+                continue;
+            }
+            tier->early_rounds = now >= tier->next_announce ? 0 : tier->early_rounds + 1;
+            tier->announcing = true;
+            tier->next_try = 0;
+            tier->numwant = numwant;
+        }
+
+        // Try the next tracker when none in the tier is running, or alongside one that has gone quiet
+        int running = tier_in_flight(tier);
+        if (running == 0 || now - tier->last_launch >= TRACKER_HEDGE_SECONDS) {
+            while (tier->next_try < tier->count) {
+                int index = tier->order[tier->next_try++];
+                if (trackers[index].in_flight) continue;    // Still busy from an earlier round
+                if (tracker_announce_async(index, trackers[index].url, announce_info_hash, announce_peer_id,
+                        announce_port, uploaded, downloaded, left, tier->numwant) == 0) {
+                    trackers[index].in_flight = true;
+                    tier->last_launch = now;
+                    running++;
+                    if (get_args().debug_mode) {
+                        fprintf(stderr, "[TrackerManager] Announcing to %s (tier %d), asking for %d peers.\n",
+                            trackers[index].url, t, tier->numwant);
+                    }
+                    break;
+                }
+            }
+        }
+        if (running == 0 && tier->next_try >= tier->count) {
+            tier_failed(tier, now);
+        }
+    }
+}
+
+// Take in a scrape result for tracker index (status as from tracker_poll_announce)
+static void scrape_done(int index, int status, const TrackerResponse *result) {
+    TrackerEntry *tracker = &trackers[index];
+    TrackerTier *tier = &tiers[tracker->tier];
+    tracker->scrape_in_flight = false;
+    if (status < 0) {
+        tracker->scrape_failed = true;
+        if (get_args().debug_mode) {
+            fprintf(stderr, "[TrackerManager] Scrape of %s failed, not scraping it again.\n", tracker->url);
+        }
+        return;
+    }
+    tier->swarm_size = result->complete + result->incomplete;
+    tier->swarm_updated = time(NULL);
+    if (get_args().debug_mode) {
+        fprintf(stderr, "[TrackerManager] %s reports %d seeders and %d leechers.\n", tracker->url,
+            result->complete, result->incomplete);
+    }
+}
+
+bool tracker_manager_poll(TrackerResponse *response) {
+    int tag;
+    TrackerResponse result = {0};
+    int status;
+    while ((status = tracker_poll_announce(&tag, &result)) != 0) {
+        if (tag >= num_trackers && tag < SCRAPE_TAG(num_trackers)) {
+            scrape_done(tag - num_trackers, status, &result);
+            free_tracker_response(&result);
+            continue;
+        }
+        if (tag < 0 || tag >= num_trackers) {
+            free_tracker_response(&result);
+            continue;
+        }
+        TrackerEntry *tracker = &trackers[tag];
+        TrackerTier *tier = &tiers[tracker->tier];
+        tracker->in_flight = false;
+
+        if (status < 0) {
+            if (get_args().debug_mode) {
+                fprintf(stderr, "[TrackerManager] Announce to %s failed.\n", tracker->url);
+            }
+            continue;
+        }
+        if (tier->announcing) {
+            // First answer this round: it leads the tier from now on and sets when the tier announces next
+            int interval = result.interval > 0 ? result.interval : TRACKER_DEFAULT_INTERVAL;
+            time_t now = time(NULL);
+            promote(tier, tag);
+            tier->announcing = false;
+            tier->failures = 0;
+            tier->next_announce = now + interval;
+            tier->last_answer = now;
+            tier->min_interval = result.min_interval;
+            tier->exhausted = result.num_peers < tier->numwant;
+            if (result.complete >= 0 && result.incomplete >= 0) {
+                tier->swarm_size = result.complete + result.incomplete;
+                tier->swarm_updated = now;
+            }
+            if (get_args().debug_mode) {
+                fprintf(stderr, "[TrackerManager] %s answered with %d of %d peers asked for, tier %d announces again in %d s%s.\n",
+                    tracker->url, result.num_peers, tier->numwant, tracker->tier, interval,
+                    tier->exhausted ? "" : " (sooner if we need peers)");
+            }
+        }
+        *response = result;
+        return true;
+    }
+    return false;
+}
+
+long tracker_manager_seconds_until_announce(void) {
+    time_t now = time(NULL);
+    long soonest = -1;
+    for (int t = 0; t < num_tiers; t++) {
+        long wait = tiers[t].announcing ? 0 : tiers[t].next_announce - now;
+        if (wait < 0) wait = 0;
+        if (soonest < 0 || wait < soonest) soonest = wait;
+    }
+    return soonest < 0 ? 0 : soonest;
+}
+
+int tracker_manager_swarm_size(void) {
+    int largest = -1;
+    for (int t = 0; t < num_tiers; t++) {
+        if (tiers[t].swarm_size > largest) largest = tiers[t].swarm_size;
+    }
+    return largest;
+}
+
+bool tracker_manager_busy(void) {
+    return tracker_announces_in_flight() > 0;
+}
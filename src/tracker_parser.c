@@ -0,0 +1,372 @@
+#define _GNU_SOURCE     // For memmem
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "tracker_parser.h"
+#include "bencode.h"
+#include "btclient.h"   // For get_args() for debug mode
+
+enum {
+    PARSE_HEADERS,
+    PARSE_BODY,                     // Content-Length, or until the connection closes
+    PARSE_CHUNK_SIZE,
+    PARSE_CHUNK_DATA,
+    PARSE_CHUNK_END,                // The CRLF after a chunk's data
+    PARSE_TRAILERS,
+    PARSE_DONE
+};
+
+// read how a response is framed (Content-Length or chunked, else it ends when the connection closes)
+// and whether the tracker keeps the connection open afterwards
+static void parse_http_headers(HttpResponseParser *parser, const char *headers, size_t len) {
+    parser->keep_alive = len >= 8 && memcmp(headers, "HTTP/1.1", 8) == 0;    // HTTP/1.0 closes unless asked not to
+    const char *line = headers;
+    const char *end = headers + len;
+    while (line < end) {
+        const char *line_end = memmem(line, end - line, "\r\n", 2);
+        if (!line_end) {
+            line_end = end;
+        }
+        // header names and the values we look for are case-insensitive
+        char lower[256];
+        size_t line_len = line_end - line < (long)sizeof(lower) - 1 ? (size_t)(line_end - line) : sizeof(lower) - 1;
+        for (size_t i = 0; i < line_len; i++) {
+            lower[i] = tolower((unsigned char)line[i]);
+        }
+        lower[line_len] = '\0';
+        if (strncmp(lower, "content-length:", 15) == 0) {
+            parser->content_length = strtol(lower + 15, NULL, 10);
+        } else if (strncmp(lower, "transfer-encoding:", 18) == 0 && strstr(lower + 18, "chunked")) {
+            parser->chunked = true;
+        } else if (strncmp(lower, "connection:", 11) == 0) {
+            if (strstr(lower + 11, "close")) {
+                parser->keep_alive = false;
+            } else if (strstr(lower + 11, "keep-alive")) {
+                parser->keep_alive = true;
+            }
+        }
+        line = line_end + 2;
+    }
+}
+
+void http_parser_init(HttpResponseParser *parser) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = PARSE_HEADERS;
+    parser->content_length = -1;
+}
+
+// Take one line of chunk framing: a chunk's size line, the CRLF after its data, or a trailer
+static int parse_chunk_line(HttpResponseParser *parser, const char *line, size_t line_len) {
+    if (parser->state == PARSE_CHUNK_SIZE) {
+        // hex size, possibly followed by extensions after ';'
+        size_t size = 0, i = 0;
+        for (; i < line_len && isxdigit((unsigned char)line[i]); i++) {
+            size = size * 16 + (isdigit((unsigned char)line[i]) ? line[i] - '0' : (tolower((unsigned char)line[i]) - 'a' + 10));
+            if (size > TRACKER_MAX_RESPONSE_BYTES) {
+                return -1;
+            }
+        }
+        if (i == 0 || (i < line_len && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+            return -1;
+        }
+        parser->chunk_left = size;
+        parser->state = size > 0 ? PARSE_CHUNK_DATA : PARSE_TRAILERS;
+    } else if (parser->state == PARSE_CHUNK_END) {
+        if (line_len != 0) {
+            return -1;
+        }
+        parser->state = PARSE_CHUNK_SIZE;
+    } else if (line_len == 0) {
+        parser->state = PARSE_DONE;     // The empty line ending the trailers
+    }
+    return 0;
+}
+
+int http_parser_feed(HttpResponseParser *parser, char *buf, size_t *len) {
+    if (parser->state == PARSE_DONE) {
+        return 1;
+    }
+    if (parser->state == PARSE_HEADERS) {
+        // the blank line ending the headers may have started in the bytes looked at last time
+        size_t from = parser->scanned >= 3 ? parser->scanned - 3 : 0;
+        const char *blank_line = memmem(buf + from, *len - from, "\r\n\r\n", 4);
+        if (!blank_line) {
+            parser->scanned = *len;
+            return 0;
+        }
+        parser->body_start = blank_line - buf + 4;
+        parser->scanned = parser->body_start;
+        parse_http_headers(parser, buf, parser->body_start);
+        parser->state = parser->chunked ? PARSE_CHUNK_SIZE : PARSE_BODY;
+    }
+
+    if (parser->state == PARSE_BODY) {
+        parser->body_len = *len - parser->body_start;
+        parser->scanned = *len;
+        if (parser->content_length >= 0 && parser->body_len >= (size_t)parser->content_length) {
+            // bytes past the body mean we can't tell where the next response would start
+            parser->keep_alive = parser->keep_alive && parser->body_len == (size_t)parser->content_length;
+            parser->body_len = parser->content_length;
+            parser->state = PARSE_DONE;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Chunked: the body so far sits at body_start, the bytes from scanned on are still to be parsed
+    while (parser->state != PARSE_DONE) {
+        char *raw = buf + parser->scanned;
+        size_t available = *len - parser->scanned;
+        if (parser->state == PARSE_CHUNK_DATA) {
+            if (available == 0) {
+                break;
+            }
+            size_t take = available < parser->chunk_left ? available : parser->chunk_left;
+            memmove(buf + parser->body_start + parser->body_len, raw, take);
+            parser->body_len += take;
+            parser->chunk_left -= take;
+            parser->scanned += take;
+            if (parser->chunk_left == 0) {
+                parser->state = PARSE_CHUNK_END;
+            }
+            continue;
+        }
+        const char *line_end = memmem(raw, available, "\r\n", 2);
+        if (!line_end) {
+            break;
+        }
+        if (parse_chunk_line(parser, raw, line_end - raw) != 0) {
+            return -1;
+        }
+        parser->scanned += line_end - raw + 2;
+    }
+
+    // Drop the framing parsed so far, so the unparsed rest (at most part of a line) follows the body
+    size_t body_end = parser->body_start + parser->body_len;
+    size_t rest = *len - parser->scanned;
+    if (parser->scanned > body_end) {
+        memmove(buf + body_end, buf + parser->scanned, rest);
+        parser->scanned = body_end;
+        *len = body_end + rest;
+    }
+    if (parser->state == PARSE_DONE) {
+        parser->keep_alive = parser->keep_alive && rest == 0;
+        return 1;
+    }
+    return 0;
+}
+
+size_t http_parser_expected_size(const HttpResponseParser *parser) {
+    if (parser->state != PARSE_BODY || parser->content_length < 0) {
+        return 0;
+    }
+    return parser->body_start + parser->content_length;
+}
+
+int http_parser_finish(HttpResponseParser *parser) {
+    if (parser->state != PARSE_BODY || parser->content_length >= 0) {
+        return -1;
+    }
+    // no framing: the body ran until the tracker closed the connection
+    parser->keep_alive = false;
+    parser->state = PARSE_DONE;
+    return 1;
+}
+
+int parse_response(TrackerResponse *out, const char *body, size_t body_len) {
+    TrackerResponse response = {0};
+    // set values to -1 if following data isn't given in response
+    // (complete and incomplete values can be received from scrape request later)
+    response.complete = -1;      
+    response.incomplete = -1;
+
+    bool failed = false;
+
+    bencode_t ben, ben_item;
+    bencode_init(&ben, body, (int) body_len);
+    if (!bencode_is_dict(&ben)) {
+        return -1;
+    }
+    const char *key;
+    int key_len;
+
+    while (bencode_dict_has_next(&ben)) {
+        if (!bencode_dict_get_next(&ben, &ben_item, &key, &key_len)) {
+            break;
+        }
+        if (key_len == 14 && strncmp(key, "failure reason", 14) == 0 && bencode_is_string(&ben_item)) {
+            const char *reason;
+            int reason_len;
+            bencode_string_value(&ben_item, &reason, &reason_len);
+            if (get_args().debug_mode) {
+                fprintf(stderr, "[TRACKER] Tracker refused the announce: %.*s\n", reason_len, reason);
+            }
+            failed = true;
+        } else if (key_len == 8 && strncmp(key, "interval", 8) == 0 && bencode_is_int(&ben_item)) {
+            long interval;
+            bencode_int_value(&ben_item, &interval);
+            response.interval = interval;
+        } else if (key_len == 12 && strncmp(key, "min interval", 12) == 0 && bencode_is_int(&ben_item)) {
+            long min_interval;
+            bencode_int_value(&ben_item, &min_interval);
+            response.min_interval = min_interval;
+        } else if (key_len == 8 && strncmp(key, "complete", 8) == 0 && bencode_is_int(&ben_item)) {
+            long complete;
+            bencode_int_value(&ben_item, &complete);
+            response.complete = complete;
+        } else if (key_len == 10 && strncmp(key, "incomplete", 10) == 0 && bencode_is_int(&ben_item)) {
+            long incomplete;
+            bencode_int_value(&ben_item, &incomplete);
+            response.incomplete = incomplete;
+        // binary model peers
+        } else if (key_len == 5 && strncmp(key, "peers", 5) == 0 && bencode_is_string(&ben_item)) {
+            const char *peers;
+            int len;
+            bencode_string_value(&ben_item, &peers, &len);
+            if (len < 0 || peers < body || peers + len > body + body_len || response.peers) {
+                failed = true;      // A length running past the body, or a second peer list
+                break;
+            }
+            // 6 bytes per peer (address then port, network byte order), read straight from the body
+            int num_peers = len / 6;
+            response.peers = malloc((num_peers + 1) * sizeof(PeerEndpoint));
+            if (!response.peers) {
+                failed = true;
+                break;
+            }
+            const unsigned char *pos = (const unsigned char *)peers;
+            for (int i = 0; i < num_peers; i++, pos += 6) {
+                response.peers[i].address = (uint32_t)pos[0] << 24 | (uint32_t)pos[1] << 16 | (uint32_t)pos[2] << 8 | pos[3];
+                response.peers[i].port = (uint16_t)(pos[4] << 8 | pos[5]);
+            }
+            response.num_peers = num_peers;
+        // dictionary model peers
+        } else if (key_len == 5 && strncmp(key, "peers", 5) == 0 && bencode_is_list(&ben_item)) {
+            bencode_t peers = ben_item;
+            int num_peers = 0;
+            while (bencode_list_has_next(&peers)) {
+                bencode_t peer;
+                bencode_list_get_next(&peers, &peer);
+                num_peers++;
+            }
+            if (response.peers) {
+                failed = true;
+                break;
+            }
+            response.peers = calloc(num_peers + 1, sizeof(PeerEndpoint));
+            if (!response.peers) {
+                failed = true;
+                break;
+            }
+            response.num_peers = num_peers;
+
+            peers = ben_item;
+            int i = 0;
+            while (bencode_list_has_next(&peers)) {
+                bencode_t peer;
+                bencode_list_get_next(&peers, &peer);
+                while (bencode_dict_has_next(&peer)) {
+                    bencode_t field;
+                    const char *field_key;
+                    int field_key_len;
+                    bencode_dict_get_next(&peer, &field, &field_key, &field_key_len);
+                    // ip address
+                    if (field_key_len == 2 && strncmp(field_key, "ip", 2) == 0 && bencode_is_string(&field)) {
+                        const char *ip_string;
+                        int ip_len;
+                        bencode_string_value(&field, &ip_string, &ip_len);
+                        char addr_buf[16] = {0};
+                        struct in_addr addr;
+                        if (ip_len > 0 && ip_len < (int)sizeof(addr_buf)) {
+                            memcpy(addr_buf, ip_string, ip_len);
+                            if (inet_aton(addr_buf, &addr)) {
+                                response.peers[i].address = ntohl(addr.s_addr);
+                            }
+                        }
+                    }
+                    // port
+                    if (field_key_len == 4 && strncmp(field_key, "port", 4) == 0 && bencode_is_int(&field)) {
+                        long port;
+                        bencode_int_value(&field, &port);
+                        response.peers[i].port = (uint16_t) port;
+                    }
+                }
+                i++;
+            }
+        }
+    }
+
+    if (failed) {
+        free_tracker_response(&response);
+        return -1;
+    }
+    *out = response;
+    return 0;
+}
+
+void parse_scrape_response(const char *body, size_t body_len, const unsigned char (*info_hashes)[20], int count,
+        ScrapeResult *results) {
+    bencode_t ben, ben_item;
+    bencode_init(&ben, body, (int) body_len);
+    const char *key;
+    int key_len;
+    while (bencode_dict_has_next(&ben)) {
+        if (!bencode_dict_get_next(&ben, &ben_item, &key, &key_len)) {
+            break;
+        }
+        if (key_len == 5 && strncmp(key, "files", 5) == 0 && bencode_is_dict(&ben_item)) {
+            bencode_t files = ben_item;
+            while (bencode_dict_has_next(&files)) {
+                bencode_t info_entry;
+                const char *info_key;
+                int info_len;
+                if (!bencode_dict_get_next(&files, &info_entry, &info_key, &info_len)) {
+                    break;
+                }
+                // files are keyed by raw info hash
+                ScrapeResult *result = NULL;
+                for (int i = 0; i < count && info_len == 20; i++) {
+                    if (memcmp(info_key, info_hashes[i], 20) == 0) {
+                        result = &results[i];
+                        break;
+                    }
+                }
+                if (!result || !bencode_is_dict(&info_entry)) {
+                    continue;
+                }
+                bencode_t stats = info_entry;
+                while (bencode_dict_has_next(&stats)) {
+                    bencode_t field;
+                    const char *field_key;
+                    int field_key_len;
+
+                    if (!bencode_dict_get_next(&stats, &field, &field_key, &field_key_len)) {
+                        break;
+                    }
+                    if (!bencode_is_int(&field)) {
+                        continue;
+                    }
+                    long value;
+                    bencode_int_value(&field, &value);
+                    if (field_key_len == 8 && strncmp(field_key, "complete", 8) == 0) {
+                        result->complete = value;
+                    } else if (field_key_len == 10 && strncmp(field_key, "downloaded", 10) == 0) {
+                        result->downloaded = value;
+                    } else if (field_key_len == 10 && strncmp(field_key, "incomplete", 10) == 0) {
+                        result->incomplete = value;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void free_tracker_response(TrackerResponse *response) {
+    if (response->peers) {
+        free(response->peers);
+    }
+    memset(response, 0, sizeof(*response));
+}